@@ -0,0 +1,292 @@
+//! Rasterized glyphs, found by codepoint and style. Colour glyphs and
+//! subpixel glyphs, whose channels are separate coverages, are kept in one
+//! large ARGB pixman image, the sheet: drawing one is a composite from a
+//! rectangle of it, with no rasterizer lookup and no per-glyph image.
+//! Coverage glyphs are drawn in whole runs from pixman's glyph cache, which
+//! holds their pixels, so the atlas keeps only their metrics.
+//!
+//! ASCII is in a direct-mapped table, everything else in a hash map.
+//! Codepoints the font has no glyph for are remembered as missing, so they
+//! are not rasterized again.
+//!
+//! The sheet is packed in shelves. A full sheet is emptied and starts over, its
+//! glyphs are rasterized again when next drawn. Entries name the generation of
+//! the sheet they were copied into, so emptying it touches no entry.
+//! The sheet takes the byte budget given to init.
+const std = @import("std");
+const c = @import("c.zig");
+const Allocator = std.mem.Allocator;
+
+/// Face variant a glyph was rasterized with.
+pub const Style = u2;
+const styles = 1 << @bitSizeOf(Style);
+
+pub const Kind = enum(u8) {
+    unknown, // not rasterized yet
+    missing, // the font has no glyph
+    mask, // coverage in pixman's glyph cache, drawn with the text colour by the caller
+    color, // pixels in the ARGB sheet, drawn as they are
+    subpixel, // coverage per channel in the ARGB sheet, drawn with the text colour
+};
+
+pub const Glyph = struct {
+    kind: Kind = .unknown,
+    gen: u32 = 0, // generation of the sheet holding it
+    x: u16 = 0, // position in the sheet
+    y: u16 = 0,
+    width: u16 = 0,
+    height: u16 = 0,
+    left: i16 = 0, // offset of the image from the pen and the baseline
+    top: i16 = 0,
+    advance: i16 = 0,
+};
+
+const Sheet = struct {
+    image: *c.pixman_image_t,
+    width: u16,
+    height: u16,
+    gen: u32 = 1,
+    // glyphs go left to right on a shelf, a full shelf opens one below it
+    shelf_y: u16 = 0,
+    shelf_h: u16 = 0,
+    pen_x: u16 = 0,
+
+    fn init(format: c.pixman_format_code_t, width: u16, height: u16) !Sheet {
+        const image = c.pixman_image_create_bits(format, width, height, null, 0) orelse
+            return error.PixmanImageCreateFailed;
+        return .{ .image = image, .width = width, .height = height };
+    }
+
+    fn deinit(self: *Sheet) void {
+        _ = c.pixman_image_unref(self.image);
+    }
+
+    fn alloc(self: *Sheet, w: u16, h: u16) ?[2]u16 {
+        if (self.pen_x + @as(u32, w) > self.width) {
+            self.shelf_y += self.shelf_h;
+            self.shelf_h = 0;
+            self.pen_x = 0;
+        }
+        if (self.shelf_y + @as(u32, h) > self.height) return null;
+        const at = [2]u16{ self.pen_x, self.shelf_y };
+        self.pen_x += w;
+        self.shelf_h = @max(self.shelf_h, h);
+        return at;
+    }
+
+    fn reset(self: *Sheet) void {
+        self.gen +%= 1;
+        self.shelf_y = 0;
+        self.shelf_h = 0;
+        self.pen_x = 0;
+    }
+};
+
+pub const Atlas = struct {
+    pub const sheet_width = 1024;
+    /// non-ASCII entries kept before the map starts over
+    pub const max_others = 1 << 16;
+
+    allocator: Allocator,
+    color: Sheet,
+    ascii: [styles][128]Glyph = [_][128]Glyph{[_]Glyph{.{}} ** 128} ** styles,
+    others: std.AutoHashMapUnmanaged(u32, Glyph) = .empty,
+    evictions: u32 = 0, // sheets emptied to make room
+
+    pub fn init(allocator: Allocator, budget: usize) !Atlas {
+        // at least a shelf of large glyphs
+        const rows: u16 = @intCast(std.math.clamp(budget / (sheet_width * 4), 128, std.math.maxInt(u16)));
+        const color = try Sheet.init(c.PIXMAN_a8r8g8b8, sheet_width, rows);
+        return .{ .allocator = allocator, .color = color };
+    }
+
+    pub fn deinit(self: *Atlas) void {
+        self.color.deinit();
+        self.others.deinit(self.allocator);
+    }
+
+    inline fn key(cp: u32, style: Style) u32 {
+        return cp | @as(u32, style) << 21;
+    }
+
+    /// The glyph of cp, .missing included, null when it has to be rasterized.
+    pub inline fn lookup(self: *const Atlas, cp: u32, style: Style) ?Glyph {
+        const g = if (cp < 0x80)
+            self.ascii[style][cp]
+        else
+            self.others.get(key(cp, style)) orelse return null;
+        return switch (g.kind) {
+            .unknown => null,
+            .missing => g,
+            .mask => g,
+            .color, .subpixel => if (g.gen == self.color.gen) g else null,
+        };
+    }
+
+    /// Remembers that the font has no glyph for cp.
+    pub fn addMissing(self: *Atlas, cp: u32, style: Style) void {
+        self.put(cp, style, .{ .kind = .missing }) catch |err| {
+            std.log.warn("glyph atlas insert failed: {}", .{err});
+        };
+    }
+
+    /// Records a rasterized glyph. Images with component alpha, fcft's subpixel
+    /// glyphs, and A8R8G8B8 images are copied into the sheet, a full sheet is
+    /// emptied first and glyphs larger than it are not cached. Any other
+    /// format is coverage and only its metrics are kept.
+    pub fn add(self: *Atlas, cp: u32, style: Style, pix: *c.pixman_image_t, left: i32, top: i32, advance: i32) !Glyph {
+        const w: u16 = @intCast(c.pixman_image_get_width(pix));
+        const h: u16 = @intCast(c.pixman_image_get_height(pix));
+        // an x8r8g8b8 image as A8 would be a solid box, its coverage is in the channels
+        const kind: Kind = if (c.pixman_image_get_component_alpha(pix) != 0)
+            .subpixel
+        else if (c.pixman_image_get_format(pix) == c.PIXMAN_a8r8g8b8)
+            .color
+        else
+            .mask;
+        var g = Glyph{
+            .kind = kind,
+            .width = w,
+            .height = h,
+            .left = std.math.lossyCast(i16, left),
+            .top = std.math.lossyCast(i16, top),
+            .advance = std.math.lossyCast(i16, advance),
+        };
+        if (kind != .mask) {
+            const sheet = &self.color;
+            if (w > sheet.width or h > sheet.height) return error.GlyphTooLarge;
+            const at = sheet.alloc(w, h) orelse blk: {
+                sheet.reset();
+                self.evictions += 1;
+                break :blk sheet.alloc(w, h).?;
+            };
+            c.pixman_image_composite32(c.PIXMAN_OP_SRC, pix, null, sheet.image, 0, 0, 0, 0, @intCast(at[0]), @intCast(at[1]), w, h);
+            g.gen = sheet.gen;
+            g.x = at[0];
+            g.y = at[1];
+        }
+        try self.put(cp, style, g);
+        return g;
+    }
+
+    fn put(self: *Atlas, cp: u32, style: Style, g: Glyph) !void {
+        if (cp < 0x80) {
+            self.ascii[style][cp] = g;
+            return;
+        }
+        if (self.others.count() >= max_others) self.others.clearRetainingCapacity();
+        try self.others.put(self.allocator, key(cp, style), g);
+    }
+
+    /// Composites g with its pen at (x, baseline), fill colours subpixel
+    /// glyphs. Coverage glyphs are not in the sheet, the caller draws them.
+    pub inline fn draw(self: *const Atlas, g: Glyph, dst: *c.pixman_image_t, fill: *c.pixman_image_t, x: i32, baseline: i32) void {
+        const dx = x + g.left;
+        const dy = baseline - g.top;
+        switch (g.kind) {
+            .color => c.pixman_image_composite32(c.PIXMAN_OP_OVER, self.color.image, null, dst, g.x, g.y, 0, 0, dx, dy, g.width, g.height),
+            .subpixel => {
+                // the sheet is a component alpha mask only for this composite
+                c.pixman_image_set_component_alpha(self.color.image, 1);
+                defer c.pixman_image_set_component_alpha(self.color.image, 0);
+                c.pixman_image_composite32(c.PIXMAN_OP_OVER, fill, self.color.image, dst, 0, 0, g.x, g.y, dx, dy, g.width, g.height);
+            },
+            .unknown, .missing, .mask => {},
+        }
+    }
+};
+
+const testing = std.testing;
+
+fn testImage(format: c.pixman_format_code_t, w: u16, h: u16, argb: u32) !*c.pixman_image_t {
+    const image = c.pixman_image_create_bits(format, w, h, null, 0) orelse return error.PixmanImageCreateFailed;
+    const channel = struct {
+        fn of(value: u32, shift: u5) u16 {
+            return @as(u16, @as(u8, @truncate(value >> shift))) * 257;
+        }
+    };
+    const color = c.pixman_color_t{
+        .red = channel.of(argb, 16),
+        .green = channel.of(argb, 8),
+        .blue = channel.of(argb, 0),
+        .alpha = channel.of(argb, 24),
+    };
+    const rect = c.pixman_rectangle16_t{ .x = 0, .y = 0, .width = w, .height = h };
+    _ = c.pixman_image_fill_rectangles(c.PIXMAN_OP_SRC, image, &color, 1, &rect);
+    return image;
+}
+
+test "Atlas: lookup, missing and eviction" {
+    // the smallest sheet, 128 rows
+    var atlas = try Atlas.init(testing.allocator, 0);
+    defer atlas.deinit();
+
+    try testing.expectEqual(null, atlas.lookup('a', 0));
+    const a8 = try testImage(c.PIXMAN_a8, 7, 12, 0xff000000);
+    defer _ = c.pixman_image_unref(a8);
+    // coverage keeps its metrics only, pixman's glyph cache has the pixels
+    const g = try atlas.add('a', 0, a8, 1, 10, 8);
+    try testing.expectEqual(Kind.mask, g.kind);
+    try testing.expectEqual(g, atlas.lookup('a', 0).?);
+    try testing.expectEqual(0, atlas.color.pen_x);
+    // styles are separate glyphs
+    try testing.expectEqual(null, atlas.lookup('a', 1));
+
+    // non-ASCII goes through the map, colour images to the ARGB sheet
+    const argb = try testImage(c.PIXMAN_a8r8g8b8, 16, 16, 0xff20a040);
+    defer _ = c.pixman_image_unref(argb);
+    const emoji = try atlas.add(0x1F600, 0, argb, 0, 14, 16);
+    try testing.expectEqual(Kind.color, emoji.kind);
+    try testing.expectEqual(emoji, atlas.lookup(0x1F600, 0).?);
+
+    atlas.addMissing(0xE000, 0);
+    try testing.expectEqual(Kind.missing, atlas.lookup(0xE000, 0).?.kind);
+
+    // drawing copies the pixels as they are
+    const dst = try testImage(c.PIXMAN_a8r8g8b8, 32, 32, 0xff000000);
+    defer _ = c.pixman_image_unref(dst);
+    const white = c.pixman_color_t{ .red = 0xffff, .green = 0xffff, .blue = 0xffff, .alpha = 0xffff };
+    const fill = c.pixman_image_create_solid_fill(&white).?;
+    defer _ = c.pixman_image_unref(fill);
+    atlas.draw(emoji, dst, fill, 4, 20);
+    const pixels: [*]const u32 = @ptrCast(@alignCast(c.pixman_image_get_data(dst)));
+    const stride: usize = @intCast(@divExact(c.pixman_image_get_stride(dst), 4));
+    try testing.expectEqual(0xff20a040, pixels[10 * stride + 5]);
+    try testing.expectEqual(0xff000000, pixels[10 * stride + 3]);
+
+    // filling the sheet empties it, the glyphs in it are gone
+    const rows = atlas.color.height / 16;
+    const per_row = Atlas.sheet_width / 16;
+    for (0..rows * per_row + 1) |i| _ = try atlas.add(0x1F300 + @as(u32, @intCast(i)), 0, argb, 0, 0, 16);
+    try testing.expectEqual(1, atlas.evictions);
+    try testing.expectEqual(null, atlas.lookup(0x1F600, 0));
+    // coverage and the negative entries stay
+    try testing.expectEqual(g, atlas.lookup('a', 0).?);
+    try testing.expectEqual(Kind.missing, atlas.lookup(0xE000, 0).?.kind);
+}
+
+test "Atlas: subpixel glyphs keep their channels" {
+    var atlas = try Atlas.init(testing.allocator, 0);
+    defer atlas.deinit();
+
+    // fcft's subpixel glyphs: x8r8g8b8 with component alpha, full red coverage only
+    const rgb = try testImage(c.PIXMAN_x8r8g8b8, 4, 4, 0x00ff0000);
+    defer _ = c.pixman_image_unref(rgb);
+    c.pixman_image_set_component_alpha(rgb, 1);
+    const g = try atlas.add('l', 0, rgb, 0, 4, 4);
+    try testing.expectEqual(Kind.subpixel, g.kind);
+    try testing.expectEqual(g, atlas.lookup('l', 0).?);
+
+    const dst = try testImage(c.PIXMAN_a8r8g8b8, 8, 8, 0xff000000);
+    defer _ = c.pixman_image_unref(dst);
+    const white = c.pixman_color_t{ .red = 0xffff, .green = 0xffff, .blue = 0xffff, .alpha = 0xffff };
+    const fill = c.pixman_image_create_solid_fill(&white).?;
+    defer _ = c.pixman_image_unref(fill);
+    atlas.draw(g, dst, fill, 2, 4);
+    const pixels: [*]const u32 = @ptrCast(@alignCast(c.pixman_image_get_data(dst)));
+    const stride: usize = @intCast(@divExact(c.pixman_image_get_stride(dst), 4));
+    try testing.expectEqual(0xffff0000, pixels[1 * stride + 3]);
+    try testing.expectEqual(0xff000000, pixels[1 * stride + 6]);
+    // and the sheet draws colour glyphs as they are again
+    try testing.expectEqual(0, c.pixman_image_get_component_alpha(atlas.color.image));
+}
@@ -35,6 +35,8 @@ fn addDep(
     artifact.linkSystemLibrary("xcb-renderutil");
     artifact.linkSystemLibrary("xcb-xrm");
     artifact.linkSystemLibrary("xcb-shm");
+    artifact.linkSystemLibrary("xcb-present");
+    artifact.linkSystemLibrary("xcb-xfixes");
     artifact.linkSystemLibrary2("expat", .{ .preferred_link_mode = .static });
 
     artifact.linkLibCpp();
@@ -131,6 +133,15 @@ fn addDep(
         .optimize = optimize,
     })) |zlib_dep| {
         artifact.linkLibrary(zlib_dep.artifact("z"));
+        artifact.addIncludePath(zlib_dep.path("upstream"));
+    }
+
+    if (b.lazyDependency("utf8proc", .{
+        .target = target,
+        .optimize = optimize,
+    })) |utf8proc_dep| {
+        artifact.linkLibrary(utf8proc_dep.artifact("utf8proc"));
+        artifact.addIncludePath(utf8proc_dep.path("upstream"));
     }
 
     if (b.lazyDependency("freetype", .{
@@ -11,7 +11,10 @@ pub usingnamespace @cImport({
     @cInclude("xcb/xcb_renderutil.h");
     @cInclude("xcb/xcb_xrm.h");
     @cInclude("xcb/render.h");
+    @cInclude("xcb/present.h");
     @cInclude("pixman.h");
+    @cInclude("zlib.h");
+    @cInclude("utf8proc.h");
     @cInclude("locale.h");
     @cInclude("config.h");
     // @cInclude("ft2build.h");
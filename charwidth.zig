@@ -0,0 +1,226 @@
+//! Display width of codepoints in terminal cells, from a table built at comptime.
+//!
+//! Two stages: the high bits of a codepoint pick a block of 256 widths,
+//! blocks that are all the same width are shared. Wide codepoints are the
+//! Emoji_Presentation ranges of pkg/fcft/emoji-data.txt plus the East Asian
+//! Wide and Fullwidth ranges below, zero width are combining marks and
+//! format characters.
+const std = @import("std");
+
+const assert = std.debug.assert;
+
+const Range = struct {
+    first: u21,
+    last: u21,
+    width: u2,
+};
+
+// East Asian Wide (W) and Fullwidth (F)
+const east_asian_wide = [_]Range{
+    .{ .first = 0x1100, .last = 0x115F, .width = 2 },
+    .{ .first = 0x2329, .last = 0x232A, .width = 2 },
+    .{ .first = 0x2E80, .last = 0x303E, .width = 2 },
+    .{ .first = 0x3041, .last = 0x33FF, .width = 2 },
+    .{ .first = 0x3400, .last = 0x4DBF, .width = 2 },
+    .{ .first = 0x4E00, .last = 0x9FFF, .width = 2 },
+    .{ .first = 0xA000, .last = 0xA4CF, .width = 2 },
+    .{ .first = 0xA960, .last = 0xA97F, .width = 2 },
+    .{ .first = 0xAC00, .last = 0xD7A3, .width = 2 },
+    .{ .first = 0xF900, .last = 0xFAFF, .width = 2 },
+    .{ .first = 0xFE10, .last = 0xFE19, .width = 2 },
+    .{ .first = 0xFE30, .last = 0xFE6F, .width = 2 },
+    .{ .first = 0xFF00, .last = 0xFF60, .width = 2 },
+    .{ .first = 0xFFE0, .last = 0xFFE6, .width = 2 },
+    .{ .first = 0x16FE0, .last = 0x16FE4, .width = 2 },
+    .{ .first = 0x17000, .last = 0x18AFF, .width = 2 },
+    .{ .first = 0x1B000, .last = 0x1B2FF, .width = 2 },
+    .{ .first = 0x1F200, .last = 0x1F202, .width = 2 },
+    .{ .first = 0x1F210, .last = 0x1F23B, .width = 2 },
+    .{ .first = 0x1F240, .last = 0x1F248, .width = 2 },
+    .{ .first = 0x1F250, .last = 0x1F251, .width = 2 },
+    .{ .first = 0x20000, .last = 0x2FFFD, .width = 2 },
+    .{ .first = 0x30000, .last = 0x3FFFD, .width = 2 },
+};
+
+// combining marks, joiners, variation selectors and other format characters
+const zero_width = [_]Range{
+    .{ .first = 0x0300, .last = 0x036F, .width = 0 },
+    .{ .first = 0x0483, .last = 0x0489, .width = 0 },
+    .{ .first = 0x0591, .last = 0x05BD, .width = 0 },
+    .{ .first = 0x05BF, .last = 0x05BF, .width = 0 },
+    .{ .first = 0x05C1, .last = 0x05C2, .width = 0 },
+    .{ .first = 0x05C4, .last = 0x05C5, .width = 0 },
+    .{ .first = 0x05C7, .last = 0x05C7, .width = 0 },
+    .{ .first = 0x0610, .last = 0x061A, .width = 0 },
+    .{ .first = 0x064B, .last = 0x065F, .width = 0 },
+    .{ .first = 0x0670, .last = 0x0670, .width = 0 },
+    .{ .first = 0x06D6, .last = 0x06DC, .width = 0 },
+    .{ .first = 0x06DF, .last = 0x06E4, .width = 0 },
+    .{ .first = 0x06E7, .last = 0x06E8, .width = 0 },
+    .{ .first = 0x06EA, .last = 0x06ED, .width = 0 },
+    .{ .first = 0x0E31, .last = 0x0E31, .width = 0 },
+    .{ .first = 0x0E34, .last = 0x0E3A, .width = 0 },
+    .{ .first = 0x0E47, .last = 0x0E4E, .width = 0 },
+    .{ .first = 0x1160, .last = 0x11FF, .width = 0 },
+    .{ .first = 0x1AB0, .last = 0x1AFF, .width = 0 },
+    .{ .first = 0x1DC0, .last = 0x1DFF, .width = 0 },
+    .{ .first = 0x200B, .last = 0x200F, .width = 0 },
+    .{ .first = 0x2028, .last = 0x202E, .width = 0 },
+    .{ .first = 0x2060, .last = 0x2064, .width = 0 },
+    .{ .first = 0x20D0, .last = 0x20FF, .width = 0 },
+    .{ .first = 0x302A, .last = 0x302D, .width = 0 },
+    .{ .first = 0x3099, .last = 0x309A, .width = 0 },
+    .{ .first = 0xFE00, .last = 0xFE0F, .width = 0 },
+    .{ .first = 0xFE20, .last = 0xFE2F, .width = 0 },
+    .{ .first = 0xFEFF, .last = 0xFEFF, .width = 0 },
+    .{ .first = 0xE0000, .last = 0xE0FFF, .width = 0 },
+};
+
+const emoji_presentation = blk: {
+    @setEvalBranchQuota(2_000_000);
+    const data = @embedFile("pkg/fcft/emoji-data.txt");
+    var list: [1024]Range = undefined;
+    var n = 0;
+    var lines = std.mem.tokenizeScalar(u8, data, '\n');
+    while (lines.next()) |line| {
+        if (line[0] == '#') continue;
+        // 1F600..1F64F  ; Emoji_Presentation  # ...
+        const semi = std.mem.indexOfScalar(u8, line, ';') orelse continue;
+        const prop = std.mem.trim(u8, line[semi + 1 .. std.mem.indexOfScalarPos(u8, line, semi, '#') orelse line.len], " \t");
+        if (!std.mem.eql(u8, prop, "Emoji_Presentation")) continue;
+        const cps = std.mem.trim(u8, line[0..semi], " \t");
+        const dots = std.mem.indexOf(u8, cps, "..");
+        const first = std.fmt.parseInt(u21, if (dots) |d| cps[0..d] else cps, 16) catch unreachable;
+        const last = if (dots) |d| std.fmt.parseInt(u21, cps[d + 2 ..], 16) catch unreachable else first;
+        list[n] = .{ .first = first, .last = last, .width = 2 };
+        n += 1;
+    }
+    break :blk list[0..n].*;
+};
+
+// later ranges win where they overlap
+const ranges = east_asian_wide ++ emoji_presentation ++ zero_width;
+
+const block_shift = 8;
+const block_size = 1 << block_shift;
+const block_count = 0x110000 >> block_shift;
+const mixed = 3;
+
+// width of every block when it is uniform, `mixed` otherwise
+const block_widths = blk: {
+    @setEvalBranchQuota(1_000_000);
+    var table = [_]u8{1} ** block_count;
+    for (ranges) |r| {
+        for (r.first >> block_shift..(r.last >> block_shift) + 1) |b| {
+            const covered = r.first <= b << block_shift and r.last >= (b << block_shift) + block_size - 1;
+            if (covered) {
+                if (table[b] != mixed) table[b] = r.width;
+            } else if (table[b] != r.width) {
+                table[b] = mixed;
+            }
+        }
+    }
+    break :blk table;
+};
+
+const mixed_count = blk: {
+    @setEvalBranchQuota(100_000);
+    var n = 0;
+    for (block_widths) |w| {
+        if (w == mixed) n += 1;
+    }
+    break :blk n;
+};
+
+// blocks 0..2 are the uniform ones, each mixed block gets its own after them
+const stage1: [block_count]u8 = blk: {
+    @setEvalBranchQuota(100_000);
+    comptime assert(3 + mixed_count <= 256);
+    var table: [block_count]u8 = undefined;
+    var next = 3;
+    for (block_widths, 0..) |w, b| {
+        if (w == mixed) {
+            table[b] = next;
+            next += 1;
+        } else {
+            table[b] = w;
+        }
+    }
+    break :blk table;
+};
+
+const stage2: [3 + mixed_count][block_size]u2 = blk: {
+    @setEvalBranchQuota(4_000_000);
+    var blocks: [3 + mixed_count][block_size]u2 = undefined;
+    for (0..3) |w| blocks[w] = [_]u2{w} ** block_size;
+    for (3..blocks.len) |i| blocks[i] = [_]u2{1} ** block_size;
+    for (ranges) |r| {
+        for (r.first >> block_shift..(r.last >> block_shift) + 1) |b| {
+            if (block_widths[b] != mixed) continue;
+            const lo = @max(r.first, b << block_shift);
+            const hi = @min(r.last, (b << block_shift) + block_size - 1);
+            for (lo..hi + 1) |cp| blocks[stage1[b]][cp & (block_size - 1)] = r.width;
+        }
+    }
+    break :blk blocks;
+};
+
+/// Cells taken by `cp`: 0 for combining and format characters, 2 for wide ones.
+pub inline fn width(cp: u32) u2 {
+    if (cp >= 0x20 and cp < 0x7f) return 1;
+    if (cp >= 0x110000) return 1;
+    return stage2[stage1[cp >> block_shift]][cp & (block_size - 1)];
+}
+
+/// Widths of a run of codepoints, lanes of printable ASCII skip the table.
+pub fn widths(cps: []const u32, out: []u2) void {
+    assert(out.len >= cps.len);
+    const lanes = 16;
+    const V = @Vector(lanes, u32);
+    var i: usize = 0;
+    while (i + lanes <= cps.len) : (i += lanes) {
+        const v: V = cps[i..][0..lanes].*;
+        // one unsigned compare per lane: cp - 0x20 < 0x5f
+        const ascii = v -% @as(V, @splat(0x20)) < @as(V, @splat(0x7f - 0x20));
+        if (@reduce(.And, ascii)) {
+            @memset(out[i .. i + lanes], 1);
+        } else {
+            for (cps[i .. i + lanes], out[i .. i + lanes]) |cp, *w| w.* = width(cp);
+        }
+    }
+    for (cps[i..], out[i..cps.len]) |cp, *w| w.* = width(cp);
+}
+
+const testing = std.testing;
+
+test "width" {
+    try testing.expectEqual(1, width('a'));
+    try testing.expectEqual(1, width(0x00E9)); // é
+    try testing.expectEqual(0, width(0x0301)); // combining acute
+    try testing.expectEqual(2, width(0x4E00)); // CJK
+    try testing.expectEqual(2, width(0xAC00)); // Hangul
+    try testing.expectEqual(2, width(0xFF21)); // fullwidth A
+    try testing.expectEqual(2, width(0x1F600)); // 😀
+    try testing.expectEqual(2, width(0x231A)); // ⌚
+    try testing.expectEqual(1, width(0x2603)); // ☃ text presentation
+    try testing.expectEqual(0, width(0x200D)); // ZWJ
+    try testing.expectEqual(0, width(0xFE0F)); // VS16
+    try testing.expectEqual(1, width(0x10FFFF));
+}
+
+test "widths" {
+    var cps: [40]u32 = undefined;
+    for (&cps, 0..) |*cp, i| cp.* = 'a' + @as(u32, @intCast(i % 26));
+    cps[20] = 0x4E00;
+    cps[37] = 0x0301;
+    var out: [40]u2 = undefined;
+    widths(&cps, &out);
+    for (out, 0..) |w, i| {
+        const expected: u2 = switch (i) {
+            20 => 2,
+            37 => 0,
+            else => 1,
+        };
+        try testing.expectEqual(expected, w);
+    }
+}
@@ -58,6 +58,46 @@ static const unsigned int defaultrcs = 257;
 
 static const bool scroll_bool = true;
 
+/*
+ * scrollback history, the oldest lines are recycled when either limit is hit
+ * histbytes counts uncompressed pages and compressed blobs. histlines is set
+ * far past what histbytes holds, so cold pages spill to histspillbytes below
+ * before any line is dropped
+ */
+static const unsigned int histlines = 1000000;
+static const unsigned long histbytes = 64UL << 20; /* 64 MiB */
+/* lines kept uncompressed, older pages are deflated with zlib when idle */
+static const unsigned int histhotlines = 4096;
+/*
+ * compressed pages over histbytes go to an unlinked memfd/tmpfile mapped with
+ * mmap, so the kernel can page them out. 0 disables spilling
+ */
+static const unsigned long histspillbytes = 1UL << 30; /* 1 GiB of address space */
+/* history lines per mouse wheel step, Shift+PgUp/PgDn scroll by a screen */
+static const unsigned int wheelstep = 3;
+/*
+ * Ctrl+Shift+F searches the screen and history, Return goes to the next older
+ * match. lines scanned per event loop turn, a few hundred microseconds
+ */
+static const unsigned int searchstep = 4096;
+/*
+ * parse each read from the pty into a list of grid operations and apply it
+ * after, runs of line feeds, cursor moves and text are merged on the way
+ */
+static const bool batchops = false;
+/*
+ * bytes of the glyph atlas sheet of colour and subpixel glyphs, coverage
+ * glyphs live in pixman's glyph cache. a full sheet is emptied and refilled
+ * from the font as glyphs are drawn again
+ */
+static const unsigned long glyphatlasbytes = 4UL << 20; /* 4 MiB */
+/*
+ * SHM buffers presented with the Present extension, 2 or 3. frames wait for
+ * the server to release a buffer instead of drawing over one it reads.
+ * 0 draws into one buffer copied to the window, as without Present
+ */
+static const unsigned int presentbuffers = 2;
+
 
 
 /*
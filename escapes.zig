@@ -2,6 +2,8 @@ const std = @import("std");
 const testing = std.testing;
 const util = @import("util.zig");
 const x = @import("x.zig");
+const ops = @import("ops.zig");
+const unicode = std.unicode;
 
 const c = @import("c.zig");
 
@@ -571,6 +573,40 @@ pub fn isControl(n: u8) bool {
     return n <= @intFromEnum(C0.US) or n == @intFromEnum(C0.DEL);
 }
 
+// Length of the leading run of ASCII bytes.
+inline fn asciiPrefix(bytes: []const u8) usize {
+    const lanes = 16;
+    var i: usize = 0;
+    while (i + lanes <= bytes.len) : (i += lanes) {
+        const v: @Vector(lanes, u8) = bytes[i..][0..lanes].*;
+        if (@reduce(.Max, v) >= 0x80) break;
+    }
+    while (i < bytes.len and bytes[i] < 0x80) i += 1;
+    return i;
+}
+
+// Decodes UTF-8 that simdutf rejected one sequence at a time, bad bytes become U+FFFD.
+fn decodeSlow(bytes: []const u8, out: []u32) []const u32 {
+    var n: usize = 0;
+    var i: usize = 0;
+    while (i < bytes.len) : (n += 1) {
+        const len = unicode.utf8ByteSequenceLength(bytes[i]) catch 0;
+        if (len == 0 or i + len > bytes.len) {
+            out[n] = unicode.replacement_character;
+            i += 1;
+            continue;
+        }
+        if (unicode.utf8Decode(bytes[i .. i + len])) |cp| {
+            out[n] = cp;
+            i += len;
+        } else |_| {
+            out[n] = unicode.replacement_character;
+            i += 1;
+        }
+    }
+    return out[0..n];
+}
+
 pub const SGR = enum(u8) {
     /// Reset all attributes 0m reset
     Reset = 0,
@@ -777,6 +813,9 @@ pub const Parser = struct {
     str_buf: [ESC_BUF_SIZE]u8,
     str_len: usize,
     allocator: std.mem.Allocator,
+    utf8: [4]u8 = undefined, // start of a UTF-8 sequence cut by the end of a read
+    utf8_len: u8 = 0,
+    ops: ?*ops.OpStream = null, // when set, a read is parsed into ops first and applied after
 
     const Self = @This();
 
@@ -795,6 +834,26 @@ pub const Parser = struct {
         };
     }
 
+    pub fn deinit(self: *Self) void {
+        if (self.ops) |stream| self.allocator.destroy(stream);
+        self.ops = null;
+    }
+
+    // NOTE: Switches between applying every sequence as it is parsed and
+    // recording the common ones as ops, applied at the end of each read.
+    pub fn batch(self: *Self, on: bool) !void {
+        if (on == (self.ops != null)) return;
+        if (on) {
+            const stream = try self.allocator.create(ops.OpStream);
+            errdefer self.allocator.destroy(stream);
+            // create leaves the memory undefined, the lengths start at zero
+            stream.* = .{};
+            self.ops = stream;
+        } else {
+            self.deinit();
+        }
+    }
+
     pub fn reset(self: *Self) void {
         self.state = .GROUND;
         self.len = 0;
@@ -834,15 +893,7 @@ pub const Parser = struct {
             // try to find start csi escape 0x1B
             if (util.indexOfCsiStart(input[i..])) |start| {
                 // process csi bytes
-                for (input[i .. i + start]) |cc| {
-                    if (util.isPrintable(cc)) {
-                        term.tputc(cc);
-                    } else if (util.isControl(cc)) {
-                        try self.process_char(term, xterm, cc);
-                    } else {
-                        std.log.warn("Non-ASCII character ignored: {x}", .{cc});
-                    }
-                }
+                try self.process_text(term, xterm, input[i .. i + start]);
                 i += start;
 
                 // process CSI ESCAPE
@@ -867,24 +918,165 @@ pub const Parser = struct {
                     i += end;
                 } else {
                     // if csi not complete  make ostatok
+                    self.flush(term);
                     try self.process_char(term, xterm, input[i]);
                     i += 1;
                 }
             } else {
                 // ostatok
-                for (input[i..]) |cc| {
-                    if (util.isPrintable(cc)) {
-                        term.tputc(cc);
-                    } else if (util.isControl(cc)) {
-                        try self.process_char(term, xterm, cc);
-                    } else {
-                        std.log.warn("Non-ASCII character ignored: {x}", .{cc});
-                    }
+                try self.process_text(term, xterm, input[i..]);
+                break;
+            }
+        }
+        self.flush(term);
+    }
+    // NOTE: Bytes between escape sequences: control bytes go to the state machine,
+    // everything else is text.
+    fn process_text(self: *Self, term: *x.Term, xterm: *x.XlibTerminal, text: []const u8) !void {
+        var i: usize = 0;
+        while (i < text.len) {
+            if (util.isControl(text[i])) {
+                if (!self.record_control(term, text[i])) {
+                    self.flush(term);
+                    try self.process_char(term, xterm, text[i]);
+                }
+                i += 1;
+                continue;
+            }
+            var end = i + 1;
+            while (end < text.len and !util.isControl(text[end])) end += 1;
+            if (self.ops != null and self.state == .GROUND) {
+                self.record_text(term, text[i..end]);
+            } else {
+                self.flush(term);
+                self.print_text(term, text[i..end]);
+            }
+            i = end;
+        }
+    }
+
+    // NOTE: Applies the recorded ops in order and empties the stream.
+    fn flush(self: *Self, term: *x.Term) void {
+        const stream = self.ops orelse return;
+        for (stream.items()) |op| {
+            var p = [2]u32{ op.a, op.b };
+            switch (op.kind) {
+                .print => self.print_text(term, stream.textOf(op)),
+                .cup => term.csi_cup(&p),
+                .sgr => term.csi_sgr(stream.paramsOf(op), op.b),
+                .ed => term.csi_ed(p[0..1]),
+                .el => term.csi_el(p[0..1]),
+                .su => term.csi_su(p[0..1]),
+                .sd => term.csi_sd(p[0..1]),
+                .newline => term.tnewline(op.a),
+                .cr => term.tmoveto(0, @intCast(term.cursor.pos.y)),
+            }
+        }
+        stream.clear();
+    }
+
+    inline fn record(self: *Self, term: *x.Term, op: ops.Op) void {
+        const stream = self.ops.?;
+        if (stream.push(op)) return;
+        self.flush(term);
+        _ = stream.push(op);
+    }
+
+    fn record_text(self: *Self, term: *x.Term, text: []const u8) void {
+        const stream = self.ops.?;
+        var rest = text;
+        while (rest.len > 0) {
+            const n = stream.print(rest);
+            if (n == 0) self.flush(term);
+            rest = rest[n..];
+        }
+    }
+
+    // NOTE: Records line feeds and carriage returns met in the ground state,
+    // false for other controls and when not recording.
+    fn record_control(self: *Self, term: *x.Term, char: u8) bool {
+        if (self.ops == null or self.state != .GROUND) return false;
+        switch (@as(C0, @enumFromInt(char))) {
+            .LF, .VT, .FF => self.record(term, .{ .kind = .newline, .a = 1 }),
+            .CR => self.record(term, .{ .kind = .cr }),
+            else => return false,
+        }
+        return true;
+    }
+
+    // NOTE: Records the CSI sequences ops carry, false for the rest.
+    fn record_csi(self: *Self, term: *x.Term) bool {
+        const p = self.params[0..self.narg];
+        const op: ops.Op = switch (@as(CSI_ENUM, @enumFromInt(self.mode[0]))) {
+            .CursorPosition => .{ .kind = .cup, .a = p[0], .b = if (p.len > 1) p[1] else 0 },
+            .EraseInDisplay => .{ .kind = .ed, .a = p[0] },
+            .EraseInLine => .{ .kind = .el, .a = p[0] },
+            .ScrollUp => .{ .kind = .su, .a = p[0] },
+            .ScrollDown => .{ .kind = .sd, .a = p[0] },
+            .SelectGraphicRendition => {
+                const stream = self.ops.?;
+                if (!stream.sgr(p)) {
+                    self.flush(term);
+                    _ = stream.sgr(p);
                 }
+                return true;
+            },
+            else => return false,
+        };
+        self.record(term, op);
+        return true;
+    }
+
+    // NOTE: Prints UTF-8 text. ASCII goes to the grid byte by byte, other runs are
+    // converted to UTF-32 with simdutf and printed in batches. A sequence cut by
+    // the end of the read is kept until the next one.
+    fn print_text(self: *Self, term: *x.Term, text: []const u8) void {
+        var rest = text;
+        while (self.utf8_len > 0 and rest.len > 0) {
+            if (rest[0] & 0xC0 != 0x80) {
+                term.tputc(unicode.replacement_character);
+                self.utf8_len = 0;
                 break;
             }
+            self.utf8[self.utf8_len] = rest[0];
+            self.utf8_len += 1;
+            rest = rest[1..];
+            const need = unicode.utf8ByteSequenceLength(self.utf8[0]) catch unreachable;
+            if (self.utf8_len == need) {
+                term.tputc(unicode.utf8Decode(self.utf8[0..need]) catch unicode.replacement_character);
+                self.utf8_len = 0;
+            }
+        }
+
+        // keep an incomplete sequence at the end for the next read
+        var tail = rest.len;
+        while (tail > 0 and rest.len - tail < 3 and rest[tail - 1] & 0xC0 == 0x80) tail -= 1;
+        if (tail > 0 and rest[tail - 1] >= 0xC0) {
+            const need = unicode.utf8ByteSequenceLength(rest[tail - 1]) catch 1;
+            if (rest.len - (tail - 1) < need) {
+                const cut = rest[tail - 1 ..];
+                @memcpy(self.utf8[0..cut.len], cut);
+                self.utf8_len = @intCast(cut.len);
+                rest = rest[0 .. tail - 1];
+            }
+        }
+
+        var cps: [256]u32 = undefined;
+        while (rest.len > 0) {
+            const ascii = asciiPrefix(rest);
+            term.tputascii(rest[0..ascii]);
+            rest = rest[ascii..];
+            if (rest.len == 0) break;
+
+            // never more codepoints than bytes, and the chunk ends on a sequence start
+            var n = @min(rest.len, cps.len);
+            while (n < rest.len and n > cps.len - 4 and rest[n] & 0xC0 == 0x80) n -= 1;
+            const decoded = util.decode_utf8_to_utf32(rest[0..n], &cps) catch decodeSlow(rest[0..n], &cps);
+            term.tputs(decoded);
+            rest = rest[n..];
         }
     }
+
     fn perform_action(self: *Self, term: *x.Term, xterm: *x.XlibTerminal, action: Action, char: ?u8) !void {
         switch (action) {
             .CLEAR => {
@@ -998,6 +1190,10 @@ pub const Parser = struct {
     //  CSI-escapes
     fn handle_csi(self: *Self, term: *x.Term, xterm: *x.XlibTerminal) !void {
         const mode = self.mode[0];
+        if (self.ops != null) {
+            if (self.record_csi(term)) return;
+            self.flush(term);
+        }
         switch (@as(CSI_ENUM, @enumFromInt(mode))) {
             .CursorUp => try term.csi_cuu(self.params[0..self.narg]),
             .CursorDown => term.csi_cud(self.params[0..self.narg]),
@@ -1033,18 +1229,10 @@ pub const Parser = struct {
     // ESC escapes
     inline fn handle_esc(_: *Self, term: *x.Term, char: u8) !void {
         switch (char) {
-            'D' => term.tscrolldown(term.top, 1), // IND
-            'E' => {
-                term.cursor.pos.addX(0);
-                if (term.cursor.pos.getY().? < term.window.tty_grid.getRows().? - 1) {
-                    term.cursor.pos.addY(term.cursor.pos.getY().? + 1);
-                } else {
-                    term.tscrollup(term.top, 1);
-                }
-                term.set_dirt(@intCast(term.cursor.pos.getY().?), @intCast(term.cursor.pos.getY().?));
-            },
-            'M' => term.tscrollup(term.top, 1), // RI
-            'H' => term.tabs[@intCast(term.cursor.pos.getX().?)] = 1, // HTS
+            'D' => term.tindex(), // IND
+            'E' => term.tnewline(1), // NEL
+            'M' => term.trindex(), // RI
+            'H' => term.tabs[term.cursor.pos.x] = 1, // HTS
             'c' => {
                 term.reset();
                 term.fulldirt();
@@ -1059,16 +1247,8 @@ pub const Parser = struct {
         switch (@as(C0, @enumFromInt(char))) {
             .BEL => xterm.ttywrite("\x07", 1, 0),
             .BS => try term.csi_cub(@ptrCast(@constCast(&[_]u32{1}))),
-            .CR => term.cursor.pos.addX(0),
-            .LF, .VT, .FF => {
-                term.cursor.pos.addX(0);
-                if (term.cursor.pos.getY().? < term.window.tty_grid.getRows().? - 1) {
-                    term.cursor.pos.addY(term.cursor.pos.getY().? + 1);
-                } else {
-                    term.tscrollup(term.top, 1);
-                }
-                term.set_dirt(@intCast(term.cursor.pos.getY().?), @intCast(term.cursor.pos.getY().?));
-            },
+            .CR => term.tmoveto(0, @intCast(term.cursor.pos.y)),
+            .LF, .VT, .FF => term.tnewline(1),
             .HT => term.tputtab(1),
             else => std.log.debug("Unhandled C0 control: {x}", .{char}),
         }
@@ -1105,3 +1285,176 @@ pub const Parser = struct {
         }
     }
 };
+
+test "decodeSlow replaces invalid bytes" {
+    var out: [8]u32 = undefined;
+    const decoded = decodeSlow("a\xffé\xe4", &out);
+    try testing.expectEqualSlices(u32, &.{ 'a', 0xFFFD, 0xE9, 0xFFFD }, decoded);
+    try testing.expectEqual(3, asciiPrefix("abc\xc3\xa9"));
+}
+
+test "print_text keeps sequences cut by a read" {
+    var term = try x.Term.init(testing.allocator, .{ .mode = .initEmpty(), .tty_grid = .{ .cols = 10, .rows = 4 } });
+    defer term.deinit();
+    var parser = Parser.init(testing.allocator);
+
+    // "é中" split inside both sequences
+    parser.print_text(&term, "\xc3");
+    parser.print_text(&term, "\xa9\xe4\xb8");
+    try testing.expectEqual(2, parser.utf8_len);
+    parser.print_text(&term, "\xad");
+    try testing.expectEqual(0, parser.utf8_len);
+    try testing.expectEqual(0xE9, term.line[0][0].u);
+    try testing.expectEqual(0x4E2D, term.line[0][1].u);
+    try testing.expectEqual(3, term.cursor.pos.x);
+}
+
+test "CR and LF mark the cell the cursor left" {
+    const xterm = try testing.allocator.create(x.XlibTerminal);
+    defer testing.allocator.destroy(xterm);
+    for ([_]bool{ false, true }) |batch| {
+        var term = try x.Term.init(testing.allocator, .{ .mode = .initEmpty(), .tty_grid = .{ .cols = 10, .rows = 4 } });
+        defer term.deinit();
+        try term.parser.batch(batch);
+
+        try term.parser.process_input(&term, xterm, "$ ls");
+        term.cleandirt();
+        try term.parser.process_input(&term, xterm, "\r\n");
+        try testing.expectEqual(x.Point{ .x = 0, .y = 1 }, term.cursor.pos);
+        // the cursor was drawn after the prompt, that cell is drawn again
+        try testing.expect(term.dirty.isSet(0));
+        try testing.expect(term.damage[0].lo <= 4 and 4 < term.damage[0].hi);
+        try testing.expect(term.dirty.isSet(1));
+    }
+}
+
+test "LF and HT from the last column cancel the pending wrap" {
+    const xterm = try testing.allocator.create(x.XlibTerminal);
+    defer testing.allocator.destroy(xterm);
+    for ([_]bool{ false, true }) |batch| {
+        var term = try x.Term.init(testing.allocator, .{ .mode = .initEmpty(), .tty_grid = .{ .cols = 10, .rows = 4 } });
+        defer term.deinit();
+        try term.parser.batch(batch);
+
+        // a tab at the last column stays there, X overwrites the last cell
+        try term.parser.process_input(&term, xterm, "0123456789\tX");
+        try testing.expectEqual('X', term.line[0][9].u);
+        try testing.expectEqual(0, term.cursor.pos.y);
+        try testing.expectEqual(' ', term.line[1][0].u);
+
+        // a line feed on the bottom row scrolls once, X starts the new row
+        try term.parser.process_input(&term, xterm, "\x1b[4;1H0123456789\nX");
+        try testing.expectEqual(x.Point{ .x = 1, .y = 3 }, term.cursor.pos);
+        try testing.expectEqual('9', term.line[2][9].u);
+        try testing.expectEqual('X', term.line[3][0].u);
+        try testing.expectEqual(' ', term.line[3][1].u);
+    }
+}
+
+test "IND and RI scroll at the margins only" {
+    const xterm = try testing.allocator.create(x.XlibTerminal);
+    defer testing.allocator.destroy(xterm);
+    for ([_]bool{ false, true }) |batch| {
+        var term = try x.Term.init(testing.allocator, .{ .mode = .initEmpty(), .tty_grid = .{ .cols = 10, .rows = 4 } });
+        defer term.deinit();
+        try term.parser.batch(batch);
+
+        // region from row 2 down, rows A B C D
+        try term.parser.process_input(&term, xterm, "\x1b[2;4r\x1b[1;1HA\x1b[2;1HB\x1b[3;1HC\x1b[4;1HD");
+        // IND above the bottom moves the cursor down in its column
+        try term.parser.process_input(&term, xterm, "\x1b[2;3H\x1bD");
+        try testing.expectEqual(x.Point{ .x = 2, .y = 2 }, term.cursor.pos);
+        try testing.expectEqual('B', term.line[1][0].u);
+
+        // IND on the bottom row scrolls the region up, the row above it stays
+        try term.parser.process_input(&term, xterm, "\x1b[4;1H\x1bD");
+        try testing.expectEqual(x.Point{ .x = 0, .y = 3 }, term.cursor.pos);
+        for ("ACD ", 0..) |ch, y| try testing.expectEqual(@as(u32, ch), term.line[y][0].u);
+
+        // RI below the top margin moves the cursor up
+        try term.parser.process_input(&term, xterm, "\x1b[3;1H\x1bM");
+        try testing.expectEqual(x.Point{ .x = 0, .y = 1 }, term.cursor.pos);
+        for ("ACD ", 0..) |ch, y| try testing.expectEqual(@as(u32, ch), term.line[y][0].u);
+
+        // RI on the top margin scrolls the region down
+        try term.parser.process_input(&term, xterm, "\x1bM");
+        try testing.expectEqual(x.Point{ .x = 0, .y = 1 }, term.cursor.pos);
+        for ("A CD", 0..) |ch, y| try testing.expectEqual(@as(u32, ch), term.line[y][0].u);
+    }
+}
+
+// A full screen program repainting 80x24: every row positioned, colored and erased.
+fn redrawTrace(out: *std.ArrayList(u8), frames: usize) !void {
+    const w = out.writer();
+    for (0..frames) |f| {
+        try w.writeAll("\x1b[H");
+        for (1..24) |r| {
+            try w.print("\x1b[{};1H\x1b[38;5;{}m", .{ r, (r + f) % 256 });
+            for (0..70) |k| try w.writeByte(@intCast(' ' + (r * 7 + k + f) % 95));
+            try w.writeAll("\x1b[0m\x1b[K");
+        }
+        try w.print("\x1b[24;1H\x1b[7m frame {} \x1b[0m\x1b[K", .{f});
+    }
+}
+
+// Output scrolling at the bottom, with runs of blank lines between blocks.
+fn scrollTrace(out: *std.ArrayList(u8), lines: usize) !void {
+    const w = out.writer();
+    try w.writeAll("\x1b[24;1H");
+    for (0..lines) |i| {
+        if (i % 8 == 0) try w.writeAll("\r\n\r\n\r\n\r\n");
+        try w.print("\x1b[32m{}\x1b[0m: line of output\r\n", .{i});
+    }
+}
+
+fn feedTrace(term: *x.Term, xterm: *x.XlibTerminal, trace: []const u8) !void {
+    var i: usize = 0;
+    while (i < trace.len) : (i += 4096) {
+        try term.parser.process_input(term, xterm, trace[i..@min(i + 4096, trace.len)]);
+    }
+}
+
+test "Parser: op stream benchmark" {
+    const allocator = testing.allocator;
+    const xterm = try allocator.create(x.XlibTerminal);
+    defer allocator.destroy(xterm);
+    var direct = try x.Term.init(allocator, .{ .mode = .initEmpty(), .tty_grid = .{ .cols = 80, .rows = 24 } });
+    defer direct.deinit();
+    try direct.parser.batch(false);
+    var batched = try x.Term.init(allocator, .{ .mode = .initEmpty(), .tty_grid = .{ .cols = 80, .rows = 24 } });
+    defer batched.deinit();
+    try batched.parser.batch(true);
+
+    var redraw = std.ArrayList(u8).init(allocator);
+    defer redraw.deinit();
+    const frames = 200;
+    try redrawTrace(&redraw, frames);
+    var scroll = std.ArrayList(u8).init(allocator);
+    defer scroll.deinit();
+    const lines = 2000;
+    try scrollTrace(&scroll, lines);
+
+    for ([_][]const u8{ redraw.items, scroll.items }, [_][]const u8{ "redraw", "scroll" }, [_]usize{ frames, lines }) |trace, name, units| {
+        var timer = try std.time.Timer.start();
+        try feedTrace(&direct, xterm, trace);
+        const applied = timer.read();
+        timer.reset();
+        try feedTrace(&batched, xterm, trace);
+        const recorded = timer.read();
+        std.debug.print("ops bench: {s} trace {} ns per unit applied directly, {} ns through ops\n", .{
+            name,
+            applied / units,
+            recorded / units,
+        });
+
+        // both ways leave the same screen
+        for (0..24) |y| {
+            for (direct.line[y][0..80], batched.line[y][0..80]) |a, b| {
+                try testing.expectEqual(a.u, b.u);
+                try testing.expectEqual(a.fg_index, b.fg_index);
+                try testing.expectEqual(a.mode, b.mode);
+            }
+        }
+        try testing.expectEqual(direct.cursor.pos, batched.cursor.pos);
+    }
+}
@@ -3,6 +3,7 @@ const c = @import("c.zig");
 const Allocator = std.mem.Allocator;
 const Buf = @import("pixbuf.zig");
 const cache_pixman = @import("pixman_cache.zig");
+const atlas = @import("atlas.zig");
 
 const fcft = @cImport({
     @cInclude("fcft/stride.h");
@@ -28,6 +29,8 @@ pub const RenderFont = struct {
     font: *fcft.fcft_font,
     allocator: Allocator,
     dpi: f64,
+    atlas: atlas.Atlas, // glyphs drawn so far, draw_char rasterizes each codepoint once
+    glyph_cache: *c.pixman_glyph_cache_t, // pixman's copies of the coverage glyphs, the only ones
 
     const Self = @This();
 
@@ -61,21 +64,79 @@ pub const RenderFont = struct {
             std.log.err("Failed to load font: {s}", .{fontquery});
             return XcbftError.FontLoadFailed;
         };
+        errdefer fcft.fcft_destroy(font);
         const dpi = try getDpi(conn);
         fcft.fcft_set_emoji_presentation(font, fcft.FCFT_EMOJI_PRESENTATION_DEFAULT);
+        var glyphs = atlas.Atlas.init(allocator, c.glyphatlasbytes) catch |err| {
+            std.log.err("glyph atlas failed: {}", .{err});
+            return XcbftError.MemoryAllocationFailed;
+        };
+        errdefer glyphs.deinit();
+        const glyph_cache = c.pixman_glyph_cache_create() orelse return XcbftError.MemoryAllocationFailed;
 
         return .{
             .conn = conn,
             .font = font,
             .allocator = allocator,
             .dpi = dpi,
+            .atlas = glyphs,
+            .glyph_cache = glyph_cache,
         };
     }
 
     pub fn deinit(self: *Self) void {
+        c.pixman_glyph_cache_destroy(self.glyph_cache);
+        self.atlas.deinit();
         fcft.fcft_destroy(self.font);
     }
 
+    // What drawing a codepoint takes: a glyph of the atlas, fcft's image
+    // when it is too large for the atlas, or nothing.
+    const Lookup = union(enum) {
+        missing,
+        cached: atlas.Glyph,
+        raw: *const fcft.fcft_glyph,
+    };
+
+    // Finds cp in the atlas, rasterizing and adding it on first use.
+    fn glyph(self: *Self, cp: u32, style: atlas.Style) Lookup {
+        if (self.atlas.lookup(cp, style)) |g| return if (g.kind == .missing) .missing else .{ .cached = g };
+        const g = fcft.fcft_rasterize_char_utf32(self.font, cp, fcft.FCFT_SUBPIXEL_DEFAULT) orelse {
+            self.atlas.addMissing(cp, style);
+            return .missing;
+        };
+        const cached = self.atlas.add(cp, style, @ptrCast(g.*.pix), g.*.x, g.*.y, g.*.advance.x) catch |err| {
+            std.log.debug("glyph U+{X} not cached: {}", .{ cp, err });
+            return .{ .raw = g };
+        };
+        return .{ .cached = cached };
+    }
+
+    /// A glyph image as fcft made it, with the pen offsets it is drawn at.
+    pub const Raster = struct {
+        pix: *c.pixman_image_t,
+        left: i32,
+        top: i32,
+        advance: i32,
+    };
+
+    /// fcft's grayscale image of cp, null when the font has no glyph for it.
+    /// The image belongs to fcft's cache, for backends that keep their own
+    /// copy with a single coverage per pixel.
+    pub fn raster(self: *Self, cp: u32) ?Raster {
+        const g = fcft.fcft_rasterize_char_utf32(self.font, cp, fcft.FCFT_SUBPIXEL_NONE) orelse return null;
+        return .{ .pix = @ptrCast(g.*.pix), .left = g.*.x, .top = g.*.y, .advance = g.*.advance.x };
+    }
+
+    // pixman's copy of the coverage glyph g of cp, made from fcft's image on
+    // first use. Call between pixman_glyph_cache_freeze and thaw.
+    fn runGlyph(self: *Self, cp: u32, style: atlas.Style, g: atlas.Glyph) ?*const anyopaque {
+        const key: *anyopaque = @ptrFromInt((@as(usize, cp) << @bitSizeOf(atlas.Style) | style) + 1);
+        if (c.pixman_glyph_cache_lookup(self.glyph_cache, self.font, key)) |entry| return entry;
+        const raster = fcft.fcft_rasterize_char_utf32(self.font, cp, fcft.FCFT_SUBPIXEL_DEFAULT) orelse return null;
+        return c.pixman_glyph_cache_insert(self.glyph_cache, self.font, key, -g.left, g.top, @ptrCast(raster.*.pix));
+    }
+
     pub inline fn draw_char(
         self: *Self,
         buf: *Buf.Buf,
@@ -84,10 +145,55 @@ pub const RenderFont = struct {
         y: i16,
         color: u32,
     ) !i16 {
-        const g = fcft.fcft_rasterize_char_utf32(self.font, char, fcft.FCFT_SUBPIXEL_DEFAULT) orelse {
-            return 0;
+        switch (self.glyph(char, 0)) {
+            .missing => return 0,
+            .raw => |g| return self.composite(buf, g, x, y, color),
+            .cached => |g| {
+                const fill = try cache_pixman.pixmanImageCreateSolidFillCached(color);
+                const baseline = @as(i32, self.font.ascent) + y;
+                if (g.kind != .mask) {
+                    self.atlas.draw(g, buf.pixman_image, fill, x, baseline);
+                    return g.advance;
+                }
+                c.pixman_glyph_cache_freeze(self.glyph_cache);
+                defer c.pixman_glyph_cache_thaw(self.glyph_cache);
+                const entry = self.runGlyph(char, 0, g) orelse return g.advance;
+                const one = [1]c.pixman_glyph_t{.{ .x = x, .y = baseline, .glyph = entry }};
+                c.pixman_composite_glyphs_no_mask(c.PIXMAN_OP_OVER, fill, buf.pixman_image, 0, 0, 0, 0, self.glyph_cache, 1, &one);
+                return g.advance;
+            },
+        }
+    }
+
+    // Draws a grapheme cluster shaped by fcft as one unit, e.g. a base with
+    // combining marks or a ZWJ emoji sequence. Falls back to the base codepoint
+    // when the font has no shaping for it.
+    pub fn drawGrapheme(
+        self: *Self,
+        buf: *Buf.Buf,
+        cps: []const u32,
+        x: i16,
+        y: i16,
+        color: u32,
+    ) !void {
+        const grapheme = fcft.fcft_rasterize_grapheme_utf32(self.font, cps.len, cps.ptr, fcft.FCFT_SUBPIXEL_DEFAULT) orelse {
+            _ = try self.draw_char(buf, cps[0], x, y, color);
+            return;
         };
+        var pen = x;
+        for (grapheme.*.glyphs[0..grapheme.*.count]) |g| {
+            pen += try self.composite(buf, g, pen, y, color);
+        }
+    }
 
+    inline fn composite(
+        self: *Self,
+        buf: *Buf.Buf,
+        g: *const fcft.fcft_glyph,
+        x: i16,
+        y: i16,
+        color: u32,
+    ) !i16 {
         const format = c.pixman_image_get_format(@ptrCast(g.*.pix));
 
         if (format == c.PIXMAN_a8r8g8b8) {
@@ -125,32 +231,51 @@ pub const RenderFont = struct {
         return @intCast(g.*.advance.x);
     }
 
+    // Draws a run of text in one colour, text[i] with its pen at cell cells[i]
+    // of a grid of cell_width pixels starting at x. Cells the caller skips,
+    // such as the second half of a wide character, leave no drift.
+    // The coverage glyphs of the run are composited by pixman in a single
+    // pixman_composite_glyphs_no_mask call from its glyph cache, colour and
+    // subpixel glyphs from the atlas sheet and ones too large for it from
+    // fcft's image.
+    // Only the buffer is written, the frame is presented by the caller.
     pub fn drawText(
         self: *Self,
         buf: *Buf.Buf,
         text: []const u32,
+        cells: []const u16,
+        cell_width: u16,
         x: i16,
         y: i16,
         color: u32,
     ) !void {
-        var width: i32 = 0;
-        var prev_char: ?u32 = null;
-
-        for (text) |cp| {
-            var kern: i32 = 0;
-            if (prev_char) |prev| {
-                var x_kern: c_long = 0;
-                if (fcft.fcft_kerning(self.font, prev, cp, &x_kern, null)) {
-                    kern = @intCast(x_kern);
-                }
-            }
+        const style: atlas.Style = 0;
+        const fill = try cache_pixman.pixmanImageCreateSolidFillCached(color);
+        const baseline = @as(i32, self.font.ascent) + y;
+        var run: [c.MAX_COLS]c.pixman_glyph_t = undefined;
+        var n: usize = 0;
+        c.pixman_glyph_cache_freeze(self.glyph_cache);
+        defer c.pixman_glyph_cache_thaw(self.glyph_cache);
 
-            const advance = try self.draw_char(buf, cp, @intCast(@as(i32, @intCast(x)) + width + kern), y, color);
-            width += kern + advance;
-            prev_char = cp;
+        for (text, cells) |cp, cell| {
+            const pen = @as(i32, x) + @as(i32, cell) * cell_width;
+            switch (self.glyph(cp, style)) {
+                .missing => {},
+                .raw => |g| _ = try self.composite(buf, g, @intCast(pen), y, color),
+                .cached => |g| {
+                    const entry = if (g.kind == .mask and n < run.len) self.runGlyph(cp, style, g) else null;
+                    if (entry) |e| {
+                        run[n] = .{ .x = pen, .y = baseline, .glyph = e };
+                        n += 1;
+                    } else {
+                        self.atlas.draw(g, buf.pixman_image, fill, pen, baseline);
+                    }
+                },
+            }
+        }
+        if (n > 0) {
+            c.pixman_composite_glyphs_no_mask(c.PIXMAN_OP_OVER, fill, buf.pixman_image, 0, 0, 0, 0, self.glyph_cache, @intCast(n), &run);
         }
-
-        try buf.draw();
     }
     // pub fn drawText(
     //     self: *Self,
@@ -246,3 +371,93 @@ pub fn getDpi(conn: *c.xcb_connection_t) XcbftError!f64 {
 
     return dpi;
 }
+
+const testing = std.testing;
+
+test "glyph run benchmark" {
+    // a full redraw of a 240x67 grid of 8x16 cells, 7x12 coverage glyphs
+    const cols = 240;
+    const rows = 67;
+    const cw = 8;
+    const ch = 16;
+    const ascent = 12;
+    const runs_per_row = 3;
+    const dst = c.pixman_image_create_bits(c.PIXMAN_a8r8g8b8, cols * cw, rows * ch, null, 0) orelse
+        return error.PixmanImageCreateFailed;
+    defer _ = c.pixman_image_unref(dst);
+    const white = c.pixman_color_t{ .red = 0xffff, .green = 0xffff, .blue = 0xffff, .alpha = 0xffff };
+    const fill = c.pixman_image_create_solid_fill(&white) orelse return error.PixmanImageCreateFailed;
+    defer _ = c.pixman_image_unref(fill);
+
+    const cache = c.pixman_glyph_cache_create() orelse return error.OutOfMemory;
+    defer c.pixman_glyph_cache_destroy(cache);
+
+    // printable ASCII, each glyph image also in pixman's cache
+    var images: [95]*c.pixman_image_t = undefined;
+    var made: usize = 0;
+    defer for (images[0..made]) |image| {
+        _ = c.pixman_image_unref(image);
+    };
+    var entries: [95]?*const anyopaque = undefined;
+    c.pixman_glyph_cache_freeze(cache);
+    for (&images, 0..) |*image, i| {
+        image.* = c.pixman_image_create_bits(c.PIXMAN_a8, 7, 12, null, 0) orelse return error.PixmanImageCreateFailed;
+        made += 1;
+        const bits: [*]u8 = @ptrCast(c.pixman_image_get_data(image.*));
+        const stride: usize = @intCast(c.pixman_image_get_stride(image.*));
+        for (0..12) |row| {
+            for (0..7) |col| bits[row * stride + col] = @truncate(i * 31 + row * 17 + col * 5);
+        }
+        entries[i] = c.pixman_glyph_cache_insert(cache, @ptrFromInt(1), @ptrFromInt(i + 1), 0, ascent, image.*);
+    }
+    c.pixman_glyph_cache_thaw(cache);
+
+    const frames = 10;
+    var timer = try std.time.Timer.start();
+    for (0..frames) |f| {
+        for (0..rows) |y| {
+            for (0..cols) |x| {
+                const k = (x + y + f) % 95;
+                c.pixman_image_composite32(c.PIXMAN_OP_OVER, fill, images[k], dst, 0, 0, 0, 0, @intCast(x * cw), @intCast(y * ch), 7, 12);
+            }
+        }
+    }
+    const per_image = timer.read() / frames;
+
+    // a run of one glyph per cell, as draw_char composites a single character
+    timer.reset();
+    c.pixman_glyph_cache_freeze(cache);
+    for (0..frames) |f| {
+        for (0..rows) |y| {
+            for (0..cols) |x| {
+                const one = c.pixman_glyph_t{ .x = @intCast(x * cw), .y = @intCast(y * ch + ascent), .glyph = entries[(x + y + f) % 95] };
+                c.pixman_composite_glyphs_no_mask(c.PIXMAN_OP_OVER, fill, dst, 0, 0, 0, 0, cache, 1, &one);
+            }
+        }
+    }
+    c.pixman_glyph_cache_thaw(cache);
+    const per_char = timer.read() / frames;
+
+    timer.reset();
+    var run: [cols / runs_per_row]c.pixman_glyph_t = undefined;
+    c.pixman_glyph_cache_freeze(cache);
+    for (0..frames) |f| {
+        for (0..rows) |y| {
+            for (0..runs_per_row) |r| {
+                for (&run, r * run.len..) |*g, x| {
+                    g.* = .{ .x = @intCast(x * cw), .y = @intCast(y * ch + ascent), .glyph = entries[(x + y + f) % 95] };
+                }
+                c.pixman_composite_glyphs_no_mask(c.PIXMAN_OP_OVER, fill, dst, 0, 0, 0, 0, cache, run.len, &run);
+            }
+        }
+    }
+    c.pixman_glyph_cache_thaw(cache);
+    const per_run = timer.read() / frames;
+
+    std.debug.print("glyph bench: 240x67 redraw {} us with an image per glyph, {} us a glyph at a time, {} us in runs of {}\n", .{
+        per_image / std.time.ns_per_us,
+        per_char / std.time.ns_per_us,
+        per_run / std.time.ns_per_us,
+        run.len,
+    });
+}
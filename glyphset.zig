@@ -0,0 +1,368 @@
+//! Text drawn by the X server from a Render GlyphSet, the backend for remote
+//! or slow-CPU sessions. Each glyph is uploaded once as an A8 image; a run of
+//! text is then one CompositeGlyphs32 request of four bytes per character,
+//! where the SHM path moves every pixel of the cells it draws.
+//!
+//! Glyphs are named by codepoint. Codepoints the font has no glyph for are
+//! remembered and skipped like the pixman path does. Colour glyphs are kept
+//! as their coverage, a GlyphSet has a single format.
+const std = @import("std");
+const c = @import("c.zig");
+const font = @import("fnt.zig");
+const Allocator = std.mem.Allocator;
+
+/// Glyphs of one item of a CompositeGlyphs32 request, the protocol's limit.
+pub const max_per_item = 254;
+const item_header = 8; // count, 3 pad bytes, dx, dy
+const composite_header = 28;
+const fill_request = 20 + 8; // FillRectangles with one rectangle
+
+/// Bytes of the items for n glyphs that follow each other by their advances.
+pub fn encodedLen(n: usize) usize {
+    return (n + max_per_item - 1) / max_per_item * item_header + n * 4;
+}
+
+/// Bytes of the items for n glyphs placed anywhere, an item each at worst.
+pub fn maxEncodedLen(n: usize) usize {
+    return n * (item_header + 4);
+}
+
+/// The coverage of a glyph image as A8. Subpixel images keep it in the
+/// colour channels with the alpha always full, each pixel takes the mean of
+/// its channels; other formats give their alpha.
+pub fn coverage(pix: *c.pixman_image_t) !*c.pixman_image_t {
+    const w = c.pixman_image_get_width(pix);
+    const h = c.pixman_image_get_height(pix);
+    const a8 = c.pixman_image_create_bits(c.PIXMAN_a8, w, h, null, 0) orelse return error.PixmanImageCreateFailed;
+    if (c.pixman_image_get_format(pix) != c.PIXMAN_x8r8g8b8 and c.pixman_image_get_component_alpha(pix) == 0) {
+        c.pixman_image_composite32(c.PIXMAN_OP_SRC, pix, null, a8, 0, 0, 0, 0, 0, 0, w, h);
+        return a8;
+    }
+    const src: [*]const u32 = @ptrCast(@alignCast(c.pixman_image_get_data(pix)));
+    const src_stride: usize = @intCast(@divExact(c.pixman_image_get_stride(pix), 4));
+    const dst: [*]u8 = @ptrCast(c.pixman_image_get_data(a8));
+    const dst_stride: usize = @intCast(c.pixman_image_get_stride(a8));
+    for (0..@intCast(h)) |y| {
+        for (0..@intCast(w)) |x| {
+            const p = src[y * src_stride + x];
+            const sum = (p >> 16 & 0xff) + (p >> 8 & 0xff) + (p & 0xff);
+            dst[y * dst_stride + x] = @intCast(sum / 3);
+        }
+    }
+    return a8;
+}
+
+/// Writes the CompositeGlyphs32 items drawing ids[i] with its pen at
+/// (xs[i], y). The server moves the pen by the advance of every glyph, an
+/// item carries on from there while that lands on the next position and
+/// otherwise a new one moves the pen. Returns the bytes written, out holds
+/// at least maxEncodedLen(ids.len), or encodedLen when nothing is skipped.
+pub fn encode(out: []u8, ids: []const u32, xs: []const i16, advances: []const i16, y: i16) usize {
+    std.debug.assert(xs.len == ids.len and advances.len == ids.len);
+    var at: usize = 0;
+    var i: usize = 0;
+    var pen: i16 = 0;
+    var dy = y;
+    while (i < ids.len) {
+        var n: usize = 1;
+        var next = xs[i] + advances[i];
+        while (i + n < ids.len and n < max_per_item and xs[i + n] == next) : (n += 1) next += advances[i + n];
+        out[at] = @intCast(n);
+        @memset(out[at + 1 .. at + 4], 0);
+        std.mem.writeInt(i16, out[at + 4 ..][0..2], xs[i] - pen, .little);
+        std.mem.writeInt(i16, out[at + 6 ..][0..2], dy, .little);
+        at += item_header;
+        for (ids[i .. i + n]) |id| {
+            std.mem.writeInt(u32, out[at..][0..4], id, .little);
+            at += 4;
+        }
+        i += n;
+        pen = next;
+        dy = 0;
+    }
+    return at;
+}
+
+pub const GlyphSet = struct {
+    /// solid pictures kept before they are all freed
+    pub const max_fills = 64;
+
+    allocator: Allocator,
+    conn: *c.xcb_connection_t,
+    id: c.xcb_render_glyphset_t,
+    visual_format: c.xcb_render_pictformat_t, // of pictures on the window's pixmaps
+    target: c.xcb_render_picture_t = 0, // where runs are drawn
+    known: std.AutoHashMapUnmanaged(u32, ?i16) = .empty, // advance of uploaded glyphs, null for codepoints without one
+    fills: std.AutoHashMapUnmanaged(u32, c.xcb_render_picture_t) = .empty, // solid pictures by pixel
+    bytes: u64 = 0, // request bytes queued, uploads included
+
+    pub fn init(allocator: Allocator, conn: *c.xcb_connection_t, visual: c.xcb_visualid_t) !GlyphSet {
+        const formats = c.xcb_render_util_query_formats(conn) orelse return error.RenderUnavailable;
+        const a8 = c.xcb_render_util_find_standard_format(formats, c.XCB_PICT_STANDARD_A_8) orelse return error.RenderUnavailable;
+        const pictvisual = c.xcb_render_util_find_visual_format(formats, visual) orelse return error.RenderUnavailable;
+        const id = c.xcb_generate_id(conn);
+        _ = c.xcb_render_create_glyph_set(conn, id, a8.*.id);
+        std.log.info("drawing text with a Render GlyphSet", .{});
+        return .{ .allocator = allocator, .conn = conn, .id = id, .visual_format = pictvisual.*.format };
+    }
+
+    pub fn deinit(self: *GlyphSet) void {
+        self.dropFills();
+        self.fills.deinit(self.allocator);
+        self.known.deinit(self.allocator);
+        if (self.target != 0) _ = c.xcb_render_free_picture(self.conn, self.target);
+        _ = c.xcb_render_free_glyph_set(self.conn, self.id);
+    }
+
+    /// Draws into drawable from now on, a pixmap of the window's visual.
+    pub fn setTarget(self: *GlyphSet, drawable: c.xcb_drawable_t) void {
+        if (self.target != 0) _ = c.xcb_render_free_picture(self.conn, self.target);
+        self.target = c.xcb_generate_id(self.conn);
+        _ = c.xcb_render_create_picture(self.conn, self.target, drawable, self.visual_format, 0, null);
+    }
+
+    fn dropFills(self: *GlyphSet) void {
+        var it = self.fills.valueIterator();
+        while (it.next()) |picture| _ = c.xcb_render_free_picture(self.conn, picture.*);
+        self.fills.clearRetainingCapacity();
+    }
+
+    inline fn color(pixel: u32) c.xcb_render_color_t {
+        return .{
+            .red = @as(u16, @as(u8, @truncate(pixel >> 16))) * 257,
+            .green = @as(u16, @as(u8, @truncate(pixel >> 8))) * 257,
+            .blue = @as(u16, @as(u8, @truncate(pixel))) * 257,
+            .alpha = 0xffff,
+        };
+    }
+
+    fn fillPicture(self: *GlyphSet, pixel: u32) !c.xcb_render_picture_t {
+        if (self.fills.get(pixel)) |picture| return picture;
+        if (self.fills.count() >= max_fills) self.dropFills();
+        const picture = c.xcb_generate_id(self.conn);
+        _ = c.xcb_render_create_solid_fill(self.conn, picture, color(pixel));
+        try self.fills.put(self.allocator, pixel, picture);
+        return picture;
+    }
+
+    // Uploads the glyph of cp on first use and returns its advance, null when
+    // the font has none.
+    fn ensure(self: *GlyphSet, face: *font.RenderFont, cp: u32) !?i16 {
+        if (self.known.get(cp)) |advance| return advance;
+        const raster = face.raster(cp) orelse {
+            try self.known.put(self.allocator, cp, null);
+            return null;
+        };
+        const w: u16 = @intCast(c.pixman_image_get_width(raster.pix));
+        const h: u16 = @intCast(c.pixman_image_get_height(raster.pix));
+        const info = c.xcb_render_glyphinfo_t{
+            .width = w,
+            .height = h,
+            .x = @intCast(-raster.left),
+            .y = @intCast(raster.top),
+            .x_off = @intCast(raster.advance),
+            .y_off = 0,
+        };
+        if (w == 0 or h == 0) {
+            _ = c.xcb_render_add_glyphs(self.conn, self.id, 1, &cp, &info, 0, null);
+        } else {
+            // rows padded to 4 bytes as the server takes them
+            const a8 = try coverage(raster.pix);
+            defer _ = c.pixman_image_unref(a8);
+            const len: u32 = @intCast(c.pixman_image_get_stride(a8) * h);
+            _ = c.xcb_render_add_glyphs(self.conn, self.id, 1, &cp, &info, len, @ptrCast(c.pixman_image_get_data(a8)));
+            self.bytes += len;
+        }
+        self.bytes += 12 + 4 + @sizeOf(c.xcb_render_glyphinfo_t);
+        try self.known.put(self.allocator, cp, info.x_off);
+        return info.x_off;
+    }
+
+    /// Fills a rectangle of the target with pixel.
+    pub fn fill(self: *GlyphSet, x: i16, y: i16, w: u16, h: u16, pixel: u32) void {
+        const rect = c.xcb_rectangle_t{ .x = x, .y = y, .width = w, .height = h };
+        _ = c.xcb_render_fill_rectangles(self.conn, c.XCB_RENDER_PICT_OP_SRC, self.target, color(pixel), 1, &rect);
+        self.bytes += fill_request;
+    }
+
+    /// Inverts the colours of a rectangle of the target, the way the pixman
+    /// path draws the cursor: white composited with the difference blend.
+    pub fn invert(self: *GlyphSet, x: i16, y: i16, w: u16, h: u16) void {
+        const rect = c.xcb_rectangle_t{ .x = x, .y = y, .width = w, .height = h };
+        _ = c.xcb_render_fill_rectangles(self.conn, c.XCB_RENDER_PICT_OP_DIFFERENCE, self.target, color(0xffffff), 1, &rect);
+        self.bytes += fill_request;
+    }
+
+    /// Draws a run of text in one colour, placed on the cell grid as
+    /// RenderFont.drawText does.
+    pub fn drawText(self: *GlyphSet, face: *font.RenderFont, text: []const u32, cells: []const u16, cell_width: u16, x: i16, y: i16, pixel: u32) !void {
+        var ids: [c.MAX_COLS]u32 = undefined;
+        var xs: [c.MAX_COLS]i16 = undefined;
+        var advances: [c.MAX_COLS]i16 = undefined;
+        var n: usize = 0;
+        for (text, cells) |cp, cell| {
+            if (n == ids.len) break;
+            advances[n] = try self.ensure(face, cp) orelse continue;
+            ids[n] = cp;
+            xs[n] = @intCast(@as(i32, x) + @as(i32, cell) * cell_width);
+            n += 1;
+        }
+        if (n == 0) return;
+        var items: [maxEncodedLen(c.MAX_COLS)]u8 align(4) = undefined;
+        const len = encode(&items, ids[0..n], xs[0..n], advances[0..n], @intCast(@as(i32, face.font.ascent) + y));
+        _ = c.xcb_render_composite_glyphs_32(
+            self.conn,
+            c.XCB_RENDER_PICT_OP_OVER,
+            try self.fillPicture(pixel),
+            self.target,
+            0, // no mask format, glyphs are composited one by one
+            self.id,
+            0,
+            0,
+            @intCast(len),
+            &items,
+        );
+        self.bytes += composite_header + len;
+    }
+};
+
+const testing = std.testing;
+
+test "GlyphSet: encode" {
+    var ids: [300]u32 = undefined;
+    var xs: [300]i16 = undefined;
+    const advances = [_]i16{8} ** 300;
+    for (&ids, &xs, 0..) |*id, *x, i| {
+        id.* = @intCast('a' + i);
+        x.* = @intCast(16 + i * 8);
+    }
+    var out: [maxEncodedLen(300)]u8 = undefined;
+    try testing.expectEqual(2 * item_header + 300 * 4, encodedLen(300));
+
+    const len = encode(&out, &ids, &xs, &advances, -3);
+    try testing.expectEqual(encodedLen(300), len);
+    // the first item moves the pen, the second carries on
+    try testing.expectEqual(max_per_item, out[0]);
+    try testing.expectEqual(16, std.mem.readInt(i16, out[4..6], .little));
+    try testing.expectEqual(-3, std.mem.readInt(i16, out[6..8], .little));
+    try testing.expectEqual('a', std.mem.readInt(u32, out[8..12], .little));
+    const second = item_header + max_per_item * 4;
+    try testing.expectEqual(300 - max_per_item, out[second]);
+    try testing.expectEqual(0, std.mem.readInt(i16, out[second + 4 ..][0..2], .little));
+    try testing.expectEqual('a' + max_per_item, std.mem.readInt(u32, out[second + item_header ..][0..4], .little));
+
+    // a skipped cell moves the pen over it in a new item
+    const len2 = encode(&out, ids[0..3], &.{ 0, 8, 24 }, advances[0..3], 0);
+    try testing.expectEqual(2 * item_header + 3 * 4, len2);
+    try testing.expectEqual(2, out[0]);
+    const gap = item_header + 2 * 4;
+    try testing.expectEqual(1, out[gap]);
+    try testing.expectEqual(8, std.mem.readInt(i16, out[gap + 4 ..][0..2], .little));
+
+    try testing.expectEqual(0, encode(&out, &.{}, &.{}, &.{}, 0));
+}
+
+test "GlyphSet: subpixel coverage" {
+    // an x8r8g8b8 raster as fcft gives with subpixel AA: alpha full everywhere
+    var pixels = [_]u32{ 0xff000000, 0xffffffff, 0xff3f7fbf, 0x00ff0000 };
+    const pix = c.pixman_image_create_bits(c.PIXMAN_x8r8g8b8, 2, 2, &pixels, 8).?;
+    defer _ = c.pixman_image_unref(pix);
+    const a8 = try coverage(pix);
+    defer _ = c.pixman_image_unref(a8);
+    const data: [*]const u8 = @ptrCast(c.pixman_image_get_data(a8));
+    const stride: usize = @intCast(c.pixman_image_get_stride(a8));
+    try std.testing.expectEqual(@as(u8, 0), data[0]);
+    try std.testing.expectEqual(@as(u8, 0xff), data[1]);
+    try std.testing.expectEqual(@as(u8, 0x7f), data[stride]);
+    try std.testing.expectEqual(@as(u8, 0x55), data[stride + 1]);
+
+    // an a8 raster keeps its alpha
+    var gray align(4) = [_]u8{ 0, 0x40, 0, 0, 0x80, 0xff, 0, 0 };
+    const pix8 = c.pixman_image_create_bits(c.PIXMAN_a8, 2, 2, @ptrCast(@alignCast(&gray)), 4).?;
+    defer _ = c.pixman_image_unref(pix8);
+    const b8 = try coverage(pix8);
+    defer _ = c.pixman_image_unref(b8);
+    const bdata: [*]const u8 = @ptrCast(c.pixman_image_get_data(b8));
+    const bstride: usize = @intCast(c.pixman_image_get_stride(b8));
+    try std.testing.expectEqual(@as(u8, 0x40), bdata[1]);
+    try std.testing.expectEqual(@as(u8, 0x80), bdata[bstride]);
+    try std.testing.expectEqual(@as(u8, 0xff), bdata[bstride + 1]);
+}
+
+test "GlyphSet: wire bytes benchmark" {
+    // a full redraw of a 240x67 grid of 8x16 cells in runs of 80, and one keystroke
+    const cols = 240;
+    const rows = 67;
+    const cw = 8;
+    const ch = 16;
+    const ascent = 12;
+    const run_len = 80;
+    const frames = 10;
+
+    // server side: a fill and a CompositeGlyphs32 per run
+    var ids: [run_len]u32 = undefined;
+    var xs: [run_len]i16 = undefined;
+    const advances = [_]i16{cw} ** run_len;
+    var items: [maxEncodedLen(run_len)]u8 align(4) = undefined;
+    var wire: usize = 0;
+    var timer = try std.time.Timer.start();
+    for (0..frames) |f| {
+        wire = 0;
+        for (0..rows) |y| {
+            for (0..cols / run_len) |r| {
+                for (&ids, &xs, r * run_len..) |*id, *px, x| {
+                    id.* = @intCast(' ' + (x + y + f) % 95);
+                    px.* = @intCast(x * cw);
+                }
+                const len = encode(&items, &ids, &xs, &advances, @intCast(y * ch + ascent));
+                wire += fill_request + composite_header + len;
+            }
+        }
+        std.mem.doNotOptimizeAway(&items);
+    }
+    const encode_ns = timer.read() / frames;
+
+    // SHM: the same runs composited by pixman, the server copies the pixels
+    const dst = c.pixman_image_create_bits(c.PIXMAN_a8r8g8b8, cols * cw, rows * ch, null, 0) orelse
+        return error.PixmanImageCreateFailed;
+    defer _ = c.pixman_image_unref(dst);
+    const white = c.pixman_color_t{ .red = 0xffff, .green = 0xffff, .blue = 0xffff, .alpha = 0xffff };
+    const fill = c.pixman_image_create_solid_fill(&white) orelse return error.PixmanImageCreateFailed;
+    defer _ = c.pixman_image_unref(fill);
+    const cache = c.pixman_glyph_cache_create() orelse return error.OutOfMemory;
+    defer c.pixman_glyph_cache_destroy(cache);
+    const image = c.pixman_image_create_bits(c.PIXMAN_a8, 7, 12, null, 0) orelse return error.PixmanImageCreateFailed;
+    defer _ = c.pixman_image_unref(image);
+    var entries: [95]?*const anyopaque = undefined;
+    c.pixman_glyph_cache_freeze(cache);
+    for (&entries, 0..) |*e, i| e.* = c.pixman_glyph_cache_insert(cache, @ptrFromInt(1), @ptrFromInt(i + 1), 0, ascent, image);
+    var run: [run_len]c.pixman_glyph_t = undefined;
+    timer.reset();
+    for (0..frames) |f| {
+        for (0..rows) |y| {
+            for (0..cols / run_len) |r| {
+                for (&run, r * run_len..) |*g, x| {
+                    g.* = .{ .x = @intCast(x * cw), .y = @intCast(y * ch + ascent), .glyph = entries[(x + y + f) % 95] };
+                }
+                c.pixman_composite_glyphs_no_mask(c.PIXMAN_OP_OVER, fill, dst, 0, 0, 0, 0, cache, run.len, &run);
+            }
+        }
+    }
+    c.pixman_glyph_cache_thaw(cache);
+    const shm_ns = timer.read() / frames;
+    const pixels = cols * cw * rows * ch * 4;
+
+    // a keystroke: one cell
+    const key_wire = fill_request + composite_header + encodedLen(1);
+    const key_pixels = cw * ch * 4;
+
+    std.debug.print("glyphset bench: 240x67 redraw sends {} bytes in {} us of encoding, SHM moves {} bytes after {} us of pixman; a keystroke {} bytes against {}\n", .{
+        wire,
+        encode_ns / std.time.ns_per_us,
+        pixels,
+        shm_ns / std.time.ns_per_us,
+        key_wire,
+        key_pixels,
+    });
+    try testing.expect(wire < pixels);
+}
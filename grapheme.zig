@@ -0,0 +1,142 @@
+//! Extra codepoints of grapheme clusters, kept next to a screen.
+//!
+//! A cell holds one codepoint. When its cluster has more (combining marks,
+//! ZWJ sequences, variation selectors) the cell is flagged and the rest of
+//! the cluster lives here, in a map per row keyed by column. Rows without
+//! clusters have an empty map, so plain text never touches the table.
+//!
+//! Entries are only valid for flagged cells whose codepoint matches the
+//! stored base. Cells overwritten or blanked simply lose the flag, the stale
+//! entry is replaced when the cell gets a cluster again or dropped with its row.
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+
+const assert = std.debug.assert;
+
+pub fn GraphemeTableType(comptime rows: usize) type {
+    return struct {
+        const Table = @This();
+
+        /// Longer clusters keep their first max_extra codepoints after the base.
+        pub const max_extra = 7;
+
+        pub const Cluster = struct {
+            base: u32,
+            len: u8 = 0,
+            extra: [max_extra]u32 = undefined,
+        };
+
+        const Row = std.AutoHashMapUnmanaged(u16, Cluster);
+
+        allocator: Allocator,
+        rows: [rows]Row = [_]Row{.empty} ** rows,
+
+        pub fn init(allocator: Allocator) Table {
+            return .{ .allocator = allocator };
+        }
+
+        pub fn deinit(self: *Table) void {
+            for (&self.rows) |*row| row.deinit(self.allocator);
+        }
+
+        /// Codepoints after `base` in the cluster of cell (x, y).
+        pub inline fn get(self: *const Table, y: usize, x: u16, base: u32) ?[]const u32 {
+            const row = &self.rows[y];
+            if (row.count() == 0) return null;
+            const cluster = row.getPtr(x) orelse return null;
+            if (cluster.base != base) return null;
+            return cluster.extra[0..cluster.len];
+        }
+
+        /// Starts an empty cluster for cell (x, y), replacing a stale one.
+        pub fn begin(self: *Table, y: usize, x: u16, base: u32) !void {
+            try self.rows[y].put(self.allocator, x, .{ .base = base });
+        }
+
+        /// Adds cp to the cluster of cell (x, y), see begin.
+        pub fn append(self: *Table, y: usize, x: u16, cp: u32) void {
+            const cluster = self.rows[y].getPtr(x) orelse return;
+            if (cluster.len == max_extra) return;
+            cluster.extra[cluster.len] = cp;
+            cluster.len += 1;
+        }
+
+        pub inline fn clearRow(self: *Table, y: usize) void {
+            if (self.rows[y].count() > 0) self.rows[y].clearRetainingCapacity();
+        }
+
+        pub fn clear(self: *Table) void {
+            for (0..rows) |y| self.clearRow(y);
+        }
+
+        /// Follows the rows of [top, end) moving n up, the n rows scrolled in are empty.
+        pub fn scrollUp(self: *Table, top: usize, end: usize, n: usize) void {
+            assert(n <= end - top);
+            std.mem.rotate(Row, self.rows[top..end], n);
+            for (end - n..end) |y| self.clearRow(y);
+        }
+
+        /// Follows the rows of [top, end) moving n down, the n rows scrolled in are empty.
+        pub fn scrollDown(self: *Table, top: usize, end: usize, n: usize) void {
+            assert(n <= end - top);
+            std.mem.rotate(Row, self.rows[top..end], end - top - n);
+            for (top..top + n) |y| self.clearRow(y);
+        }
+
+        /// Follows the cells of row y from column `from` on moving by delta,
+        /// clusters leaving [from, cols) are dropped.
+        pub fn shift(self: *Table, y: usize, from: u16, delta: i32, cols: u16) !void {
+            const row = &self.rows[y];
+            if (row.count() == 0) return;
+            var moved: Row = .empty;
+            errdefer moved.deinit(self.allocator);
+            try moved.ensureTotalCapacity(self.allocator, row.count());
+            var it = row.iterator();
+            while (it.next()) |entry| {
+                const x = entry.key_ptr.*;
+                if (x < from) {
+                    moved.putAssumeCapacity(x, entry.value_ptr.*);
+                    continue;
+                }
+                const to = @as(i32, x) + delta;
+                if (to < from or to >= cols) continue;
+                moved.putAssumeCapacity(@intCast(to), entry.value_ptr.*);
+            }
+            row.deinit(self.allocator);
+            row.* = moved;
+        }
+    };
+}
+
+const testing = std.testing;
+
+test "GraphemeTable: clusters follow rows and columns" {
+    const Table = GraphemeTableType(4);
+    var table = Table.init(testing.allocator);
+    defer table.deinit();
+
+    try testing.expectEqual(null, table.get(0, 0, 'e'));
+    try table.begin(1, 3, 'e');
+    table.append(1, 3, 0x0301);
+    try testing.expectEqualSlices(u32, &.{0x0301}, table.get(1, 3, 'e').?);
+    // another base at the same cell is a stale entry
+    try testing.expectEqual(null, table.get(1, 3, 'a'));
+
+    table.scrollUp(0, 4, 1);
+    try testing.expectEqualSlices(u32, &.{0x0301}, table.get(0, 3, 'e').?);
+    table.scrollDown(0, 4, 2);
+    try testing.expectEqualSlices(u32, &.{0x0301}, table.get(2, 3, 'e').?);
+    try testing.expectEqual(0, table.rows[0].count());
+
+    try table.shift(2, 1, 2, 6);
+    try testing.expectEqualSlices(u32, &.{0x0301}, table.get(2, 5, 'e').?);
+    try table.shift(2, 1, 1, 6);
+    try testing.expectEqual(0, table.rows[2].count());
+
+    // begin replaces what was there
+    try table.begin(3, 0, 'a');
+    for (0..Table.max_extra + 2) |_| table.append(3, 0, 0x0308);
+    try testing.expectEqual(Table.max_extra, table.get(3, 0, 'a').?.len);
+    try table.begin(3, 0, 'a');
+    try testing.expectEqual(0, table.get(3, 0, 'a').?.len);
+}
@@ -0,0 +1,205 @@
+//! Cell span primitives of the screen: blank fills, shifts inside a row and
+//! copies of row ranges, the work behind erase, insert, delete and scroll.
+//!
+//! Cells are moved as bytes in vectors of the target's native width. A fill
+//! stores a pattern of whole cells that is a whole number of vectors long,
+//! so cells of any size, padding included, take plain vector stores and no
+//! per-field work.
+const std = @import("std");
+
+const assert = std.debug.assert;
+
+const vec_bytes = std.simd.suggestVectorLength(u8) orelse 16;
+const Bytes = @Vector(vec_bytes, u8);
+
+/// Sets every cell of `cells` to `blank`.
+pub fn fill(comptime Cell: type, cells: []Cell, blank: Cell) void {
+    const size = @sizeOf(Cell);
+    comptime assert(size > 0);
+    // fewest cells that end on a vector boundary
+    const block = comptime vec_bytes / std.math.gcd(@as(usize, size), @as(usize, vec_bytes));
+    const pattern_bytes = block * size;
+    const vecs = pattern_bytes / vec_bytes;
+
+    const whole = cells.len / block;
+    if (whole == 0) {
+        @memset(cells, blank);
+        return;
+    }
+    var pattern: [block]Cell = undefined;
+    @memset(&pattern, blank);
+    const src: *const [pattern_bytes]u8 = @ptrCast(&pattern);
+    var v: [vecs]Bytes = undefined;
+    inline for (&v, 0..) |*lane, k| lane.* = src[k * vec_bytes ..][0..vec_bytes].*;
+
+    const dst: [*]u8 = @ptrCast(cells.ptr);
+    var i: usize = 0;
+    while (i < whole * pattern_bytes) : (i += pattern_bytes) {
+        inline for (v, 0..) |lane, k| dst[i + k * vec_bytes ..][0..vec_bytes].* = lane;
+    }
+    @memset(cells[whole * block ..], blank);
+}
+
+/// Moves cells[from..from + n] to cells[to..to + n], the two may overlap.
+pub fn shift(comptime Cell: type, cells: []Cell, to: usize, from: usize, n: usize) void {
+    assert(@max(to, from) + n <= cells.len);
+    if (to == from or n == 0) return;
+    const base: [*]u8 = @ptrCast(cells.ptr);
+    moveBytes(base + to * @sizeOf(Cell), base + from * @sizeOf(Cell), n * @sizeOf(Cell));
+}
+
+/// Copies the first `cols` cells of every row of src to the same row of dst,
+/// the ranges may overlap. Cells past `cols` are left alone.
+pub fn copyRows(comptime Row: type, dst: []Row, src: []const Row, cols: usize) void {
+    const info = @typeInfo(Row).array;
+    assert(dst.len == src.len and cols <= info.len);
+    if (dst.len == 0 or dst.ptr == src.ptr) return;
+    const size = @sizeOf(info.child);
+    const to: [*]u8 = @ptrCast(dst.ptr);
+    const from: [*]const u8 = @ptrCast(src.ptr);
+    // full rows are one contiguous span
+    if (cols == info.len) return moveBytes(to, from, dst.len * @sizeOf(Row));
+
+    // rows overlap only as a whole, so the row order decides as for bytes
+    if (@intFromPtr(to) < @intFromPtr(from)) {
+        for (0..dst.len) |y| moveBytes(to + y * @sizeOf(Row), from + y * @sizeOf(Row), cols * size);
+    } else {
+        var y = dst.len;
+        while (y > 0) {
+            y -= 1;
+            moveBytes(to + y * @sizeOf(Row), from + y * @sizeOf(Row), cols * size);
+        }
+    }
+}
+
+// A chunk is loaded whole before it is stored. Walking away from the
+// destination, every store lands on bytes that were already read.
+inline fn moveBytes(dst: [*]u8, src: [*]const u8, len: usize) void {
+    if (@intFromPtr(dst) < @intFromPtr(src)) {
+        var i: usize = 0;
+        while (i + vec_bytes <= len) : (i += vec_bytes) {
+            const v: Bytes = src[i..][0..vec_bytes].*;
+            dst[i..][0..vec_bytes].* = v;
+        }
+        while (i < len) : (i += 1) dst[i] = src[i];
+    } else {
+        var i = len;
+        while (i >= vec_bytes) : (i -= vec_bytes) {
+            const v: Bytes = src[i - vec_bytes ..][0..vec_bytes].*;
+            dst[i - vec_bytes ..][0..vec_bytes].* = v;
+        }
+        while (i > 0) {
+            i -= 1;
+            dst[i] = src[i];
+        }
+    }
+}
+
+const testing = std.testing;
+
+// same fields as the screen's Glyph, 12 bytes with padding
+const TestCell = struct {
+    mode: u16 = 0,
+    u: u32 = ' ',
+    fg: u9 = 7,
+    bg: u9 = 0,
+};
+
+fn expectCells(expected: []const u32, cells: []const TestCell) !void {
+    try testing.expectEqual(expected.len, cells.len);
+    for (expected, cells) |u, cell| try testing.expectEqual(u, cell.u);
+}
+
+test "grid: fill" {
+    var cells: [37]TestCell = undefined;
+    for (&cells, 0..) |*cell, i| cell.* = .{ .u = @intCast(i) };
+    const blank = TestCell{ .u = ' ', .bg = 4, .mode = 3 };
+    fill(TestCell, cells[3..36], blank);
+    try testing.expectEqual(2, cells[2].u);
+    for (cells[3..36]) |cell| try testing.expectEqual(blank, cell);
+    try testing.expectEqual(36, cells[36].u);
+
+    // shorter than a pattern block
+    fill(TestCell, cells[0..1], blank);
+    try testing.expectEqual(blank, cells[0]);
+    fill(TestCell, cells[0..0], .{});
+}
+
+test "grid: shift and copyRows" {
+    var cells: [40]TestCell = undefined;
+    for (&cells, 0..) |*cell, i| cell.* = .{ .u = @intCast(i) };
+    // right, overlapping
+    shift(TestCell, &cells, 3, 1, 30);
+    try testing.expectEqual(0, cells[0].u);
+    try testing.expectEqual(2, cells[2].u);
+    for (cells[3..33], 1..) |cell, u| try testing.expectEqual(u, cell.u);
+    try testing.expectEqual(33, cells[33].u);
+    // and back left
+    shift(TestCell, &cells, 1, 3, 30);
+    for (cells[0..31], 0..) |cell, u| try testing.expectEqual(u, cell.u);
+
+    const Row = [4]TestCell;
+    var rows: [5]Row = undefined;
+    for (&rows, 0..) |*row, y| {
+        for (row, 0..) |*cell, x| cell.* = .{ .u = @intCast(y * 10 + x) };
+    }
+    // down by one, three cells of every row
+    copyRows(Row, rows[1..4], rows[0..3], 3);
+    try expectCells(&.{ 0, 1, 2, 13 }, &rows[1]);
+    try expectCells(&.{ 10, 11, 12, 23 }, &rows[2]);
+    try expectCells(&.{ 20, 21, 22, 33 }, &rows[3]);
+    // up by two, whole rows
+    copyRows(Row, rows[0..3], rows[2..5], 4);
+    try expectCells(&.{ 10, 11, 12, 23 }, &rows[0]);
+    try expectCells(&.{ 40, 41, 42, 43 }, &rows[2]);
+}
+
+test "grid: benchmark" {
+    const util = @import("util.zig");
+    const cols = 240;
+    const Row = [cols]TestCell;
+    const rows = 67;
+    const screen = try testing.allocator.create([rows]Row);
+    defer testing.allocator.destroy(screen);
+    for (screen) |*row| @memset(row, .{});
+    const blank = TestCell{ .bg = 4 };
+    const iterations = 2000;
+
+    // an erase of 80 cells, then an insert and a delete of 8 on the same row
+    var timer = try std.time.Timer.start();
+    for (0..iterations) |i| {
+        const row = &screen[i % rows];
+        @memset(row[40..120], blank);
+        util.move(TestCell, row[48..cols], row[40 .. cols - 8]);
+        util.move(TestCell, row[40 .. cols - 8], row[48..cols]);
+    }
+    const scalar = timer.read();
+    timer.reset();
+    for (0..iterations) |i| {
+        const row = &screen[i % rows];
+        fill(TestCell, row[40..120], blank);
+        shift(TestCell, row, 48, 40, cols - 48);
+        shift(TestCell, row, 40, 48, cols - 48);
+    }
+    const vector = timer.read();
+    std.debug.print("grid span bench: {} ns per erase+insert+delete with @memset/util.move, {} ns with grid\n", .{
+        scalar / iterations,
+        vector / iterations,
+    });
+
+    // a scroll region of 60 rows moved by one, 80 of 240 columns in use
+    timer.reset();
+    for (0..iterations) |_| {
+        util.move(Row, screen[0..60], screen[1..61]);
+    }
+    const whole = timer.read();
+    timer.reset();
+    for (0..iterations) |_| {
+        copyRows(Row, screen[0..60], screen[1..61], 80);
+    }
+    const used = timer.read();
+    std.debug.print("grid rows bench: {} ns per scroll moving whole rows, {} ns moving used columns\n", .{
+        whole / iterations,
+        used / iterations,
+    });
+}
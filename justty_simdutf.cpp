@@ -360,6 +360,128 @@ HWY_ATTR size_t IndexOfAnyCharImpl(const uint8_t *HWY_RESTRICT text, size_t text
         return text_len;
     }
 }
+using D32 = hn::ScalableTag<uint32_t>;
+// First i with hay[i] == first and hay[i + gap] == last, len when there is none.
+// Prefilter for substring search: both ends of the needle must match.
+HWY_ATTR size_t IndexOfPairU32Impl(const uint32_t *HWY_RESTRICT hay, size_t len, uint32_t first, uint32_t last, size_t gap) {
+    if (len <= gap)
+        return len;
+    const size_t end = len - gap;
+    D32 d;
+    const size_t N = hn::Lanes(d);
+    const auto vfirst = hn::Set(d, first);
+    const auto vlast = hn::Set(d, last);
+    size_t i = 0;
+    for (; i + N <= end; i += N) {
+        const auto m = hn::And(hn::Eq(hn::LoadU(d, hay + i), vfirst), hn::Eq(hn::LoadU(d, hay + i + gap), vlast));
+        const intptr_t pos = hn::FindFirstTrue(d, m);
+        if (pos >= 0)
+            return i + static_cast<size_t>(pos);
+    }
+    for (; i < end; ++i) {
+        if (hay[i] == first && hay[i + gap] == last)
+            return i;
+    }
+    return len;
+}
+
+// Pixel kernels over a8r8g8b8 images, strides are in pixels.
+
+// Sets w x h pixels from dst to value.
+HWY_ATTR void FillRectU32Impl(uint32_t *HWY_RESTRICT dst, size_t stride, size_t w, size_t h, uint32_t value) {
+    D32 d;
+    const size_t N = hn::Lanes(d);
+    const auto v = hn::Set(d, value);
+    for (size_t y = 0; y < h; ++y) {
+        uint32_t *row = dst + y * stride;
+        size_t x = 0;
+        for (; x + N <= w; x += N)
+            hn::StoreU(v, d, row + x);
+        for (; x < w; ++x)
+            row[x] = value;
+    }
+}
+
+// Moves the columns [x, x + w) of rows [src_y, src_y + rows) to the same
+// columns from row dst_y. Rows are taken away from the destination, so
+// overlapping bands scroll either way.
+HWY_ATTR void MoveRowsU32Impl(uint32_t *base, size_t stride, size_t x, size_t w, size_t dst_y, size_t src_y, size_t rows) {
+    if (dst_y == src_y || rows == 0 || w == 0)
+        return;
+    D32 d;
+    const size_t N = hn::Lanes(d);
+    for (size_t k = 0; k < rows; ++k) {
+        const size_t r = dst_y < src_y ? k : rows - 1 - k;
+        const uint32_t *HWY_RESTRICT from = base + (src_y + r) * stride + x;
+        uint32_t *HWY_RESTRICT to = base + (dst_y + r) * stride + x;
+        size_t i = 0;
+        for (; i + N <= w; i += N)
+            hn::StoreU(hn::LoadU(d, from + i), d, to + i);
+        for (; i < w; ++i)
+            to[i] = from[i];
+    }
+}
+
+// XORs w x h pixels from dst with mask, 0x00ffffff inverts the colour.
+HWY_ATTR void XorRectU32Impl(uint32_t *HWY_RESTRICT dst, size_t stride, size_t w, size_t h, uint32_t mask) {
+    D32 d;
+    const size_t N = hn::Lanes(d);
+    const auto m = hn::Set(d, mask);
+    for (size_t y = 0; y < h; ++y) {
+        uint32_t *row = dst + y * stride;
+        size_t x = 0;
+        for (; x + N <= w; x += N)
+            hn::StoreU(hn::Xor(hn::LoadU(d, row + x), m), d, row + x);
+        for (; x < w; ++x)
+            row[x] ^= mask;
+    }
+}
+
+static inline uint32_t BlendPixel(uint32_t bg, uint32_t fg, uint32_t a) {
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        const uint32_t t = ((fg >> shift) & 0xff) * a + ((bg >> shift) & 0xff) * (255 - a) + 128;
+        out |= ((t + (t >> 8)) >> 8) << shift;
+    }
+    return out;
+}
+
+// Blends the premultiplied fg over w x h pixels from dst through the A8
+// coverage in mask, every channel of a pixel goes a / 255 of the way to fg.
+HWY_ATTR void BlendMaskU32Impl(uint32_t *HWY_RESTRICT dst, size_t stride, const uint8_t *HWY_RESTRICT mask, size_t mask_stride, size_t w, size_t h, uint32_t fg) {
+    D32 d;
+    const hn::Repartition<uint8_t, D32> d8;
+    const hn::Rebind<uint8_t, D32> dm; // a coverage byte per pixel
+    const hn::Half<decltype(d8)> dh;
+    const hn::Rebind<uint16_t, decltype(dh)> d16;
+    const size_t N = hn::Lanes(d);
+    const auto spread = hn::Set(d, 0x01010101u);
+    const auto fg8 = hn::BitCast(d8, hn::Set(d, fg));
+    const auto fg_lo = hn::PromoteTo(d16, hn::LowerHalf(dh, fg8));
+    const auto fg_hi = hn::PromoteTo(d16, hn::UpperHalf(dh, fg8));
+    const auto max = hn::Set(d16, uint16_t{255});
+    const auto half = hn::Set(d16, uint16_t{128});
+    // (fg * a + bg * (255 - a)) / 255, rounded
+    const auto lerp = [&](auto bg, auto f, auto a) HWY_ATTR {
+        const auto t = hn::Add(hn::Add(hn::Mul(f, a), hn::Mul(bg, hn::Sub(max, a))), half);
+        return hn::ShiftRight<8>(hn::Add(t, hn::ShiftRight<8>(t)));
+    };
+    for (size_t y = 0; y < h; ++y) {
+        uint32_t *row = dst + y * stride;
+        const uint8_t *cov = mask + y * mask_stride;
+        size_t x = 0;
+        for (; x + N <= w; x += N) {
+            const auto a8 = hn::BitCast(d8, hn::Mul(hn::PromoteTo(d, hn::LoadU(dm, cov + x)), spread));
+            const auto bg8 = hn::BitCast(d8, hn::LoadU(d, row + x));
+            const auto lo = lerp(hn::PromoteTo(d16, hn::LowerHalf(dh, bg8)), fg_lo, hn::PromoteTo(d16, hn::LowerHalf(dh, a8)));
+            const auto hi = lerp(hn::PromoteTo(d16, hn::UpperHalf(dh, bg8)), fg_hi, hn::PromoteTo(d16, hn::UpperHalf(dh, a8)));
+            const auto out = hn::Combine(d8, hn::DemoteTo(dh, hi), hn::DemoteTo(dh, lo));
+            hn::StoreU(hn::BitCast(d, out), d, row + x);
+        }
+        for (; x < w; ++x)
+            row[x] = BlendPixel(row[x], fg, cov[x]);
+    }
+}
 } // namespace HWY_NAMESPACE
 HWY_AFTER_NAMESPACE();
 
@@ -376,6 +498,11 @@ HWY_EXPORT(ContainsNewlineOrNonASCIIOrQuoteImpl);
 HWY_EXPORT(IndexOfCsiStartImpl);
 HWY_EXPORT(ExtractCsiSeqImpl);
 HWY_EXPORT(MoveBytesImpl);
+HWY_EXPORT(IndexOfPairU32Impl);
+HWY_EXPORT(FillRectU32Impl);
+HWY_EXPORT(MoveRowsU32Impl);
+HWY_EXPORT(XorRectU32Impl);
+HWY_EXPORT(BlendMaskU32Impl);
 
 size_t simd_base64_max_length(const char *input, size_t length) {
     return simdutf::maximal_binary_length_from_base64(input, length);
@@ -433,6 +560,10 @@ size_t simd_index_of_char(const uint8_t *haystack, size_t haystack_len, uint8_t
     return HWY_DYNAMIC_DISPATCH(IndexOfCharImpl)(haystack, haystack_len, needle);
 }
 
+size_t simd_index_of_pair_u32(const uint32_t *hay, size_t len, uint32_t first, uint32_t last, size_t gap) {
+    return HWY_DYNAMIC_DISPATCH(IndexOfPairU32Impl)(hay, len, first, last, gap);
+}
+
 size_t simd_index_of_any_char(const uint8_t *text, size_t text_len, const uint8_t *chars, size_t chars_len) {
     return HWY_DYNAMIC_DISPATCH(IndexOfAnyCharImpl)(text, text_len, chars, chars_len);
 }
@@ -463,4 +594,20 @@ void simd_to_upper(uint8_t *text, size_t len) {
     HWY_DYNAMIC_DISPATCH(ToUpperImpl)(text, len);
 }
 
+void simd_fill_rect_u32(uint32_t *dst, size_t stride, size_t w, size_t h, uint32_t value) {
+    HWY_DYNAMIC_DISPATCH(FillRectU32Impl)(dst, stride, w, h, value);
+}
+
+void simd_move_rows_u32(uint32_t *base, size_t stride, size_t x, size_t w, size_t dst_y, size_t src_y, size_t rows) {
+    HWY_DYNAMIC_DISPATCH(MoveRowsU32Impl)(base, stride, x, w, dst_y, src_y, rows);
+}
+
+void simd_xor_rect_u32(uint32_t *dst, size_t stride, size_t w, size_t h, uint32_t mask) {
+    HWY_DYNAMIC_DISPATCH(XorRectU32Impl)(dst, stride, w, h, mask);
+}
+
+void simd_blend_mask_u32(uint32_t *dst, size_t stride, const uint8_t *mask, size_t mask_stride, size_t w, size_t h, uint32_t fg) {
+    HWY_DYNAMIC_DISPATCH(BlendMaskU32Impl)(dst, stride, mask, mask_stride, w, h, fg);
+}
+
 } // extern "C"
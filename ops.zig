@@ -0,0 +1,158 @@
+//! Grid operations recorded by the parser, applied once a read is parsed.
+//!
+//! The common output of full screen programs (text, cursor positioning,
+//! colors, erases, line feeds and scrolls) is kept as a list of small ops
+//! instead of touching the grid while decoding. Pushing an op merges it into
+//! the previous one when the two have the effect of one: adjacent text, line
+//! feeds in a row, a carriage return before or after a line feed, and cursor
+//! positions that replace each other. A run of n line feeds at the bottom
+//! then scrolls the region once by n instead of n times by one.
+//!
+//! Ops carry no pointers, text and SGR parameters are copied into pools of
+//! the stream, so a stream can be filled from any buffer and applied later.
+const std = @import("std");
+
+const assert = std.debug.assert;
+
+pub const Kind = enum(u8) {
+    print, // UTF-8 text [a, a + b) of the text pool, no control bytes
+    cup, // CSI a;b H with the raw parameters, 0 is the default
+    sgr, // CSI m with the parameters [a, a + b) of the parameter pool
+    ed, // CSI a J
+    el, // CSI a K
+    su, // CSI a S
+    sd, // CSI a T
+    newline, // a line feeds, each returns to the first column
+    cr, // carriage return
+};
+
+pub const Op = struct {
+    kind: Kind,
+    a: u32 = 0,
+    b: u32 = 0,
+};
+
+pub const OpStream = struct {
+    pub const max_ops = 4096;
+    pub const text_bytes = 64 * 1024;
+    pub const max_params = 4096;
+
+    ops: [max_ops]Op = undefined,
+    len: usize = 0,
+    text: [text_bytes]u8 = undefined,
+    text_len: usize = 0,
+    params: [max_params]u32 = undefined,
+    params_len: usize = 0,
+
+    pub inline fn items(self: *const OpStream) []const Op {
+        return self.ops[0..self.len];
+    }
+
+    pub fn clear(self: *OpStream) void {
+        self.len = 0;
+        self.text_len = 0;
+        self.params_len = 0;
+    }
+
+    /// Appends op, merged into the previous one where possible.
+    /// False when the stream is full, it has to be applied and cleared first.
+    pub fn push(self: *OpStream, op: Op) bool {
+        if (self.len > 0) {
+            const last = &self.ops[self.len - 1];
+            switch (op.kind) {
+                .print => if (last.kind == .print and last.a + last.b == op.a) {
+                    last.b += op.b;
+                    return true;
+                },
+                .newline => switch (last.kind) {
+                    .newline => {
+                        last.a +|= op.a;
+                        return true;
+                    },
+                    // the line feed returns as well
+                    .cr => {
+                        last.* = op;
+                        return true;
+                    },
+                    else => {},
+                },
+                .cr => if (last.kind == .cr or last.kind == .newline) return true,
+                .cup => if (last.kind == .cup) {
+                    last.* = op;
+                    return true;
+                },
+                else => {},
+            }
+        }
+        if (self.len == max_ops) return false;
+        self.ops[self.len] = op;
+        self.len += 1;
+        return true;
+    }
+
+    /// Copies as much of text as fits and pushes it, returns the bytes taken.
+    pub fn print(self: *OpStream, text: []const u8) usize {
+        const n = @min(text.len, text_bytes - self.text_len);
+        if (n == 0) return 0;
+        if (!self.push(.{ .kind = .print, .a = @intCast(self.text_len), .b = @intCast(n) })) return 0;
+        @memcpy(self.text[self.text_len..][0..n], text[0..n]);
+        self.text_len += n;
+        return n;
+    }
+
+    /// Copies the parameters of an SGR sequence and pushes it, false when full.
+    pub fn sgr(self: *OpStream, params: []const u32) bool {
+        assert(params.len <= max_params);
+        if (self.params_len + params.len > max_params) return false;
+        if (!self.push(.{ .kind = .sgr, .a = @intCast(self.params_len), .b = @intCast(params.len) })) return false;
+        @memcpy(self.params[self.params_len..][0..params.len], params);
+        self.params_len += params.len;
+        return true;
+    }
+
+    pub inline fn textOf(self: *const OpStream, op: Op) []const u8 {
+        return self.text[op.a..][0..op.b];
+    }
+
+    pub inline fn paramsOf(self: *OpStream, op: Op) []u32 {
+        return self.params[op.a..][0..op.b];
+    }
+};
+
+const testing = std.testing;
+
+test "OpStream: merges" {
+    const stream = try testing.allocator.create(OpStream);
+    defer testing.allocator.destroy(stream);
+    stream.* = .{};
+
+    try testing.expectEqual(5, stream.print("hello"));
+    try testing.expectEqual(6, stream.print(" world"));
+    // CR LF LF LF is one op
+    try testing.expect(stream.push(.{ .kind = .cr }));
+    for (0..3) |_| try testing.expect(stream.push(.{ .kind = .newline, .a = 1 }));
+    try testing.expect(stream.push(.{ .kind = .cr }));
+    try testing.expect(stream.push(.{ .kind = .cup, .a = 3, .b = 4 }));
+    try testing.expect(stream.push(.{ .kind = .cup, .a = 5, .b = 1 }));
+    try testing.expect(stream.sgr(&.{ 1, 31 }));
+    try testing.expectEqual(1, stream.print("x"));
+
+    const ops = stream.items();
+    try testing.expectEqual(5, ops.len);
+    try testing.expectEqual(Kind.print, ops[0].kind);
+    try testing.expectEqualStrings("hello world", stream.textOf(ops[0]));
+    try testing.expectEqual(Op{ .kind = .newline, .a = 3 }, ops[1]);
+    try testing.expectEqual(Op{ .kind = .cup, .a = 5, .b = 1 }, ops[2]);
+    try testing.expectEqualSlices(u32, &.{ 1, 31 }, stream.paramsOf(ops[3]));
+    // text after another op is not merged with the first run
+    try testing.expectEqualStrings("x", stream.textOf(ops[4]));
+
+    stream.clear();
+    try testing.expectEqual(0, stream.items().len);
+    // a full text pool takes what fits
+    const big = [_]u8{'a'} ** 1000;
+    var taken: usize = 0;
+    while (taken < OpStream.text_bytes) taken += stream.print(&big);
+    try testing.expectEqual(0, stream.print("b"));
+    try testing.expectEqual(1, stream.items().len);
+}
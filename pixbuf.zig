@@ -295,7 +295,8 @@ pub const Buf = struct {
         }
     }
 
-    pub fn draw(self: *Self) !void {
+    /// Presents the whole buffer and clears the container around it.
+    pub fn draw(self: *Self) void {
         const cont_w = self.container.width;
         const cont_h = self.container.height;
 
@@ -350,35 +351,48 @@ pub const Buf = struct {
                 cont_h,
             );
         }
+        self.present(.{ .x = 0, .y = 0, .width = self.width, .height = self.height });
+    }
+
+    /// Copies rectangle r of the buffer to the container. The request is only
+    /// queued, with no reply to wait for: the caller flushes once per frame.
+    pub fn present(self: *Self, r: Rect) void {
+        if (r.x >= self.width or r.y >= self.height) return;
+        const w = @min(r.width, self.width - r.x);
+        const h = @min(r.height, self.height - r.y);
+        if (w == 0 or h == 0) return;
         if (self.is_shm) {
-            const copy_cookie = c.xcb_copy_area(
+            _ = c.xcb_copy_area(
                 self.conn,
                 self.shm.base.pixmap,
                 self.container.drawable,
                 self.gc,
-                0,
-                0,
-                self.x,
-                self.y,
-                self.width,
-                self.height,
+                @intCast(r.x),
+                @intCast(r.y),
+                self.x + @as(i16, @intCast(r.x)),
+                self.y + @as(i16, @intCast(r.y)),
+                w,
+                h,
             );
-            if (c.xcb_request_check(self.conn, copy_cookie) != null) {
-                std.log.err("Failed to copy area in SHM mode", .{});
-                return error.CopyAreaFailed;
-            }
         } else {
-            _ = c.xcb_image_put(
+            // put_image takes whole rows of the image, so the band of rows goes
+            const image = self.shm.no_base.image;
+            const stride: usize = image.*.stride;
+            _ = c.xcb_put_image(
                 self.conn,
+                c.XCB_IMAGE_FORMAT_Z_PIXMAP,
                 self.container.drawable,
                 self.gc,
-                self.shm.no_base.image,
+                self.width,
+                h,
                 self.x,
-                self.y,
+                self.y + @as(i16, @intCast(r.y)),
                 0,
+                image.*.depth,
+                @intCast(stride * h),
+                self.mapped.ptr + stride * r.y,
             );
         }
-        _ = c.xcb_flush(self.conn);
     }
 
     pub fn deinit(self: *Self) void {
@@ -399,10 +413,12 @@ pub const Buf = struct {
         _ = c.xcb_free_gc(self.conn, self.gc);
     }
 
-    pub fn rect(self: *Self, x: i16, y: i16, w: i16, h: i16, color: u32) void {
-        var dx: i16 = 0;
-        var dy: i16 = 0;
+    /// Pixels of the buffer, rows of self.width.
+    inline fn pixels(self: *Self) [*]u32 {
+        return @ptrCast(@alignCast(self.mapped.ptr));
+    }
 
+    pub fn rect(self: *Self, x: i16, y: i16, w: i16, h: i16, color: u32) void {
         var rect_x = x;
         var rect_y = y;
         var rect_w = w;
@@ -425,20 +441,35 @@ pub const Buf = struct {
 
         if (rect_w <= 0 or rect_h <= 0) return;
 
-        const pixels: [*]u32 = @ptrCast(@alignCast(self.mapped.ptr));
-        while (dy < rect_h) : (dy += 1) {
-            dx = 0;
-            while (dx < rect_w) : (dx += 1) {
-                const px_idx = (@as(usize, @intCast(rect_y + dy)) * @as(usize, self.width)) + @as(usize, @intCast(rect_x + dx));
-                pixels[px_idx] = color;
-            }
-        }
+        const at = @as(usize, @intCast(rect_y)) * self.width + @as(usize, @intCast(rect_x));
+        util.fillRect(self.pixels() + at, self.width, @intCast(rect_w), @intCast(rect_h), color);
+    }
+
+    /// Fills a rectangle with the a8r8g8b8 pixel, clipped to the buffer.
+    pub fn fill(self: *Self, x: u16, y: u16, w: u16, h: u16, pixel: u32) void {
+        if (x >= self.width or y >= self.height) return;
+        const at = @as(usize, y) * self.width + x;
+        util.fillRect(self.pixels() + at, self.width, @min(w, self.width - x), @min(h, self.height - y), pixel);
+    }
+
+    /// Inverts the colours of a rectangle, clipped to the buffer. Inverting
+    /// twice gives the pixels back.
+    pub fn invert(self: *Self, x: u16, y: u16, w: u16, h: u16) void {
+        if (x >= self.width or y >= self.height) return;
+        const at = @as(usize, y) * self.width + x;
+        util.xorRect(self.pixels() + at, self.width, @min(w, self.width - x), @min(h, self.height - y), 0x00ffffff);
+    }
+
+    /// Moves rows [src_y, src_y + rows) to dst_y, columns [x, x + w) only,
+    /// clipped to the buffer. The bands may overlap.
+    pub fn moveRows(self: *Self, x: u16, w: u16, dst_y: u16, src_y: u16, rows: u16) void {
+        const low = @max(dst_y, src_y);
+        if (x >= self.width or low >= self.height) return;
+        util.moveRows(self.pixels(), self.width, x, @min(w, self.width - x), dst_y, src_y, @min(rows, self.height - low));
     }
 
     pub fn clear(self: *Self, color: u32) void {
-        const pixels: [*]u32 = @ptrCast(@alignCast(self.mapped.ptr));
-        const total_pixels = @as(usize, self.width) * @as(usize, self.height);
-        @memset(pixels[0..total_pixels], color);
+        util.fillRect(self.pixels(), self.width, self.width, self.height, color);
     }
     pub fn setContainerSize(self: *Self, cw: u16, ch: u16) void {
         const dx: i32 = @divFloor(@as(i32, cw) - @as(i32, self.container.width), 2);
@@ -457,6 +488,52 @@ pub const Buf = struct {
     }
 };
 
+pub const Rect = struct {
+    x: u16,
+    y: u16,
+    width: u16,
+    height: u16,
+
+    inline fn bottom(self: Rect) u32 {
+        return @as(u32, self.y) + self.height;
+    }
+
+    fn join(a: Rect, b: Rect) Rect {
+        const x = @min(a.x, b.x);
+        const y = @min(a.y, b.y);
+        const right = @max(@as(u32, a.x) + a.width, @as(u32, b.x) + b.width);
+        return .{ .x = x, .y = y, .width = @intCast(right - x), .height = @intCast(@max(a.bottom(), b.bottom()) - y) };
+    }
+};
+
+/// Rectangles of a frame to present. A rectangle that starts where the
+/// last one ends, the next dirty row under the previous, is joined to it,
+/// so a frame is a few bands each as wide as the changes in it.
+pub const Damage = struct {
+    pub const max_rects = 64;
+
+    rects: [max_rects]Rect = undefined,
+    len: usize = 0,
+
+    pub inline fn items(self: *const Damage) []const Rect {
+        return self.rects[0..self.len];
+    }
+
+    pub fn add(self: *Damage, r: Rect) void {
+        if (r.width == 0 or r.height == 0) return;
+        if (self.len > 0) {
+            const last = &self.rects[self.len - 1];
+            // past max_rects everything else joins the last one
+            if (last.bottom() == r.y or self.len == max_rects) {
+                last.* = last.join(r);
+                return;
+            }
+        }
+        self.rects[self.len] = r;
+        self.len += 1;
+    }
+};
+
 inline fn countSize(stride: u16, h: u16) !usize {
     return try std.math.mul(u32, @intCast(stride), @intCast(h));
 }
@@ -471,3 +548,27 @@ const sh = union {
         image: *c.xcb_image_t,
     },
 };
+
+const testing = std.testing;
+
+test "Damage: rows join into bands" {
+    var damage: Damage = .{};
+    // a cell on row 1, then columns 2..6 of row 2 right under it
+    damage.add(.{ .x = 8, .y = 16, .width = 8, .height = 16 });
+    damage.add(.{ .x = 16, .y = 32, .width = 32, .height = 16 });
+    // row 5 is apart
+    damage.add(.{ .x = 0, .y = 80, .width = 8, .height = 16 });
+    damage.add(.{ .x = 0, .y = 96, .width = 0, .height = 16 });
+    try testing.expectEqualSlices(Rect, &.{
+        .{ .x = 8, .y = 16, .width = 40, .height = 32 },
+        .{ .x = 0, .y = 80, .width = 8, .height = 16 },
+    }, damage.items());
+
+    // every other row, the last rectangle takes the rest
+    damage = .{};
+    for (0..Damage.max_rects + 4) |i| damage.add(.{ .x = 0, .y = @intCast(i * 32), .width = 8, .height = 16 });
+    try testing.expectEqual(Damage.max_rects, damage.items().len);
+    const last = damage.items()[Damage.max_rects - 1];
+    try testing.expectEqual((Damage.max_rects - 1) * 32, last.y);
+    try testing.expectEqual((Damage.max_rects + 3) * 32 + 16, last.bottom());
+}
@@ -0,0 +1,257 @@
+//! Frames shown through the Present extension from two or three SHM buffers.
+//!
+//! A frame is drawn into a buffer the server is done with and handed to the
+//! window with PresentPixmap, its update region the damaged rectangles. The
+//! server sends IdleNotify once it no longer reads a buffer and CompleteNotify
+//! once the frame is shown. One frame is in flight at a time: a redraw while
+//! it is keeps its dirty rows for the completion, so drawing never waits on
+//! the server and never writes pixels it is reading.
+//!
+//! Frames only draw the cells that changed, so every buffer keeps the
+//! rectangles drawn into the others since it was last used. They are copied
+//! from the newest frame before the buffer is drawn into again.
+const std = @import("std");
+const c = @import("c.zig");
+const Buf = @import("pixbuf.zig");
+const Allocator = std.mem.Allocator;
+const build_options = @import("build_options");
+
+const assert = std.debug.assert;
+
+pub const max_buffers = 3;
+
+/// Which buffer the next frame goes to, apart from the connection.
+pub const Ring = struct {
+    count: u8,
+    busy: [max_buffers]bool = [_]bool{false} ** max_buffers, // read by the server
+    stale: [max_buffers]Buf.Damage = [_]Buf.Damage{.{}} ** max_buffers, // drawn elsewhere since
+    newest: ?u8 = null, // buffer of the last frame
+    in_flight: bool = false, // last frame not complete yet
+
+    pub fn init(count: u8) Ring {
+        assert(count >= 2 and count <= max_buffers);
+        return .{ .count = count };
+    }
+
+    /// The buffer to draw the next frame into, null while a frame is in flight
+    /// or the server reads every buffer. The newest one is taken when it is
+    /// idle, it has nothing to catch up on.
+    pub fn acquire(self: *const Ring) ?u8 {
+        if (self.in_flight) return null;
+        if (self.newest) |i| {
+            if (!self.busy[i]) return i;
+        }
+        for (0..self.count) |i| {
+            if (!self.busy[i]) return @intCast(i);
+        }
+        return null;
+    }
+
+    /// Records the frame drawn into buffer i, its damage is stale in the others.
+    pub fn submit(self: *Ring, i: u8, damage: *const Buf.Damage) void {
+        for (0..self.count) |k| {
+            if (k == i) continue;
+            for (damage.items()) |r| self.stale[k].add(r);
+        }
+        self.stale[i] = .{};
+        self.busy[i] = true;
+        self.newest = i;
+        self.in_flight = true;
+    }
+
+    pub inline fn idle(self: *Ring, i: u8) void {
+        self.busy[i] = false;
+    }
+
+    pub inline fn complete(self: *Ring) void {
+        self.in_flight = false;
+    }
+
+    /// Forgets every frame, for buffers that were just created.
+    pub fn reset(self: *Ring) void {
+        self.* = init(self.count);
+    }
+};
+
+pub const Chain = struct {
+    allocator: Allocator,
+    conn: *c.xcb_connection_t,
+    screen: *c.xcb_screen_t,
+    window: c.xcb_window_t,
+    opcode: u8, // major opcode of Present, its events carry it
+    eid: u32,
+    region: c.xcb_xfixes_region_t, // update region of the frame being presented
+    bufs: [max_buffers]Buf.Buf = undefined,
+    ring: Ring,
+    back: u8 = 0, // buffer being drawn
+    serial: u32 = 0,
+
+    /// Buffers of w x h presenting to window, null when the server has no
+    /// Present or the build has no SHM, frames then go through the pixmap.
+    pub fn init(
+        allocator: Allocator,
+        conn: *c.xcb_connection_t,
+        screen: *c.xcb_screen_t,
+        window: c.xcb_window_t,
+        w: u16,
+        h: u16,
+        count: u8,
+    ) !?Chain {
+        if (comptime !build_options.shm) return null;
+        if (count < 2) return null;
+        const ext = c.xcb_get_extension_data(conn, &c.xcb_present_id);
+        if (ext == null or ext.*.present == 0) {
+            std.log.info("Present extension not available", .{});
+            return null;
+        }
+        const version = c.xcb_present_query_version_reply(conn, c.xcb_present_query_version(conn, 1, 0), null) orelse return null;
+        std.c.free(version);
+        const fixes = c.xcb_xfixes_query_version_reply(conn, c.xcb_xfixes_query_version(conn, 2, 0), null) orelse return null;
+        std.c.free(fixes);
+
+        var chain = Chain{
+            .allocator = allocator,
+            .conn = conn,
+            .screen = screen,
+            .window = window,
+            .opcode = ext.*.major_opcode,
+            .eid = c.xcb_generate_id(conn),
+            .region = c.xcb_generate_id(conn),
+            .ring = Ring.init(@min(count, max_buffers)),
+        };
+        try chain.createBuffers(w, h);
+        _ = c.xcb_xfixes_create_region(conn, chain.region, 0, null);
+        _ = c.xcb_present_select_input(
+            conn,
+            chain.eid,
+            window,
+            c.XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY | c.XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY,
+        );
+        std.log.info("presenting with {d} SHM buffers", .{chain.ring.count});
+        return chain;
+    }
+
+    pub fn deinit(self: *Chain) void {
+        _ = c.xcb_present_select_input(self.conn, self.eid, self.window, c.XCB_PRESENT_EVENT_MASK_NO_EVENT);
+        _ = c.xcb_xfixes_destroy_region(self.conn, self.region);
+        for (self.bufs[0..self.ring.count]) |*buf| buf.deinit();
+    }
+
+    fn createBuffers(self: *Chain, w: u16, h: u16) !void {
+        var made: usize = 0;
+        errdefer for (self.bufs[0..made]) |*buf| buf.deinit();
+        while (made < self.ring.count) : (made += 1) {
+            self.bufs[made] = try Buf.Buf.init(self.allocator, self.conn, self.screen, self.window, w, h);
+        }
+    }
+
+    /// Buffers of the new size, the next frame has to draw every row.
+    pub fn resize(self: *Chain, w: u16, h: u16) !void {
+        for (self.bufs[0..self.ring.count]) |*buf| buf.deinit();
+        self.ring.reset();
+        try self.createBuffers(w, h);
+    }
+
+    /// The buffer to draw the next frame into, brought up to the newest frame.
+    /// Null while the last frame is not complete or no buffer is idle.
+    pub fn acquire(self: *Chain) ?*Buf.Buf {
+        const i = self.ring.acquire() orelse return null;
+        const buf = &self.bufs[i];
+        if (self.ring.newest) |newest| {
+            if (newest != i) {
+                const src = self.bufs[newest].pixman_image;
+                for (self.ring.stale[i].items()) |r| {
+                    c.pixman_image_composite32(c.PIXMAN_OP_SRC, src, null, buf.pixman_image, r.x, r.y, 0, 0, r.x, r.y, r.width, r.height);
+                }
+            }
+        }
+        self.ring.stale[i] = .{};
+        self.back = i;
+        return buf;
+    }
+
+    /// Presents the acquired buffer, only damage is updated on the window.
+    /// The request is queued, the caller flushes.
+    pub fn present(self: *Chain, damage: *const Buf.Damage) void {
+        if (damage.len == 0) return;
+        var rects: [Buf.Damage.max_rects]c.xcb_rectangle_t = undefined;
+        for (damage.items(), 0..) |r, k| {
+            rects[k] = .{ .x = @intCast(r.x), .y = @intCast(r.y), .width = r.width, .height = r.height };
+        }
+        _ = c.xcb_xfixes_set_region(self.conn, self.region, @intCast(damage.len), &rects);
+        self.serial +%= 1;
+        _ = c.xcb_present_pixmap(
+            self.conn,
+            self.window,
+            self.bufs[self.back].shm.base.pixmap,
+            self.serial,
+            0, // valid: the whole pixmap
+            self.region,
+            0,
+            0,
+            0, // any crtc
+            0, // no fences
+            0,
+            c.XCB_PRESENT_OPTION_NONE,
+            0, // next vblank
+            0,
+            0,
+            0,
+            null,
+        );
+        self.ring.submit(self.back, damage);
+    }
+
+    /// Takes the Present events among the connection's, true for one of them.
+    pub fn handleEvent(self: *Chain, event: *c.xcb_generic_event_t) bool {
+        if (event.response_type & ~@as(u8, 0x80) != c.XCB_GE_GENERIC) return false;
+        const ge: *c.xcb_ge_generic_event_t = @ptrCast(event);
+        if (ge.extension != self.opcode) return false;
+        switch (ge.event_type) {
+            c.XCB_PRESENT_IDLE_NOTIFY => {
+                const ev: *c.xcb_present_idle_notify_event_t = @ptrCast(event);
+                for (self.bufs[0..self.ring.count], 0..) |*buf, i| {
+                    if (buf.shm.base.pixmap == ev.pixmap) self.ring.idle(@intCast(i));
+                }
+            },
+            c.XCB_PRESENT_COMPLETE_NOTIFY => {
+                const ev: *c.xcb_present_complete_notify_event_t = @ptrCast(event);
+                // a notify of buffers freed by a resize completes nothing
+                if (ev.serial == self.serial) self.ring.complete();
+            },
+            else => {},
+        }
+        return true;
+    }
+};
+
+const testing = std.testing;
+
+test "Ring: buffers, pacing and damage carried forward" {
+    var ring = Ring.init(2);
+    try testing.expectEqual(0, ring.acquire().?);
+
+    var damage: Buf.Damage = .{};
+    damage.add(.{ .x = 8, .y = 16, .width = 8, .height = 16 });
+    ring.submit(0, &damage);
+    // nothing until the frame completes
+    try testing.expectEqual(null, ring.acquire());
+    ring.complete();
+    // the server still reads 0, the other one has its rectangle to catch up on
+    try testing.expectEqual(1, ring.acquire().?);
+    try testing.expectEqualSlices(Buf.Rect, damage.items(), ring.stale[1].items());
+
+    ring.submit(1, &damage);
+    ring.complete();
+    // 1 is shown and 0 is still busy: no buffer
+    try testing.expectEqual(null, ring.acquire());
+    ring.idle(0);
+    try testing.expectEqual(0, ring.acquire().?);
+    // an idle newest buffer goes first, it is up to date
+    ring.idle(1);
+    try testing.expectEqual(1, ring.acquire().?);
+
+    ring.reset();
+    try testing.expectEqual(null, ring.newest);
+    try testing.expectEqual(0, ring.stale[0].len);
+}
@@ -0,0 +1,1085 @@
+const std = @import("std");
+const c = @import("c.zig");
+const data_structs = @import("datastructs.zig");
+const util = @import("util.zig");
+const build_options = @import("build_options");
+const posix = std.posix;
+const linux = std.os.linux;
+const Allocator = std.mem.Allocator;
+
+const assert = std.debug.assert;
+
+/// Limits of the history, whichever is hit first wins.
+pub const Budget = struct {
+    lines: usize,
+    /// memory of uncompressed pages plus compressed blobs
+    bytes: usize,
+    /// the newest lines that are never compressed
+    hot_lines: usize = std.math.maxInt(usize),
+    /// size of the spill file for blobs over `bytes`, 0 disables spilling
+    spill_bytes: usize = 0,
+};
+
+/// FIFO of byte blobs in an unlinked memfd (or O_TMPFILE) mapped with mmap.
+/// The kernel can page the file out, the mapping is only reserved address
+/// space until written. Blobs are released in the order they were written,
+/// so the free space is always [tail, head) or [tail, end) + [0, head).
+pub const Spill = struct {
+    fd: posix.fd_t,
+    map: []align(std.heap.page_size_min) u8,
+    /// offset of the oldest live blob
+    head: usize = 0,
+    /// offset for the next blob
+    tail: usize = 0,
+    /// the tail went back to 0 while older blobs still sit at the end
+    wrapped: bool = false,
+    /// where the data before the wrap ends
+    wrap_end: usize = 0,
+    live: usize = 0,
+
+    pub fn init(size: usize) !Spill {
+        const fd: posix.fd_t = if (comptime build_options.memfd)
+            try posix.memfd_create("justty-scrollback", linux.MFD.CLOEXEC)
+        else
+            try posix.open("/tmp", .{ .ACCMODE = .RDWR, .TMPFILE = true, .DIRECTORY = true, .CLOEXEC = true }, 0o600);
+        errdefer posix.close(fd);
+
+        const len = std.mem.alignForward(usize, size, std.heap.page_size_min);
+        try posix.ftruncate(fd, len);
+        const map = try posix.mmap(
+            null,
+            len,
+            posix.PROT.READ | posix.PROT.WRITE,
+            .{ .TYPE = .SHARED },
+            fd,
+            0,
+        );
+        return .{ .fd = fd, .map = map };
+    }
+
+    pub fn deinit(self: *Spill) void {
+        posix.munmap(self.map);
+        posix.close(self.fd);
+    }
+
+    /// Reserves `len` bytes after the newest blob, null when the file is full.
+    pub fn alloc(self: *Spill, len: usize) ?[]u8 {
+        if (self.live == 0) self.* = .{ .fd = self.fd, .map = self.map };
+        var offset = self.tail;
+        if (!self.wrapped) {
+            if (self.map.len - self.tail < len) {
+                if (self.head < len) return null;
+                self.wrapped = true;
+                self.wrap_end = self.tail;
+                offset = 0;
+            }
+        } else if (self.head - self.tail < len) {
+            return null;
+        }
+        self.tail = offset + len;
+        self.live += 1;
+        return self.map[offset .. offset + len];
+    }
+
+    /// Releases the oldest blob and gives the pages that hold no live blob
+    /// back to the kernel.
+    pub fn release(self: *Spill, blob: []u8) void {
+        const offset = @intFromPtr(blob.ptr) - @intFromPtr(self.map.ptr);
+        const page = std.heap.page_size_min;
+        // after a wrap the newest blobs end at the tail, its page is still live
+        var punch_start = std.mem.alignBackward(usize, self.head, page);
+        if (self.wrapped) punch_start = @max(punch_start, std.mem.alignForward(usize, self.tail, page));
+        if (self.wrapped and offset < self.head) {
+            // first blob after the wrap, the end of the file is empty now
+            self.punch(punch_start, self.map.len);
+            self.wrapped = false;
+            punch_start = 0;
+        }
+        assert(offset == 0 or offset == self.head);
+        self.head = offset + blob.len;
+        self.live -= 1;
+        // everything before the page holding the next blob is free
+        self.punch(punch_start, std.mem.alignBackward(usize, self.head, page));
+    }
+
+    inline fn punch(self: *Spill, start: usize, end: usize) void {
+        if (end <= start) return;
+        posix.madvise(@alignCast(self.map.ptr + start), end - start, posix.MADV.REMOVE) catch {};
+    }
+};
+
+/// Scrollback history made of fixed-size pages of rows.
+/// Pages come from a pool and are kept in a FIFO ring:
+/// [ oldest page ... newest page ]
+//     ↑                  ↑
+//    head               tail (rows are appended here)
+/// When the budget is reached the oldest page is recycled as the new tail,
+/// so pushing a line never allocates in the steady state.
+///
+/// Pages older than `hot_lines` can be deflated with compressCold(), their
+/// rows are freed and only a zlib blob stays. Reading such a page inflates
+/// it again into a small LRU of decompressed pages.
+///
+/// Lines seen twice are interned: from the second occurrence on a row only
+/// keeps a refcounted reference to one shared copy of its cells.
+/// Cell must be an integer or provide `key() u64` identifying its contents.
+///
+/// A rewrap to another width reads the pages back oldest first and pushes
+/// the rewrapped rows in their place. Pages whose rows do not change go back
+/// whole, compressed or spilled, so only wrapped or too wide lines are read.
+pub fn ScrollbackType(
+    comptime Cell: type,
+    comptime cols: usize,
+    comptime page_rows: usize,
+) type {
+    comptime assert(page_rows > 0 and page_rows <= std.math.maxInt(u16));
+    comptime assert(cols <= std.math.maxInt(u16));
+
+    return struct {
+        const Scrollback = @This();
+
+        pub const Row = [cols]Cell;
+        pub const Rows = [page_rows]Row;
+
+        /// number of inflated cold pages kept around for the viewport
+        pub const lru_size = 4;
+        /// direct-mapped table of recently pushed lines, candidates for interning
+        pub const recent_size = 256;
+
+        /// Cells stored once for every row that repeats them.
+        pub const Shared = struct {
+            hash: u64,
+            /// rows referencing this copy
+            refs: u32,
+            cells: []Cell,
+        };
+
+        const Recent = struct {
+            hash: u64 = 0,
+            page: ?*Page = null,
+            row: u16 = 0,
+        };
+
+        /// What a rewrap needs to know about a row without reading it.
+        pub const RowInfo = struct {
+            /// cells up to the last one that is not blank, or more
+            width: u16,
+            /// the line goes on in the next row
+            wraps: bool = false,
+        };
+
+        pub const Page = struct {
+            /// cell storage, null while the page only exists as a blob
+            rows: ?*Rows,
+            /// occupied width of every row at the time it was pushed
+            lens: [page_rows]u16,
+            /// interned cells of the row, the row itself holds nothing then
+            shared: [page_rows]?*Shared,
+            /// number of used rows
+            count: u16 = 0,
+            /// deflated cells of the used rows, empty for hot pages
+            blob: []u8 = &.{},
+            /// blob lives in the spill file instead of the heap
+            spilled: bool = false,
+            /// number of the first row, as in `pushed`
+            first: u64 = 0,
+            /// widest RowInfo of the rows
+            width: u16 = 0,
+            /// some row goes on in the next one
+            wraps: bool = false,
+
+            inline fn full(self: *const Page) bool {
+                return self.count == page_rows;
+            }
+
+            inline fn compressed(self: *const Page) bool {
+                return self.blob.len > 0;
+            }
+
+            /// cells held by the row itself
+            inline fn inlineLen(self: *const Page, i: usize) usize {
+                return if (self.shared[i] != null) 0 else self.lens[i];
+            }
+
+            inline fn cells(self: *const Page) usize {
+                var n: usize = 0;
+                for (0..self.count) |i| n += self.inlineLen(i);
+                return n;
+            }
+        };
+
+        const PageRing = data_structs.RingBufferType(*Page, .slice);
+
+        allocator: Allocator,
+        pool: std.heap.MemoryPool(Page),
+        pages: PageRing,
+        budget: Budget,
+
+        /// Number of lines currently stored.
+        count: usize = 0,
+        /// Lines pushed since the last rewrap, the oldest stored line is number pushed - count.
+        pushed: u64 = 0,
+        /// Memory held by rows and in-memory blobs.
+        bytes: usize = 0,
+
+        /// blobs evicted from memory, created on first use
+        spill: ?Spill = null,
+        /// spilled pages always form a prefix of the ring
+        spilled_pages: usize = 0,
+        /// a page before the tail is not full, left by a rewrap
+        ragged: bool = false,
+        /// pages are set aside by a rewrap, nothing is spilled meanwhile
+        rewrapping: bool = false,
+
+        /// freed rows kept for the next page instead of going back to the allocator
+        spare: ?*Rows = null,
+        /// deflate output, sized for the worst case of one page
+        scratch: []u8 = &.{},
+
+        lru: [lru_size]?*Page = .{null} ** lru_size,
+        lru_tick: [lru_size]u64 = .{0} ** lru_size,
+        tick: u64 = 0,
+
+        lines: std.AutoHashMapUnmanaged(u64, *Shared) = .empty,
+        shared_pool: std.heap.MemoryPool(Shared),
+        recent: [recent_size]Recent = .{Recent{}} ** recent_size,
+        /// pushed lines that were stored as a reference
+        dedup_hits: usize = 0,
+
+        pub fn init(allocator: Allocator, budget: Budget) !Scrollback {
+            // two pages minimum: one filling up, one full to scroll back into
+            const max_pages = @max(2, budget.lines / page_rows);
+
+            var pages = try PageRing.init(allocator, max_pages);
+            errdefer pages.deinit(allocator);
+
+            return .{
+                .allocator = allocator,
+                .pool = std.heap.MemoryPool(Page).init(allocator),
+                .shared_pool = std.heap.MemoryPool(Shared).init(allocator),
+                .pages = pages,
+                .budget = budget,
+            };
+        }
+
+        pub fn deinit(self: *Scrollback) void {
+            self.clear();
+            if (self.spill) |*spill| spill.deinit();
+            if (self.spare) |rows| self.allocator.destroy(rows);
+            self.allocator.free(self.scratch);
+            self.pages.deinit(self.allocator);
+            self.pool.deinit();
+            assert(self.lines.count() == 0);
+            self.lines.deinit(self.allocator);
+            self.shared_pool.deinit();
+        }
+
+        /// Maximum number of lines the history can hold before recycling.
+        pub inline fn capacity(self: *const Scrollback) usize {
+            return self.pages.buffer.len * page_rows;
+        }
+
+        /// Drops every line, page headers stay in the pool for reuse.
+        pub fn clear(self: *Scrollback) void {
+            while (self.pages.pop()) |page| {
+                self.releaseShared(page);
+                self.releaseRows(page);
+                self.releaseBlob(page);
+                self.pool.destroy(page);
+            }
+            self.lru = .{null} ** lru_size;
+            self.recent = .{Recent{}} ** recent_size;
+            self.count = 0;
+            self.ragged = false;
+            assert(self.spilled_pages == 0);
+        }
+
+        /// Appends a row as the newest history line.
+        /// Only allocates while the history grows towards its budget.
+        pub inline fn push(self: *Scrollback, row: []const Cell) !void {
+            return self.pushRow(row, .{ .width = @intCast(row.len) });
+        }
+
+        /// push with what a later rewrap has to know about the row.
+        pub fn pushRow(self: *Scrollback, row: []const Cell, info: RowInfo) !void {
+            assert(row.len <= cols);
+            const page = try self.tailPage();
+            const i = page.count;
+            const hash = hashRow(row);
+            page.lens[i] = @intCast(row.len);
+            page.width = @max(page.width, info.width);
+            page.wraps = page.wraps or info.wraps;
+            page.shared[i] = self.intern(hash, row) catch null;
+            if (page.shared[i] == null) {
+                util.move(Cell, page.rows.?[i][0..row.len], row);
+                self.recent[hash % recent_size] = .{ .hash = hash, .page = page, .row = i };
+            }
+            page.count += 1;
+            self.count += 1;
+            self.pushed += 1;
+        }
+
+        /// Returns the page that receives the next line, recycling the
+        /// oldest one when the ring or the byte budget is full.
+        inline fn tailPage(self: *Scrollback) !*Page {
+            if (self.pages.tail()) |page| {
+                if (!page.full()) return page;
+            }
+            // make room in memory by spilling blobs before dropping lines
+            while (self.bytes + @sizeOf(Rows) > self.budget.bytes and self.spillOne()) {}
+            const over_budget = self.pages.count >= 2 and
+                self.bytes + @sizeOf(Rows) > self.budget.bytes;
+            const page = if (self.pages.full() or over_budget) blk: {
+                const oldest = self.pages.pop().?;
+                self.count -= oldest.count;
+                self.releaseShared(oldest);
+                self.forget(oldest);
+                self.releaseBlob(oldest);
+                break :blk oldest;
+            } else blk: {
+                const page = try self.pool.create();
+                page.* = .{ .rows = null, .lens = undefined, .shared = undefined };
+                break :blk page;
+            };
+            errdefer {
+                for (&self.recent) |*slot| {
+                    if (slot.page == page) slot.* = .{};
+                }
+                self.pool.destroy(page);
+            }
+            if (page.rows == null) page.rows = try self.takeRows();
+            page.count = 0;
+            page.first = self.pushed;
+            page.width = 0;
+            page.wraps = false;
+            self.pages.push_assume_capacity(page);
+            return page;
+        }
+
+        inline fn takeRows(self: *Scrollback) !*Rows {
+            const rows = self.spare orelse try self.allocator.create(Rows);
+            self.spare = null;
+            self.bytes += @sizeOf(Rows);
+            return rows;
+        }
+
+        fn releaseRows(self: *Scrollback, page: *Page) void {
+            const rows = page.rows orelse return;
+            page.rows = null;
+            self.bytes -= @sizeOf(Rows);
+            self.forget(page);
+            if (self.spare == null) {
+                self.spare = rows;
+            } else {
+                self.allocator.destroy(rows);
+            }
+        }
+
+        inline fn forget(self: *Scrollback, page: *Page) void {
+            for (&self.lru) |*slot| {
+                if (slot.* == page) slot.* = null;
+            }
+        }
+
+        fn releaseBlob(self: *Scrollback, page: *Page) void {
+            if (!page.compressed()) return;
+            if (page.spilled) {
+                // only the oldest page is ever released while spilled
+                self.spill.?.release(page.blob);
+                self.spilled_pages -= 1;
+                page.spilled = false;
+            } else {
+                self.bytes -= page.blob.len;
+                self.allocator.free(page.blob);
+            }
+            page.blob = &.{};
+        }
+
+        /// Moves the blob of the oldest unspilled page to the spill file.
+        /// Stops at the first hot page so the file stays in age order.
+        fn spillOne(self: *Scrollback) bool {
+            if (self.budget.spill_bytes == 0 or self.rewrapping) return false;
+            if (self.spilled_pages == self.pages.count) return false;
+            const page = self.pages.get(self.spilled_pages).?;
+            if (!page.compressed()) return false;
+
+            if (self.spill == null) {
+                self.spill = Spill.init(self.budget.spill_bytes) catch |err| {
+                    std.log.warn("scrollback spill file unavailable: {}", .{err});
+                    self.budget.spill_bytes = 0;
+                    return false;
+                };
+            }
+            const dest = self.spill.?.alloc(page.blob.len) orelse return false;
+            @memcpy(dest, page.blob);
+            self.bytes -= page.blob.len;
+            self.allocator.free(page.blob);
+            page.blob = dest;
+            page.spilled = true;
+            self.spilled_pages += 1;
+            return true;
+        }
+
+        inline fn cellKey(cell: Cell) u64 {
+            return switch (@typeInfo(Cell)) {
+                .int => @intCast(cell),
+                else => cell.key(),
+            };
+        }
+
+        fn hashRow(row: []const Cell) u64 {
+            var h: u64 = 0xcbf29ce484222325 ^ row.len;
+            for (row) |cell| h = (h ^ cellKey(cell)) *% 0x100000001b3;
+            // splitmix finalizer, the low bits pick the recent slot
+            h = (h ^ (h >> 30)) *% 0xbf58476d1ce4e5b9;
+            h = (h ^ (h >> 27)) *% 0x94d049bb133111eb;
+            return h ^ (h >> 31);
+        }
+
+        fn eqlRow(a: []const Cell, b: []const Cell) bool {
+            if (a.len != b.len) return false;
+            for (a, b) |x, y| {
+                if (cellKey(x) != cellKey(y)) return false;
+            }
+            return true;
+        }
+
+        /// Returns the shared copy of `row` when the line was seen before.
+        /// The shared copy is created on the second occurrence, which is
+        /// found through the recent table while its page is still hot.
+        fn intern(self: *Scrollback, hash: u64, row: []const Cell) !?*Shared {
+            if (row.len == 0) return null;
+            if (self.lines.get(hash)) |shared| {
+                if (!eqlRow(shared.cells, row)) return null;
+                shared.refs += 1;
+                self.dedup_hits += 1;
+                return shared;
+            }
+
+            const slot = self.recent[hash % recent_size];
+            if (slot.hash != hash) return null;
+            const page = slot.page orelse return null;
+            const rows = page.rows orelse return null;
+            if (slot.row >= page.count or page.shared[slot.row] != null) return null;
+            if (!eqlRow(rows[slot.row][0..page.lens[slot.row]], row)) return null;
+
+            const shared = try self.shared_pool.create();
+            errdefer self.shared_pool.destroy(shared);
+            const cells = try self.allocator.dupe(Cell, row);
+            errdefer self.allocator.free(cells);
+            shared.* = .{ .hash = hash, .refs = 1, .cells = cells };
+            try self.lines.put(self.allocator, hash, shared);
+            self.bytes += cells.len * @sizeOf(Cell);
+            self.dedup_hits += 1;
+            return shared;
+        }
+
+        fn releaseShared(self: *Scrollback, page: *Page) void {
+            for (page.shared[0..page.count]) |*ref| self.unref(ref);
+        }
+
+        inline fn unref(self: *Scrollback, ref: *?*Shared) void {
+            const shared = ref.* orelse return;
+            ref.* = null;
+            shared.refs -= 1;
+            if (shared.refs > 0) return;
+            _ = self.lines.remove(shared.hash);
+            self.bytes -= shared.cells.len * @sizeOf(Cell);
+            self.allocator.free(shared.cells);
+            self.shared_pool.destroy(shared);
+        }
+
+        /// Gives a page that holds no line anymore back to the pool.
+        fn destroyPage(self: *Scrollback, page: *Page) void {
+            self.releaseShared(page);
+            self.releaseRows(page);
+            self.releaseBlob(page);
+            for (&self.recent) |*slot| {
+                if (slot.page == page) slot.* = .{};
+            }
+            self.pool.destroy(page);
+        }
+
+        /// Deflates up to `max_pages` full pages that are older than the hot
+        /// window. Meant to be called when the terminal is idle.
+        /// Returns the number of pages compressed.
+        pub fn compressCold(self: *Scrollback, max_pages: usize) !usize {
+            const hot_pages = std.math.divCeil(usize, self.budget.hot_lines, page_rows) catch unreachable;
+            if (self.pages.count <= hot_pages) return 0;
+            const cold_pages = self.pages.count - hot_pages;
+
+            var done: usize = 0;
+            for (0..cold_pages) |p| {
+                if (done == max_pages) break;
+                const page = self.pages.get(p).?;
+                // only the tail still fills up, a rewrap can leave others short
+                if (page.compressed() or (!page.full() and p + 1 == self.pages.count)) continue;
+                try self.deflatePage(page);
+                done += 1;
+            }
+            while (self.bytes > self.budget.bytes and self.spillOne()) {}
+            return done;
+        }
+
+        fn deflatePage(self: *Scrollback, page: *Page) !void {
+            const rows = page.rows.?;
+            if (self.scratch.len == 0) {
+                self.scratch = try self.allocator.alloc(u8, c.compressBound(@sizeOf(Rows)));
+            }
+
+            // pack the used cells of every row to the front, moving left only
+            var packed_len: usize = 0;
+            const flat: [*]Cell = @ptrCast(rows);
+            for (rows[0..page.count], 0..) |*row, i| {
+                const len = page.inlineLen(i);
+                std.mem.copyForwards(Cell, flat[packed_len .. packed_len + len], row[0..len]);
+                packed_len += len;
+            }
+            const src = std.mem.sliceAsBytes(flat[0..packed_len]);
+
+            var dest_len: c.uLongf = @intCast(self.scratch.len);
+            if (c.compress2(self.scratch.ptr, &dest_len, src.ptr, @intCast(src.len), c.Z_BEST_SPEED) != c.Z_OK) {
+                self.unpack(page);
+                return error.CompressFailed;
+            }
+            const blob = self.allocator.dupe(u8, self.scratch[0..dest_len]) catch |err| {
+                self.unpack(page);
+                return err;
+            };
+
+            page.blob = blob;
+            self.bytes += blob.len;
+            self.releaseRows(page);
+        }
+
+        /// Inflates a cold page into fresh rows and keeps it in the LRU.
+        fn inflatePage(self: *Scrollback, page: *Page) !*Rows {
+            assert(page.compressed());
+            const rows = try self.takeRows();
+            errdefer {
+                self.spare = rows;
+                self.bytes -= @sizeOf(Rows);
+            }
+
+            const flat: [*]Cell = @ptrCast(rows);
+            const dest = std.mem.sliceAsBytes(flat[0..page.cells()]);
+            var dest_len: c.uLongf = @intCast(dest.len);
+            if (c.uncompress(dest.ptr, &dest_len, page.blob.ptr, @intCast(page.blob.len)) != c.Z_OK or
+                dest_len != dest.len)
+            {
+                return error.DecompressFailed;
+            }
+            page.rows = rows;
+            self.unpack(page);
+
+            // evict the least recently used page, its blob stays
+            var victim: usize = 0;
+            for (self.lru, self.lru_tick, 0..) |slot, tick, i| {
+                if (slot == null) {
+                    victim = i;
+                    break;
+                }
+                if (tick < self.lru_tick[victim]) victim = i;
+            }
+            if (self.lru[victim]) |old| self.releaseRows(old);
+            self.lru[victim] = page;
+            self.lru_tick[victim] = self.tick;
+            return rows;
+        }
+
+        /// Moves packed cells back to their rows, from the last row so that
+        /// nothing is overwritten before it is read.
+        fn unpack(_: *Scrollback, page: *Page) void {
+            const rows = page.rows.?;
+            const flat: [*]Cell = @ptrCast(rows);
+            var end = page.cells();
+            var i: usize = page.count;
+            while (i > 0) {
+                i -= 1;
+                const len = page.inlineLen(i);
+                end -= len;
+                std.mem.copyBackwards(Cell, rows[i][0..len], flat[end .. end + len]);
+            }
+        }
+
+        inline fn touch(self: *Scrollback, page: *Page) void {
+            self.tick += 1;
+            for (self.lru, 0..) |slot, i| {
+                if (slot == page) self.lru_tick[i] = self.tick;
+            }
+        }
+
+        /// Page and row of a line by age.
+        inline fn locate(self: *const Scrollback, index: usize) struct { *Page, usize } {
+            // every page but the tail is full, so the position is plain division
+            if (!self.ragged) return .{ self.pages.get(index / page_rows).?, index % page_rows };
+            // otherwise the last page starting at or before the line
+            const line = self.pushed - self.count + index;
+            var lo: usize = 0;
+            var hi: usize = self.pages.count;
+            while (hi - lo > 1) {
+                const mid = lo + (hi - lo) / 2;
+                if (self.pages.get(mid).?.first <= line) lo = mid else hi = mid;
+            }
+            const page = self.pages.get(lo).?;
+            return .{ page, @intCast(line - page.first) };
+        }
+
+        /// Line by age, 0 is the oldest stored line.
+        /// Cold pages are inflated on demand into one of lru_size slots, so
+        /// the slice is only valid until the next get, push or compressCold:
+        /// a later get may evict the page it points into. Callers that need
+        /// a line across another call copy it first.
+        pub fn get(self: *Scrollback, index: usize) !?[]const Cell {
+            if (index >= self.count) return null;
+            const page, const i = self.locate(index);
+            if (page.shared[i]) |shared| return shared.cells;
+            if (page.compressed()) self.touch(page);
+            const rows = page.rows orelse try self.inflatePage(page);
+            return rows[i][0..page.lens[i]];
+        }
+
+        /// Line by distance from the screen, 0 is the line that scrolled out last.
+        /// Valid as long as a line from get.
+        pub inline fn getFromNewest(self: *Scrollback, n: usize) !?[]const Cell {
+            if (n >= self.count) return null;
+            return self.get(self.count - 1 - n);
+        }
+
+        /// Newest lines that popNewest can take back, the ones in hot pages.
+        pub fn hotTail(self: *const Scrollback) usize {
+            var n: usize = 0;
+            var p = self.pages.count;
+            while (p > 0) {
+                p -= 1;
+                const page = self.pages.get(p).?;
+                if (page.compressed()) break;
+                n += page.count;
+            }
+            return n;
+        }
+
+        /// Moves the newest line into out and drops it, for lines going back
+        /// to the screen. Returns its length, null past hotTail().
+        pub fn popNewest(self: *Scrollback, out: *Row) ?usize {
+            const page = self.pages.tail() orelse return null;
+            if (page.compressed() or page.count == 0) return null;
+            const i = page.count - 1;
+            const len = page.lens[i];
+            const cells = if (page.shared[i]) |shared| shared.cells else page.rows.?[i][0..len];
+            util.move(Cell, out[0..len], cells);
+            self.unref(&page.shared[i]);
+            page.count -= 1;
+            self.count -= 1;
+            self.pushed -= 1;
+            if (page.count == 0) {
+                _ = self.pages.pop_tail();
+                self.destroyPage(page);
+            }
+            return len;
+        }
+
+        /// Pages set aside by beginRewrap, oldest first.
+        pub const Rewrap = struct {
+            pages: PageRing,
+            width: u16,
+            /// spilled pages all go back whole or are all read, the spill file is a FIFO
+            keep_spilled: bool,
+
+            pub inline fn next(self: *Rewrap) ?*Page {
+                return self.pages.pop();
+            }
+
+            /// Whether the rows of page stay as they are at the new width:
+            /// none is cut or joined. `joined` tells whether the line before
+            /// the page goes on in its first row.
+            pub fn keeps(self: *const Rewrap, page: *const Page, joined: bool) bool {
+                if (page.spilled) return self.keep_spilled;
+                return !joined and !page.wraps and page.width <= self.width;
+            }
+        };
+
+        /// Sets every page aside for a rewrap to `width` columns, the history
+        /// starts empty. Each page then either goes back whole with keepPage
+        /// or has its rows read with pageRow, rewrapped and pushed, and is
+        /// dropped with dropPage. The line budget holds throughout and no page
+        /// is copied, end with endRewrap.
+        pub fn beginRewrap(self: *Scrollback, width: u16) !Rewrap {
+            var rewrap = Rewrap{
+                .pages = try PageRing.init(self.allocator, self.pages.buffer.len),
+                .width = width,
+                .keep_spilled = true,
+            };
+            for (0..self.spilled_pages) |p| {
+                const page = self.pages.get(p).?;
+                if (page.wraps or page.width > width) rewrap.keep_spilled = false;
+            }
+            std.mem.swap(PageRing, &rewrap.pages, &self.pages);
+            self.pushed -= self.count;
+            self.count = 0;
+            self.ragged = false;
+            self.rewrapping = true;
+            return rewrap;
+        }
+
+        /// Puts a page set aside back whole as the newest one.
+        pub fn keepPage(self: *Scrollback, page: *Page) void {
+            if (self.pages.tail()) |tail| {
+                if (!tail.full()) self.ragged = true;
+            }
+            if (self.pages.full()) {
+                const oldest = self.pages.pop().?;
+                self.count -= oldest.count;
+                self.destroyPage(oldest);
+            }
+            page.first = self.pushed;
+            self.pages.push_assume_capacity(page);
+            self.count += page.count;
+            self.pushed += page.count;
+        }
+
+        /// Row i of a page set aside, cold pages are inflated.
+        pub fn pageRow(self: *Scrollback, page: *Page, i: usize) ![]const Cell {
+            if (page.shared[i]) |shared| return shared.cells;
+            const rows = page.rows orelse try self.inflatePage(page);
+            return rows[i][0..page.lens[i]];
+        }
+
+        /// Frees a page set aside once its rows were pushed again.
+        pub inline fn dropPage(self: *Scrollback, page: *Page) void {
+            self.destroyPage(page);
+        }
+
+        pub fn endRewrap(self: *Scrollback, rewrap: *Rewrap) void {
+            while (rewrap.next()) |page| self.dropPage(page);
+            rewrap.pages.deinit(self.allocator);
+            self.rewrapping = false;
+            while (self.bytes > self.budget.bytes and self.spillOne()) {}
+        }
+    };
+}
+
+const testing = std.testing;
+
+test "Scrollback: push and get" {
+    const History = ScrollbackType(u32, 8, 4);
+    var history = try History.init(testing.allocator, .{ .lines = 16, .bytes = std.math.maxInt(usize) });
+    defer history.deinit();
+
+    for (0..10) |i| {
+        const row = [_]u32{@intCast(i)} ** 3;
+        try history.push(&row);
+    }
+    try testing.expectEqual(10, history.count);
+    try testing.expectEqual(0, (try history.get(0)).?[0]);
+    try testing.expectEqual(3, (try history.get(0)).?.len);
+    try testing.expectEqual(9, (try history.getFromNewest(0)).?[2]);
+    try testing.expectEqual(7, (try history.getFromNewest(2)).?[0]);
+    try testing.expectEqual(null, try history.get(10));
+}
+
+test "Scrollback: recycles oldest page" {
+    const History = ScrollbackType(u32, 8, 4);
+    var history = try History.init(testing.allocator, .{ .lines = 12, .bytes = std.math.maxInt(usize) });
+    defer history.deinit();
+    try testing.expectEqual(12, history.capacity());
+
+    for (0..12) |i| try history.push(&[_]u32{@intCast(i)});
+    const oldest = history.pages.head().?;
+
+    // the 13th line reuses the page of lines 0..3
+    try history.push(&[_]u32{12});
+    try testing.expectEqual(oldest, history.pages.tail().?);
+    try testing.expectEqual(9, history.count);
+    try testing.expectEqual(4, (try history.get(0)).?[0]);
+    try testing.expectEqual(12, (try history.getFromNewest(0)).?[0]);
+
+    history.clear();
+    try testing.expectEqual(0, history.count);
+    try testing.expectEqual(null, try history.getFromNewest(0));
+}
+
+test "Scrollback: compress cold pages" {
+    const History = ScrollbackType(u32, 8, 4);
+    var history = try History.init(testing.allocator, .{
+        .lines = 64,
+        .bytes = std.math.maxInt(usize),
+        .hot_lines = 4,
+    });
+    defer history.deinit();
+
+    for (0..20) |i| {
+        var row: [8]u32 = undefined;
+        for (&row, 0..) |*cell, x| cell.* = @intCast(i * 100 + x);
+        try history.push(row[0 .. i % 8 + 1]);
+    }
+
+    // 5 pages, the newest one stays hot
+    try testing.expectEqual(4, try history.compressCold(10));
+    try testing.expectEqual(0, try history.compressCold(10));
+    for (0..4) |p| try testing.expect(history.pages.get(p).?.rows == null);
+
+    for (0..20) |i| {
+        const line = (try history.get(i)).?;
+        try testing.expectEqual(i % 8 + 1, line.len);
+        try testing.expectEqual(i * 100 + line.len - 1, line[line.len - 1]);
+    }
+    // only lru_size cold pages stay inflated
+    var inflated: usize = 0;
+    for (0..4) |p| {
+        if (history.pages.get(p).?.rows != null) inflated += 1;
+    }
+    try testing.expect(inflated <= History.lru_size);
+}
+
+test "Scrollback: rewrap keeps unchanged pages" {
+    const History = ScrollbackType(u32, 8, 4);
+    var history = try History.init(testing.allocator, .{
+        .lines = 64,
+        .bytes = std.math.maxInt(usize),
+        .hot_lines = 4,
+    });
+    defer history.deinit();
+
+    var rows: [12][3]u32 = undefined;
+    for (&rows, 0..) |*row, i| {
+        for (row, 0..) |*cell, x| cell.* = @intCast(i * 10 + x);
+        // the third page has a line going on in the next row
+        try history.pushRow(row, .{ .width = 3, .wraps = i == 8 });
+    }
+    try testing.expectEqual(2, try history.compressCold(10));
+
+    var aside = try history.beginRewrap(6);
+    {
+        defer history.endRewrap(&aside);
+        // the rows of the first page are joined in pairs, the second page stays
+        const first = aside.next().?;
+        try testing.expect(!aside.keeps(first, true));
+        var joined: [6]u32 = undefined;
+        for (0..2) |pair| {
+            for (0..2) |half| @memcpy(joined[half * 3 ..][0..3], try history.pageRow(first, pair * 2 + half));
+            try history.pushRow(&joined, .{ .width = 6 });
+        }
+        history.dropPage(first);
+        const second = aside.next().?;
+        try testing.expect(aside.keeps(second, false));
+        history.keepPage(second);
+        const third = aside.next().?;
+        try testing.expect(!aside.keeps(third, false));
+        for (0..third.count) |i| try history.pushRow(try history.pageRow(third, i), .{ .width = 3 });
+        history.dropPage(third);
+        try testing.expectEqual(null, aside.next());
+    }
+
+    try testing.expectEqual(10, history.count);
+    try testing.expect(history.pages.get(1).?.rows == null);
+    try testing.expectEqual(10, (try history.get(0)).?[3]);
+    try testing.expectEqual(40, (try history.get(2)).?[0]);
+    try testing.expectEqual(72, (try history.get(5)).?[2]);
+    try testing.expectEqual(110, (try history.get(9)).?[0]);
+
+    // only the hot lines after the kept page come back
+    try testing.expectEqual(4, history.hotTail());
+    var out: History.Row = undefined;
+    for (0..4) |n| {
+        try testing.expectEqual(3, history.popNewest(&out).?);
+        try testing.expectEqual((11 - n) * 10, out[0]);
+    }
+    try testing.expectEqual(null, history.popNewest(&out));
+    try testing.expectEqual(6, history.count);
+}
+
+test "Spill: fifo wraps around" {
+    var spill = try Spill.init(std.heap.page_size_min);
+    defer spill.deinit();
+    const size = spill.map.len;
+
+    const a = spill.alloc(size / 2).?;
+    const b = spill.alloc(size / 4).?;
+    try testing.expectEqual(null, spill.alloc(size / 2));
+    spill.release(a);
+    // does not fit at the end, goes to the front
+    const d = spill.alloc(size / 2).?;
+    try testing.expectEqual(@intFromPtr(spill.map.ptr), @intFromPtr(d.ptr));
+    try testing.expect(spill.wrapped);
+    spill.release(b);
+    spill.release(d);
+    try testing.expect(!spill.wrapped);
+    try testing.expectEqual(0, spill.live);
+
+    // blobs sharing a page with released ones keep their bytes across wraps
+    var fifo = try Spill.init(4 * std.heap.page_size_min);
+    defer fifo.deinit();
+    var blobs: [64][]u8 = undefined;
+    var first: usize = 0;
+    var next: usize = 0;
+    var wraps: usize = 0;
+    for (0..300) |i| {
+        const len = 700 + i * 397 % 1500;
+        const blob = while (true) {
+            if (fifo.alloc(len)) |got| break got;
+            fifo.release(blobs[first % blobs.len]);
+            first += 1;
+            for (first..next) |k| try testing.expect(std.mem.allEqual(u8, blobs[k % blobs.len], @truncate(k)));
+        };
+        if (@intFromPtr(blob.ptr) == @intFromPtr(fifo.map.ptr) and next > 0) wraps += 1;
+        @memset(blob, @truncate(next));
+        blobs[next % blobs.len] = blob;
+        next += 1;
+    }
+    try testing.expect(wraps > 1);
+    for (first..next) |k| try testing.expect(std.mem.allEqual(u8, blobs[k % blobs.len], @truncate(k)));
+}
+
+test "Scrollback: spill cold pages to file" {
+    const History = ScrollbackType(u32, 8, 4);
+    var history = try History.init(testing.allocator, .{
+        .lines = 64,
+        .bytes = 2 * @sizeOf(History.Rows),
+        .hot_lines = 4,
+        .spill_bytes = 1 << 16,
+    });
+    defer history.deinit();
+
+    for (0..40) |i| {
+        try history.push(&[_]u32{ @intCast(i), 7, 7, 7 });
+        _ = try history.compressCold(1);
+    }
+    try testing.expect(history.spilled_pages > 0);
+    try testing.expect(history.bytes <= 2 * @sizeOf(History.Rows));
+    // spilled pages read back through the mapping
+    for (0..history.count) |i| {
+        const line = (try history.get(i)).?;
+        try testing.expectEqual(40 - history.count + i, line[0]);
+    }
+}
+
+test "Scrollback: spill instead of recycling past the memory budget" {
+    const History = ScrollbackType(u32, 8, 4);
+    // the line cap is far away, only the byte budget is hit
+    var history = try History.init(testing.allocator, .{
+        .lines = 1 << 20,
+        .bytes = 2 * @sizeOf(History.Rows),
+        .hot_lines = 4,
+        .spill_bytes = 1 << 20,
+    });
+    defer history.deinit();
+
+    for (0..400) |i| {
+        var row: [8]u32 = undefined;
+        for (&row, 0..) |*cell, x| cell.* = @intCast(i * 8 + x);
+        try history.push(&row);
+        _ = try history.compressCold(1);
+    }
+    try testing.expectEqual(400, history.count);
+    try testing.expect(history.spilled_pages > history.pages.count / 2);
+    try testing.expect(history.bytes <= 2 * @sizeOf(History.Rows));
+    for (0..400) |i| {
+        const line = (try history.get(i)).?;
+        try testing.expectEqual(i * 8, line[0]);
+        try testing.expectEqual(i * 8 + 7, line[7]);
+    }
+}
+
+test "Scrollback: dedup repeated lines" {
+    const History = ScrollbackType(u32, 8, 4);
+    var history = try History.init(testing.allocator, .{ .lines = 8, .bytes = std.math.maxInt(usize) });
+    defer history.deinit();
+
+    const ok = [_]u32{ 'o', 'k' };
+    try history.push(&ok);
+    try history.push(&[_]u32{'x'});
+    try history.push(&ok); // second occurrence creates the shared copy
+    try history.push(&ok);
+    try testing.expectEqual(2, history.dedup_hits);
+    try testing.expectEqual(1, history.lines.count());
+    const shared = history.pages.get(0).?.shared[2].?;
+    try testing.expectEqual(2, shared.refs);
+    try testing.expectEqualSlices(u32, &ok, (try history.get(3)).?);
+
+    // recycling the pages drops the references and the shared copy
+    for (0..12) |i| try history.push(&[_]u32{@intCast(i)});
+    try testing.expectEqual(0, history.lines.count());
+}
+
+test "Scrollback: dedup benchmark" {
+    const History = ScrollbackType(u64, 240, 256);
+    var history = try History.init(testing.allocator, .{
+        .lines = 100_000,
+        .bytes = std.math.maxInt(usize),
+        .hot_lines = 256,
+    });
+    defer history.deinit();
+
+    // a CI-like log: compiler lines, test results, separators and progress bars
+    var row: [240]u64 = undefined;
+    var timer = try std.time.Timer.start();
+    for (0..history.capacity()) |i| {
+        var buf: [240]u8 = undefined;
+        const text = switch (i % 8) {
+            0 => std.fmt.bufPrint(&buf, "[{d}/2000] Compiling src/module_{d}.zig", .{ i % 2000, i % 300 }),
+            1, 2, 3 => std.fmt.bufPrint(&buf, "test ... ok", .{}),
+            4 => std.fmt.bufPrint(&buf, "----------------------------------------", .{}),
+            5 => std.fmt.bufPrint(&buf, "[{d:>3}%] ##########", .{i % 101}),
+            6 => std.fmt.bufPrint(&buf, "", .{}),
+            else => std.fmt.bufPrint(&buf, "warning: unused variable 'x' in fn_{d}", .{i % 50}),
+        } catch unreachable;
+        for (text, 0..) |ch, x| row[x] = ch;
+        try history.push(row[0..text.len]);
+    }
+    const elapsed = timer.read();
+
+    var raw: usize = 0;
+    for (0..history.count) |i| raw += (try history.get(i)).?.len * @sizeOf(u64);
+    std.debug.print("scrollback dedup bench: {} ns per line, {d:.1}% lines deduplicated, {} shared copies, {} bytes of cells -> {} bytes held\n", .{
+        elapsed / history.count,
+        @as(f64, @floatFromInt(history.dedup_hits)) * 100.0 / @as(f64, @floatFromInt(history.count)),
+        history.lines.count(),
+        raw,
+        history.bytes,
+    });
+}
+
+test "Scrollback: push benchmark" {
+    const History = ScrollbackType(u64, 240, 256);
+    var history = try History.init(testing.allocator, .{ .lines = 10_000, .bytes = std.math.maxInt(usize) });
+    defer history.deinit();
+
+    const row = [_]u64{0x41} ** 240;
+    // warm up until every page of the budget exists
+    for (0..history.capacity()) |_| try history.push(&row);
+
+    const iterations = 100_000;
+    var timer = try std.time.Timer.start();
+    for (0..iterations) |_| try history.push(&row);
+    const elapsed = timer.read();
+    std.debug.print("scrollback push bench: {} ns per line\n", .{elapsed / iterations});
+}
+
+test "Scrollback: compression benchmark" {
+    const History = ScrollbackType(u64, 240, 256);
+    var history = try History.init(testing.allocator, .{
+        .lines = 100_000,
+        .bytes = std.math.maxInt(usize),
+        .hot_lines = 256,
+    });
+    defer history.deinit();
+
+    var row = [_]u64{' '} ** 240;
+    for (0..history.capacity()) |i| {
+        // build-log like lines: a short varying prefix, blank tail
+        row[i % 60] = 'a' + i % 26;
+        try history.push(row[0..80]);
+    }
+    const raw = history.bytes;
+
+    var timer = try std.time.Timer.start();
+    const pages = try history.compressCold(std.math.maxInt(usize));
+    const elapsed = timer.read();
+    std.debug.print("scrollback compress bench: {} pages, {} ns per page, {} -> {} bytes\n", .{
+        pages,
+        elapsed / @max(pages, 1),
+        raw,
+        history.bytes,
+    });
+}
@@ -0,0 +1,273 @@
+const std = @import("std");
+const util = @import("util.zig");
+const Allocator = std.mem.Allocator;
+
+const assert = std.debug.assert;
+
+/// Position of a match. Lines are numbered by age and keep their number
+/// while they scroll from the screen into the history.
+pub const Match = struct {
+    line: u64,
+    col: u16,
+    len: u16,
+};
+
+/// Incremental substring search over the screen and the scrollback, newest
+/// line first. The text is scanned in chunks of `chunk_lines` lines copied
+/// into a UTF-32 buffer, one separator between lines, so matches never span
+/// two lines. Candidates come from a SIMD scan for the first and last
+/// codepoint of the needle at the right distance and are then verified.
+///
+/// step() does a bounded amount of work and can be called between reads of
+/// the pty, so a search over a long history never stalls output.
+///
+/// The source passed to step() provides:
+///   lineRange() [2]u64      numbers of the oldest line and one past the newest
+///   lineAt(n: u64) ?[]const Cell   valid until the next lineAt, each line
+///                                   is copied into the chunk before the next
+pub fn SearchType(comptime Cell: type, comptime cols: usize) type {
+    return struct {
+        const Search = @This();
+
+        /// one history page per chunk
+        pub const chunk_lines = 256;
+        pub const max_needle = 256;
+        const separator: u32 = 0;
+
+        allocator: Allocator,
+        needle: [max_needle]u32 = undefined,
+        needle_len: u16 = 0,
+        /// matches found so far, newest first
+        matches: std.ArrayListUnmanaged(Match) = .empty,
+        /// next line to scan, scanning goes towards older lines
+        next: u64 = 0,
+        done: bool = true,
+
+        /// codepoints of the current chunk
+        text: []u32 = &.{},
+        /// offset of every chunk line in text
+        starts: [chunk_lines]u32 = undefined,
+
+        pub fn init(allocator: Allocator) Search {
+            return .{ .allocator = allocator };
+        }
+
+        pub fn deinit(self: *Search) void {
+            self.matches.deinit(self.allocator);
+            self.allocator.free(self.text);
+        }
+
+        /// Starts a new search from the newest line of `source`.
+        /// An empty needle stops searching, pattern() restarts the current one.
+        pub fn start(self: *Search, source: anytype, needle: []const u32) void {
+            self.matches.clearRetainingCapacity();
+            self.needle_len = @intCast(@min(needle.len, max_needle));
+            std.mem.copyForwards(u32, self.needle[0..self.needle_len], needle[0..self.needle_len]);
+            self.next = source.lineRange()[1];
+            self.done = self.needle_len == 0 or std.mem.indexOfScalar(u32, self.pattern(), separator) != null;
+        }
+
+        pub inline fn pattern(self: *const Search) []const u32 {
+            return self.needle[0..self.needle_len];
+        }
+
+        /// Matches found so far on line n, in column order.
+        pub fn onLine(self: *const Search, n: u64) []const Match {
+            const items = self.matches.items;
+            // newest first: lines go down through the list
+            var lo: usize = 0;
+            var hi: usize = items.len;
+            while (lo < hi) {
+                const mid = (lo + hi) / 2;
+                if (items[mid].line > n) lo = mid + 1 else hi = mid;
+            }
+            var end = lo;
+            while (end < items.len and items[end].line == n) end += 1;
+            return items[lo..end];
+        }
+
+        /// Scans up to `max_lines` lines, stopping early at the end of a
+        /// chunk that produced matches. Returns the number of new matches.
+        pub fn step(self: *Search, source: anytype, max_lines: usize) !usize {
+            if (self.done) return 0;
+            if (self.text.len == 0) self.text = try self.allocator.alloc(u32, chunk_lines * (cols + 1));
+
+            const found = self.matches.items.len;
+            var scanned: usize = 0;
+            while (scanned < max_lines) {
+                // lines older than the history were recycled meanwhile
+                const oldest = source.lineRange()[0];
+                if (self.next <= oldest) {
+                    self.done = true;
+                    break;
+                }
+                const n: usize = @intCast(@min(self.next - oldest, chunk_lines, max_lines - scanned));
+                try self.scanChunk(source, self.next - n, n);
+                self.next -= n;
+                scanned += n;
+                self.done = self.next == oldest;
+                if (self.done or self.matches.items.len > found) break;
+            }
+            return self.matches.items.len - found;
+        }
+
+        /// Copies lines [first, first + n) newest first and collects matches.
+        fn scanChunk(self: *Search, source: anytype, first: u64, n: usize) !void {
+            var len: usize = 0;
+            for (0..n) |k| {
+                self.starts[k] = @intCast(len);
+                const row = source.lineAt(first + n - 1 - k) orelse &.{};
+                for (row[0..@min(row.len, cols)]) |cell| {
+                    self.text[len] = codepoint(cell);
+                    len += 1;
+                }
+                self.text[len] = separator;
+                len += 1;
+            }
+
+            const needle = self.pattern();
+            const gap = needle.len - 1;
+            const text = self.text[0..len];
+            var line: usize = 0;
+            var pos: usize = 0;
+            while (util.indexOfPairU32(text[pos..], needle[0], needle[gap], gap)) |i| {
+                const at = pos + i;
+                pos = at + 1;
+                if (!std.mem.eql(u32, text[at .. at + needle.len], needle)) continue;
+                while (line + 1 < n and self.starts[line + 1] <= at) line += 1;
+                try self.matches.append(self.allocator, .{
+                    .line = first + n - 1 - line,
+                    .col = @intCast(at - self.starts[line]),
+                    .len = self.needle_len,
+                });
+            }
+        }
+
+        inline fn codepoint(cell: Cell) u32 {
+            return switch (@typeInfo(Cell)) {
+                .int => @intCast(cell),
+                else => cell.u,
+            };
+        }
+    };
+}
+
+const testing = std.testing;
+
+const TestLines = struct {
+    lines: []const []const u32,
+    oldest: u64 = 0,
+
+    pub fn lineRange(self: *const TestLines) [2]u64 {
+        return .{ self.oldest, self.lines.len };
+    }
+
+    pub fn lineAt(self: *const TestLines, n: u64) ?[]const u32 {
+        if (n < self.oldest or n >= self.lines.len) return null;
+        return self.lines[@intCast(n)];
+    }
+};
+
+fn utf32(comptime s: []const u8) [s.len]u32 {
+    var out: [s.len]u32 = undefined;
+    for (s, 0..) |ch, i| out[i] = ch;
+    return out;
+}
+
+test "Search: newest first" {
+    const Search = SearchType(u32, 16);
+    const l0 = utf32("make all");
+    const l1 = utf32("error: one");
+    const l2 = utf32("ok");
+    const l3 = utf32("error: two error");
+    var source = TestLines{ .lines = &.{ &l0, &l1, &l2, &l3 } };
+
+    var search = Search.init(testing.allocator);
+    defer search.deinit();
+    const needle = utf32("error");
+    search.start(&source, &needle);
+    try testing.expectEqual(3, try search.step(&source, 100));
+    try testing.expect(search.done);
+
+    try testing.expectEqual(Match{ .line = 3, .col = 0, .len = 5 }, search.matches.items[0]);
+    try testing.expectEqual(Match{ .line = 3, .col = 11, .len = 5 }, search.matches.items[1]);
+    try testing.expectEqual(Match{ .line = 1, .col = 0, .len = 5 }, search.matches.items[2]);
+    try testing.expectEqual(2, search.onLine(3).len);
+    try testing.expectEqual(11, search.onLine(3)[1].col);
+    try testing.expectEqual(1, search.onLine(1).len);
+    try testing.expectEqual(0, search.onLine(2).len);
+    try testing.expectEqual(0, search.onLine(0).len);
+
+    // no match across lines
+    const across = utf32("allerror");
+    search.start(&source, &across);
+    try testing.expectEqual(0, try search.step(&source, 100));
+}
+
+test "Search: bounded steps" {
+    const Search = SearchType(u32, 8);
+    const hit = utf32("needle");
+    const miss = utf32("hay");
+    var lines: [Search.chunk_lines * 3][]const u32 = undefined;
+    for (&lines) |*line| line.* = &miss;
+    lines[10] = &hit;
+    var source = TestLines{ .lines = &lines };
+
+    var search = Search.init(testing.allocator);
+    defer search.deinit();
+    const needle = utf32("needle");
+    search.start(&source, &needle);
+    try testing.expectEqual(0, try search.step(&source, Search.chunk_lines));
+    try testing.expect(!search.done);
+    try testing.expectEqual(Search.chunk_lines * 2, search.next);
+    try testing.expectEqual(1, try search.step(&source, lines.len));
+    try testing.expectEqual(10, search.matches.items[0].line);
+
+    // lines dropped from the history end the search
+    search.start(&source, &needle);
+    source.oldest = 20;
+    _ = try search.step(&source, lines.len);
+    try testing.expect(search.done);
+    try testing.expectEqual(0, search.matches.items.len);
+}
+
+test "Search: benchmark" {
+    const scrollback = @import("scrollback.zig");
+    const cols = 80;
+    const History = scrollback.ScrollbackType(u32, cols, 256);
+    const lines = 100_000;
+    var history = try History.init(testing.allocator, .{ .lines = lines, .bytes = std.math.maxInt(usize) });
+    defer history.deinit();
+
+    var row: [cols]u32 = undefined;
+    for (0..lines) |i| {
+        for (&row, 0..) |*cell, k| cell.* = 'a' + @as(u32, @intCast((i * 7 + k * 13) % 26));
+        if (i == 0) @memcpy(row[40..46], &utf32("needle"));
+        try history.push(&row);
+    }
+
+    const Source = struct {
+        history: *History,
+        pub fn lineRange(self: @This()) [2]u64 {
+            return .{ self.history.pushed - self.history.count, self.history.pushed };
+        }
+        pub fn lineAt(self: @This(), n: u64) ?[]const u32 {
+            return self.history.get(@intCast(n - (self.history.pushed - self.history.count))) catch null;
+        }
+    };
+    const source = Source{ .history = &history };
+
+    const Search = SearchType(u32, cols);
+    var search = Search.init(testing.allocator);
+    defer search.deinit();
+    const needle = utf32("needle");
+
+    // the only hit is the oldest line, so this is a full scan
+    var timer = try std.time.Timer.start();
+    search.start(source, &needle);
+    while (!search.done and search.matches.items.len == 0) _ = try search.step(source, 4096);
+    const elapsed = timer.read();
+    try testing.expectEqual(1, search.matches.items.len);
+    try testing.expectEqual(0, search.matches.items[0].line);
+    std.debug.print("search bench: {} lines in {} ns, {} ns per line\n", .{ lines, elapsed, elapsed / lines });
+}
@@ -539,6 +539,25 @@ test "indexOf_any_char" {
     try testing.expectEqual(@as(?usize, 0), indexOfAny(haystack, "four")); // Finds 'f' in "four"
 }
 
+/// First position where `first` is followed by `last` `gap` codepoints later.
+/// Candidate filter for substring search over UTF-32 text.
+pub fn indexOfPairU32(haystack: []const u32, first: u32, last: u32, gap: usize) ?usize {
+    const result = simd_index_of_pair_u32(haystack.ptr, haystack.len, first, last, gap);
+    return if (result == haystack.len) null else result;
+}
+
+test "indexOfPairU32" {
+    const testing = std.testing;
+    var text: [100]u32 = undefined;
+    for (&text, 0..) |*ch, i| ch.* = 'a' + @as(u32, @intCast(i % 20));
+    try testing.expectEqual(@as(?usize, 2), indexOfPairU32(&text, 'c', 'e', 2));
+    try testing.expectEqual(@as(?usize, 17), indexOfPairU32(&text, 'r', 't', 2));
+    try testing.expectEqual(@as(?usize, 97), indexOfPairU32(text[80..], 'r', 't', 2).? + 80);
+    try testing.expectEqual(@as(?usize, null), indexOfPairU32(&text, 'c', 'f', 2));
+    try testing.expectEqual(@as(?usize, 5), indexOfPairU32(&text, 'f', 'f', 0));
+    try testing.expectEqual(@as(?usize, null), indexOfPairU32(text[0..2], 'a', 'c', 2));
+}
+
 test "decode_utf8_to_utf32 - Cyrillic string" {
     const testing = std.testing;
     const allocator = testing.allocator;
@@ -920,6 +939,142 @@ test "toUpper" {
     try testing.expectEqualStrings("HELLO WORLD", &buf);
 }
 
+// Pixel kernels over a8r8g8b8 buffers, stride is in pixels.
+
+/// Sets the w x h rectangle whose top left pixel is dst[0] to value.
+pub inline fn fillRect(dst: [*]u32, stride: usize, w: usize, h: usize, value: u32) void {
+    simd_fill_rect_u32(dst, stride, w, h, value);
+}
+
+/// Moves `rows` rows starting at src_y to dst_y, columns [x, x + w) only.
+/// Overlapping bands are fine, for scrolling.
+pub inline fn moveRows(base: [*]u32, stride: usize, x: usize, w: usize, dst_y: usize, src_y: usize, rows: usize) void {
+    simd_move_rows_u32(base, stride, x, w, dst_y, src_y, rows);
+}
+
+/// XORs the rectangle with mask, 0x00ffffff inverts the colours.
+pub inline fn xorRect(dst: [*]u32, stride: usize, w: usize, h: usize, mask: u32) void {
+    simd_xor_rect_u32(dst, stride, w, h, mask);
+}
+
+/// Blends the premultiplied fg over the rectangle through A8 coverage.
+pub inline fn blendMask(dst: [*]u32, stride: usize, mask: [*]const u8, mask_stride: usize, w: usize, h: usize, fg: u32) void {
+    simd_blend_mask_u32(dst, stride, mask, mask_stride, w, h, fg);
+}
+
+const scalar = struct {
+    fn fillRect(dst: [*]u32, stride: usize, w: usize, h: usize, value: u32) void {
+        for (0..h) |y| @memset(dst[y * stride ..][0..w], value);
+    }
+
+    fn moveRows(base: [*]u32, stride: usize, x: usize, w: usize, dst_y: usize, src_y: usize, rows: usize) void {
+        for (0..rows) |k| {
+            const r = if (dst_y < src_y) k else rows - 1 - k;
+            @memcpy(base[(dst_y + r) * stride + x ..][0..w], base[(src_y + r) * stride + x ..][0..w]);
+        }
+    }
+
+    fn xorRect(dst: [*]u32, stride: usize, w: usize, h: usize, mask: u32) void {
+        for (0..h) |y| {
+            for (dst[y * stride ..][0..w]) |*p| p.* ^= mask;
+        }
+    }
+
+    fn blendPixel(bg: u32, fg: u32, a: u32) u32 {
+        var out: u32 = 0;
+        inline for (.{ 0, 8, 16, 24 }) |shift| {
+            const t = (fg >> shift & 0xff) * a + (bg >> shift & 0xff) * (255 - a) + 128;
+            out |= (t + (t >> 8)) >> 8 << shift;
+        }
+        return out;
+    }
+
+    fn blendMask(dst: [*]u32, stride: usize, mask: [*]const u8, mask_stride: usize, w: usize, h: usize, fg: u32) void {
+        for (0..h) |y| {
+            for (dst[y * stride ..][0..w], mask[y * mask_stride ..][0..w]) |*p, a| p.* = blendPixel(p.*, fg, a);
+        }
+    }
+};
+
+test "pixel kernels match the scalar loops" {
+    const testing = std.testing;
+    const stride = 67; // rows end off the vector width
+    const h = 9;
+    var a: [stride * h]u32 = undefined;
+    var b: [stride * h]u32 = undefined;
+    var mask: [stride * h]u8 = undefined;
+    var prng = std.Random.DefaultPrng.init(7);
+    const random = prng.random();
+    for (&a, &b, &mask) |*x, *y, *m| {
+        x.* = random.int(u32);
+        y.* = x.*;
+        m.* = random.int(u8);
+    }
+    mask[0] = 0;
+    mask[1] = 255;
+
+    fillRect(a[stride + 3 ..].ptr, stride, 61, 7, 0xff102030);
+    scalar.fillRect(b[stride + 3 ..].ptr, stride, 61, 7, 0xff102030);
+    try testing.expectEqualSlices(u32, &b, &a);
+
+    xorRect(a[5..].ptr, stride, 33, h, 0x00ffffff);
+    scalar.xorRect(b[5..].ptr, stride, 33, h, 0x00ffffff);
+    try testing.expectEqualSlices(u32, &b, &a);
+
+    for (&a, &b, 0..) |*x, *y, i| {
+        x.* = @intCast(i);
+        y.* = x.*;
+    }
+    // up and down over overlapping bands
+    moveRows(&a, stride, 2, 60, 1, 3, 6);
+    scalar.moveRows(&b, stride, 2, 60, 1, 3, 6);
+    try testing.expectEqualSlices(u32, &b, &a);
+    moveRows(&a, stride, 0, stride, 4, 2, 5);
+    scalar.moveRows(&b, stride, 0, stride, 4, 2, 5);
+    try testing.expectEqualSlices(u32, &b, &a);
+
+    blendMask(&a, stride, &mask, stride, stride, h, 0xffc0a080);
+    scalar.blendMask(&b, stride, &mask, stride, stride, h, 0xffc0a080);
+    try testing.expectEqualSlices(u32, &b, &a);
+    // no coverage keeps the pixel, full coverage takes fg
+    try testing.expectEqual(b[0], a[0]);
+    try testing.expectEqual(0xffc0a080, a[1]);
+}
+
+test "pixel kernels: benchmark" {
+    const w = 1920;
+    const h = 1080;
+    const allocator = std.testing.allocator;
+    const pixels = try allocator.alloc(u32, w * h);
+    defer allocator.free(pixels);
+    const mask = try allocator.alloc(u8, w * h);
+    defer allocator.free(mask);
+    @memset(pixels, 0xff000000);
+    for (mask, 0..) |*m, i| m.* = @truncate(i);
+    const iterations = 20;
+
+    var timer = try std.time.Timer.start();
+    for (0..iterations) |i| fillRect(pixels.ptr, w, w, h, @intCast(i));
+    std.debug.print("fillRect bench: simd {} ns", .{timer.lap() / iterations});
+    for (0..iterations) |i| scalar.fillRect(pixels.ptr, w, w, h, @intCast(i));
+    std.debug.print(", scalar {} ns\n", .{timer.lap() / iterations});
+
+    for (0..iterations) |_| moveRows(pixels.ptr, w, 0, w, 0, 16, h - 16);
+    std.debug.print("moveRows bench: simd {} ns", .{timer.lap() / iterations});
+    for (0..iterations) |_| scalar.moveRows(pixels.ptr, w, 0, w, 0, 16, h - 16);
+    std.debug.print(", scalar {} ns\n", .{timer.lap() / iterations});
+
+    for (0..iterations) |_| xorRect(pixels.ptr, w, w, h, 0x00ffffff);
+    std.debug.print("xorRect bench: simd {} ns", .{timer.lap() / iterations});
+    for (0..iterations) |_| scalar.xorRect(pixels.ptr, w, w, h, 0x00ffffff);
+    std.debug.print(", scalar {} ns\n", .{timer.lap() / iterations});
+
+    for (0..iterations) |_| blendMask(pixels.ptr, w, mask.ptr, w, w, h, 0xffc0c0c0);
+    std.debug.print("blendMask bench: simd {} ns", .{timer.lap() / iterations});
+    for (0..iterations) |_| scalar.blendMask(pixels.ptr, w, mask.ptr, w, w, h, 0xffc0c0c0);
+    std.debug.print(", scalar {} ns\n", .{timer.lap() / iterations});
+}
+
 pub fn eql(comptime T: type, a: []const T, b: []const T) bool {
     if (a.len != b.len) return false;
     comptime if (@sizeOf(T) == 0) {
@@ -1042,6 +1197,14 @@ pub extern "c" fn simd_index_of_any_char(
     chars_len: usize,
 ) usize;
 
+extern "c" fn simd_index_of_pair_u32(
+    haystack: [*]const u32,
+    haystack_len: usize,
+    first: u32,
+    last: u32,
+    gap: usize,
+) usize;
+
 extern "c" fn simd_detect_encodings(input: [*]const u8, len: usize) c_int;
 extern "c" fn simd_count_utf8(input: [*]const u8, len: usize) usize;
 extern "c" fn simd_compare(a: [*]const u8, a_len: usize, b: [*]const u8, b_len: usize) bool;
@@ -1049,6 +1212,10 @@ pub extern "c" fn simd_copy_bytes(src: [*]const u8, dst: [*]u8, len: usize) void
 pub extern "c" fn simd_move_bytes(src: [*]const u8, dst: [*]u8, len: usize) void;
 
 extern "c" fn simd_to_upper(text: [*]u8, len: usize) void;
+extern "c" fn simd_fill_rect_u32(dst: [*]u32, stride: usize, w: usize, h: usize, value: u32) void;
+extern "c" fn simd_move_rows_u32(base: [*]u32, stride: usize, x: usize, w: usize, dst_y: usize, src_y: usize, rows: usize) void;
+extern "c" fn simd_xor_rect_u32(dst: [*]u32, stride: usize, w: usize, h: usize, mask: u32) void;
+extern "c" fn simd_blend_mask_u32(dst: [*]u32, stride: usize, mask: [*]const u8, mask_stride: usize, w: usize, h: usize, fg: u32) void;
 extern "c" fn simd_index_of_space_or_newline_or_non_ascii(
     input: [*]const u8,
     len: usize,
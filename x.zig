@@ -11,6 +11,11 @@ const assert = std.debug.assert;
 const unicode = std.unicode;
 const Keysym = @import("keysym.zig");
 const escapes = @import("escapes.zig");
+const scrollback = @import("scrollback.zig");
+const search = @import("search.zig");
+const charwidth = @import("charwidth.zig");
+const grapheme = @import("grapheme.zig");
+const grid = @import("grid.zig");
 // const font = @import("xcb_font.zig");
 const font = @import("fnt.zig");
 pub const vtiden: []const u8 = "\x1B[?6c"; // VT102 identification string
@@ -20,6 +25,8 @@ pub const ascii_printable =
     \\ `abcdefghijklmnopqrstuvwxyz{|}~
 ;
 const Buf = @import("pixbuf.zig");
+const Present = @import("present.zig");
+const glyphset = @import("glyphset.zig");
 const signal = @import("signal.zig");
 
 const utf_size = 4;
@@ -77,6 +84,7 @@ const Glyph_flags = enum(u4) {
     ATTR_WIDE = 10, // Wide character
     ATTR_WDUMMY = 11, // Dummy wide character
     ATTR_BOLD_FAINT = 12, // Bold and faint combined
+    ATTR_GRAPHEME = 13, // More codepoints in the grapheme table of the screen
 };
 
 // Bitset for Glyph attributes
@@ -178,13 +186,13 @@ const CSIEscape = struct {
     pub fn parse_esc(self: *Self, xterm: *XlibTerminal, data: []const u8) !void {
         for (data) |byte| {
             if (byte == '\n') {
-                xterm.term.cursor.pos.addX(0);
-                if (xterm.term.cursor.pos.getY().? < xterm.term.window.tty_grid.getRows().? - 1) {
-                    xterm.term.cursor.pos.data.position.y += 1;
+                xterm.term.cursor.pos.x = 0;
+                if (xterm.term.cursor.pos.y < xterm.term.window.tty_grid.rows - 1) {
+                    xterm.term.cursor.pos.y += 1;
                 } else {
                     xterm.scrollUp(1);
                 }
-                xterm.term.set_dirt(@intCast(xterm.term.cursor.pos.getY().?), @intCast(xterm.term.cursor.pos.getY().?));
+                xterm.term.set_dirt(xterm.term.cursor.pos.y, xterm.term.cursor.pos.y);
                 continue;
             }
 
@@ -322,11 +330,27 @@ const S = struct {
     var root_initialized: bool = false;
 };
 
+// Size of the grid and cell positions in it. Read for every byte written, so
+// these are plain fields, u16 covers every cell and widens to an index for free.
+pub const Grid = struct {
+    cols: u16 = 0,
+    rows: u16 = 0,
+};
+
+pub const Point = struct {
+    x: u16 = 0,
+    y: u16 = 0,
+};
+
+comptime {
+    assert(c.MAX_COLS <= std.math.maxInt(u16) and c.MAX_ROWS <= std.math.maxInt(u16));
+}
+
 // Purely graphic info //
 const TermWindow = struct {
     mode: WinMode,
     ///*tty width and height in columns and rows */
-    tty_grid: rect = rect.initGrid(0, 0),
+    tty_grid: Grid = .{},
     //*window width and height */
     win_size: rect = rect.initSize(0, 0),
     // /*char height and width */
@@ -362,21 +386,225 @@ pub const Glyph = struct {
             .mode = GLyphMode.initEmpty(),
         };
     }
+
+    // codepoint, colors and flags packed in one word, used to hash and compare history lines
+    pub inline fn key(self: Glyph) u64 {
+        comptime assert(50 + @bitSizeOf(GLyphMode.MaskInt) <= 64);
+        return @as(u64, self.u) |
+            @as(u64, self.fg_index) << 32 |
+            @as(u64, self.bg_index) << 41 |
+            @as(u64, self.mode.mask) << 50;
+    }
 };
 
 const DirtySet = std.bit_set.ArrayBitSet(u16, c.MAX_ROWS);
 
+// Columns [lo, hi) of a dirty row that changed since the last redraw.
+const Span = struct {
+    lo: u16 = c.MAX_COLS,
+    hi: u16 = 0,
+
+    const full = Span{ .lo = 0, .hi = c.MAX_COLS };
+};
+
+// rows [top, bot) of the view moved delta rows since the last frame, up when positive
+pub const ScrollOp = struct {
+    top: u16,
+    bot: u16,
+    delta: i32,
+};
+
+// scrolls of different regions kept per frame, past that the screen is redrawn
+const max_scrolls = 8;
+
+// pads short history rows when drawing
+const blank_row = [_]Glyph{Glyph.initEmpty()} ** c.MAX_COLS;
+
+// occupied width: cells up to the last one that is not a default blank
+inline fn rowLen(row: []const Glyph) usize {
+    var n = row.len;
+    while (n > 0) : (n -= 1) {
+        const g = row[n - 1];
+        if ((g.u != ' ' and g.u != 0) or g.bg_index != c.defaultbg or g.mode.mask != 0) break;
+    }
+    return n;
+}
+
+// A grapheme cluster carried to the row and column its cell went to.
+const Carried = struct {
+    row: usize,
+    x: u16,
+    cluster: Graphemes.Cluster,
+};
+
+// Streams logical lines into rows of a new width, see Term.reflow.
+const Reflow = struct {
+    cols: u16,
+    rows: u16,
+    ring: *Screen, // the last rows written, row n lives in ring[n % rows]
+    lens: [c.MAX_ROWS]u16 = undefined,
+    history: *History, // receives the rows that fall out of the ring
+    base: usize = 0, // oldest row still in the ring
+    row: usize = 0, // row being filled
+    out: u16 = 0, // cells in the row being filled
+    mark: ?usize = null, // cell of the row being fed that holds the cursor
+    at: [2]usize = .{ 0, 0 }, // row and column the marked cell went to
+    clusters: ?*const Graphemes = null, // of the screen row being fed, null for history rows
+    src: usize = 0, // screen row being fed
+    carried: std.ArrayListUnmanaged(Carried) = .empty,
+    allocator: Allocator,
+    started: bool = false,
+
+    fn beginLine(self: *Reflow) void {
+        if (self.started) self.newRow();
+        self.started = true;
+    }
+
+    // NOTE: Appends the cells of one stored row to the current logical line,
+    // at least min_len of them. Returns whether the line goes on in the next row.
+    fn feed(self: *Reflow, row: []const Glyph, min_len: usize) bool {
+        const wraps = row.len > 0 and row[row.len - 1].mode.isSet(.ATTR_WRAP);
+        const n = if (wraps) row.len else @min(row.len, @max(rowLen(row), min_len));
+        for (row[0..n], 0..) |g, x| {
+            self.put(g);
+            // where the cell lands, wide characters pushed to the next row included
+            if (self.mark) |m| {
+                if (m == x) self.at = .{ self.row, self.out - 1 };
+            }
+            if (g.mode.isSet(.ATTR_GRAPHEME)) self.carry(@intCast(x), g.u);
+        }
+        return wraps;
+    }
+
+    fn carry(self: *Reflow, x: u16, base: u32) void {
+        const table = self.clusters orelse return;
+        const extra = table.get(self.src, x, base) orelse return;
+        var cluster = Graphemes.Cluster{ .base = base, .len = @intCast(extra.len) };
+        @memcpy(cluster.extra[0..extra.len], extra);
+        self.carried.append(self.allocator, .{ .row = self.row, .x = self.out - 1, .cluster = cluster }) catch |err| {
+            std.log.warn("grapheme table insert failed: {}", .{err});
+        };
+    }
+
+    inline fn put(self: *Reflow, g: Glyph) void {
+        // a wide character is never split over two rows
+        if (self.out == self.cols or (g.mode.isSet(.ATTR_WIDE) and self.out + 1 == self.cols)) {
+            self.ring[self.row % self.rows][self.cols - 1].mode.set(.ATTR_WRAP);
+            self.newRow();
+        }
+        var cell = g;
+        cell.mode.unset(.ATTR_WRAP);
+        self.ring[self.row % self.rows][self.out] = cell;
+        self.out += 1;
+    }
+
+    fn newRow(self: *Reflow) void {
+        self.lens[self.row % self.rows] = self.out;
+        self.row += 1;
+        self.out = 0;
+        // the slot still holds the row written `rows` rows ago
+        if (self.row - self.base == self.rows) self.pushOldest();
+    }
+
+    fn pushOldest(self: *Reflow) void {
+        const slot = self.base % self.rows;
+        const row = &self.ring[slot];
+        // a wrapped row keeps its last cell, the flag is there
+        const wraps = row[self.cols - 1].mode.isSet(.ATTR_WRAP);
+        const len = if (wraps) self.cols else self.lens[slot];
+        self.history.pushRow(row[0..len], .{ .width = self.lens[slot], .wraps = wraps }) catch |err| {
+            std.log.warn("scrollback push failed: {}", .{err});
+        };
+        @memset(row, Glyph.initEmpty());
+        self.base += 1;
+    }
+
+    // NOTE: Ends the line being filled and puts a history page whose rows
+    // do not change back after everything written so far.
+    fn keep(self: *Reflow, page: *History.Page) void {
+        if (self.started) self.newRow();
+        self.started = false;
+        while (self.base < self.row) self.pushOldest();
+        self.history.keepPage(page);
+        self.row += page.count;
+        self.base = self.row;
+    }
+};
+
+pub const Screen = [c.MAX_ROWS][c.MAX_COLS]Glyph;
+
+// Kept for every screen row and updated on writes, both fields are upper bounds:
+// cells from len on are default blanks and attrs has every flag set on a cell
+// before len. A row blanked from its start is exact again.
+const RowMeta = struct {
+    len: u16 = 0,
+    attrs: GLyphMode = GLyphMode.initEmpty(),
+
+    fn of(row: []const Glyph) RowMeta {
+        var meta = RowMeta{ .len = @intCast(rowLen(row)) };
+        for (row[0..meta.len]) |g| meta.attrs.setUnion(g.mode);
+        return meta;
+    }
+
+    // cells before end were written, with mode among others
+    inline fn wrote(self: *RowMeta, end: usize, mode: GLyphMode) void {
+        self.len = @max(self.len, @as(u16, @intCast(end)));
+        self.attrs.setUnion(mode);
+    }
+
+    // cells [x1, x2) became default blanks
+    inline fn cleared(self: *RowMeta, x1: usize, x2: usize) void {
+        if (x2 < self.len) return;
+        if (x1 == 0) {
+            self.* = .{};
+        } else {
+            self.len = @min(self.len, @as(u16, @intCast(x1)));
+        }
+    }
+
+    // n blanks inserted at x push the cells after them right, up to cols
+    inline fn inserted(self: *RowMeta, x: usize, n: usize, cols: usize) void {
+        if (self.len > x) self.len = @intCast(@min(self.len + n, cols));
+    }
+
+    // n cells deleted at x pull the cells after them left
+    inline fn deleted(self: *RowMeta, x: usize, n: usize) void {
+        if (self.len > x) self.len = @intCast(@max(x, self.len -| n));
+    }
+};
+
+pub const ScreenMeta = [c.MAX_ROWS]RowMeta;
+
+// 256 rows per page keeps a page at a few hundred KB with MAX_COLS=240
+pub const History = scrollback.ScrollbackType(Glyph, c.MAX_COLS, 256);
+
+pub const Search = search.SearchType(Glyph, c.MAX_COLS);
+
+pub const Graphemes = grapheme.GraphemeTableType(c.MAX_ROWS);
+
 pub const Term = struct {
     mode: TermMode, // Terminal modes
     /// Allocator
     allocator: Allocator,
     //(e.g., line auto-transfer, alternate screen, UTF-8).
     dirty: DirtySet, //Bitmask to keep track of “dirty” rows that need to be redrawn.
-    line: [c.MAX_ROWS][c.MAX_COLS]Glyph, // Array of strings with fixed size MAX_ROWS
-    alt: [c.MAX_ROWS][c.MAX_COLS]Glyph, // alt array(for example vim,htop) of strings with fixes size MAX_ROWS
+    damage: [c.MAX_ROWS]Span = [_]Span{.{}} ** c.MAX_ROWS, // changed columns of every dirty row
+    scrolls: [max_scrolls]ScrollOp = undefined, // moves of the drawn rows since the last frame, in order
+    nscrolls: u8 = 0,
+    overlay: u16 = 0, // rows at the bottom of the view the window draws over, scrolls leave them in place
+    drawn: ?Point = null, // cell the last frame drew the cursor over, until a scroll marks it
+    line: *Screen, // active screen, always the one being drawn and written to
+    alt: *Screen, // inactive screen(for example vim,htop keep the main one here)
+    meta: *ScreenMeta, // occupied length and attribute summary of every row of the active screen
+    alt_meta: *ScreenMeta, // the same for the inactive screen, swapped with it
+    graphemes: Graphemes, // rest of the clusters of ATTR_GRAPHEME cells on the active screen
+    alt_graphemes: Graphemes, // the same for the inactive screen, swapped with it
+    history: History, // lines scrolled off the top of the main screen
+    scroll: usize = 0, // history lines shown above the grid, 0 follows the output
+    search: Search, // matches over the grid and history, filled in steps from the event loop
     parser: escapes.Parser,
-    //For an 80x24 character terminal with a Glyph size of 16 bytes, one screen takes ~30 KB.
-    //Two screens - ~60 KB. can we use union for 60kb? mb not
+    //Both screens live on the heap, swapscreen only exchanges the two pointers,
+    //so switching costs O(1) and Term can be moved by value without dangling.
     // cols,rows
     window: TermWindow,
     cursor: TCursor, //cursor
@@ -387,6 +615,11 @@ pub const Term = struct {
     top: u16 = 0, // Upper scroll limit
     bot: u16 = 0, // Lower scroll limit
     lastc: u32 = 0, //stores the last typed character in the terminal. It is required to process certain escape sequences, such as CSI REP
+    gprev: u32 = 0, // last character written, combining ones included
+    gstate: c.utf8proc_int32_t = 0, // utf8proc break state between gprev and the next character
+    gcell: ?[2]u16 = null, // cell written last, characters continuing its cluster join it
+    gnext: Point = .{}, // cursor position right after gcell was written
+    wrapnext: ?Point = null, // a print filled the last column here, the next one wraps first while the cursor stays
     // esc: u16 = 0, // Status of ESC sequences
     charset: u16 = 0, // Current encoding
     icharset: u16 = 0, // Encoding index
@@ -394,13 +627,37 @@ pub const Term = struct {
     cursor_visible: bool, // Cursor visibility
 
     pub fn init(allocator: Allocator, window: TermWindow) !Term {
+        const line = try allocator.create(Screen);
+        errdefer allocator.destroy(line);
+        const alt = try allocator.create(Screen);
+        errdefer allocator.destroy(alt);
+        const meta = try allocator.create(ScreenMeta);
+        errdefer allocator.destroy(meta);
+        const alt_meta = try allocator.create(ScreenMeta);
+        errdefer allocator.destroy(alt_meta);
+        @memset(meta, .{});
+        @memset(alt_meta, .{});
+        var history = try History.init(allocator, .{
+            .lines = c.histlines,
+            .bytes = c.histbytes,
+            .hot_lines = c.histhotlines,
+            .spill_bytes = c.histspillbytes,
+        });
+        errdefer history.deinit();
+
         var term: Term = .{
             .window = window,
             .mode = TermMode.initEmpty(),
             .allocator = allocator,
             .dirty = DirtySet.initEmpty(),
-            .line = undefined,
-            .alt = undefined,
+            .line = line,
+            .alt = alt,
+            .meta = meta,
+            .alt_meta = alt_meta,
+            .graphemes = Graphemes.init(allocator),
+            .alt_graphemes = Graphemes.init(allocator),
+            .history = history,
+            .search = Search.init(allocator),
             .cursor = TCursor{
                 .attr = Glyph{ .u = ' ', .fg_index = c.defaultfg, .bg_index = c.defaultbg, .mode = GLyphMode.initEmpty() },
                 .state = CursorMode.initEmpty(),
@@ -410,26 +667,44 @@ pub const Term = struct {
             .ocx = 0,
             .ocy = 0,
             .top = 0,
-            .bot = window.tty_grid.getRows().? - 1,
+            .bot = window.tty_grid.rows - 1,
             .charset = 0,
             .icharset = 0,
             .trantbl = [_]u8{0} ** 4,
             .cursor_visible = true,
         };
 
-        for (&term.line) |*row| {
+        for (term.line) |*row| {
             row.* = [_]Glyph{Glyph{ .u = ' ', .fg_index = c.defaultfg, .bg_index = c.defaultbg, .mode = GLyphMode.initEmpty() }} ** c.MAX_COLS;
         }
-        for (&term.alt) |*row| {
+        for (term.alt) |*row| {
             row.* = [_]Glyph{Glyph{ .u = ' ', .fg_index = c.defaultfg, .bg_index = c.defaultbg, .mode = GLyphMode.initEmpty() }} ** c.MAX_COLS;
         }
         term.tabs = [_]u8{0} ** c.MAX_COLS;
         term.mode.set(.MODE_WRAP);
+        if (c.batchops) try term.parser.batch(true);
         return term;
     }
 
+    pub fn deinit(self: *Term) void {
+        self.allocator.destroy(self.line);
+        self.allocator.destroy(self.alt);
+        self.allocator.destroy(self.meta);
+        self.allocator.destroy(self.alt_meta);
+        self.graphemes.deinit();
+        self.alt_graphemes.deinit();
+        self.history.deinit();
+        self.search.deinit();
+        self.parser.deinit();
+    }
+
     pub fn reset(self: *Term) void {
         self.parser.reset();
+        if (self.mode.isSet(.MODE_ALTSCREEN)) {
+            std.mem.swap(*Screen, &self.line, &self.alt);
+            std.mem.swap(*ScreenMeta, &self.meta, &self.alt_meta);
+            std.mem.swap(Graphemes, &self.graphemes, &self.alt_graphemes);
+        }
         self.mode = TermMode.initEmpty();
         self.mode.set(.MODE_WRAP);
         self.cursor = TCursor{
@@ -439,38 +714,47 @@ pub const Term = struct {
         self.ocx = 0;
         self.ocy = 0;
         self.top = 0;
-        self.bot = self.window.tty_grid.getRows().? - 1;
+        self.bot = self.window.tty_grid.rows - 1;
         self.lastc = 0;
+        self.wrapnext = null;
         self.charset = 0;
         self.icharset = 0;
         self.trantbl = [_]u8{0} ** 4;
         self.cursor_visible = true;
-        @memset(&self.line, [_]Glyph{Glyph.initEmpty()} ** c.MAX_COLS);
-        @memset(&self.alt, [_]Glyph{Glyph.initEmpty()} ** c.MAX_COLS);
+        self.scroll = 0;
+        @memset(self.line, [_]Glyph{Glyph.initEmpty()} ** c.MAX_COLS);
+        @memset(self.alt, [_]Glyph{Glyph.initEmpty()} ** c.MAX_COLS);
+        @memset(self.meta, .{});
+        @memset(self.alt_meta, .{});
+        self.graphemes.clear();
+        self.alt_graphemes.clear();
+        self.gcell = null;
         self.fulldirt();
     }
 
     // NOTE: Inserts n empty characters at the current cursor position, shifting existing characters to the right.
     pub inline fn csi_ich(self: *Term, params: []u32) !void { // Insert Characters
         const n = DEFAULT(u32, params[0], 1);
-        const screen = if (self.mode.isSet(.MODE_ALTSCREEN)) &self.alt else &self.line;
-        const cursor_x = self.cursor.pos.getX().?; // i16
-        const cols: i16 = @intCast(self.window.tty_grid.getCols().?); // u16
-        const row = self.cursor.pos.getY().?; // i16
+        const screen = self.line;
+        const cursor_x = self.cursor.pos.x;
+        const cols = self.window.tty_grid.cols;
+        const row = self.cursor.pos.y;
 
         // has some space?
         if (cursor_x >= cols) return;
 
         // count symbols to move
-        const chars_to_shift = try std.math.sub(i16, @intCast(cols), @intCast(cursor_x));
-        const insert_count: i16 = @min(@as(i16, @intCast(n)), chars_to_shift);
+        const chars_to_shift = cols - cursor_x;
+        const insert_count = @min(std.math.lossyCast(u16, n), chars_to_shift);
 
         // move to right
         if (chars_to_shift > insert_count) {
-            util.move(
+            grid.shift(
                 Glyph,
-                screen[@intCast(row)][@intCast(cursor_x + insert_count)..@intCast(cols)],
-                screen[@intCast(row)][@intCast(cursor_x)..@intCast(cols - insert_count)],
+                screen[row][0..cols],
+                cursor_x + insert_count,
+                cursor_x,
+                chars_to_shift - insert_count,
             );
         }
 
@@ -480,17 +764,19 @@ pub const Term = struct {
         //        ^
         //
         // add 2 zero chars (n=2):
-        // - util.move moves [C][D][E][F][G][H] in [4..10]
-        // - @memset set [2..4] zero Glyph
+        // - grid.shift moves [C][D][E][F][G][H] in [4..10]
+        // - grid.fill sets [2..4] to blank Glyphs
         //
         // result:
         // [A][B][ ][ ][C][D][E][F][G][H]
         //        ^
 
         // ostatok with zero glyphs
-        @memset(screen[@intCast(row)][@intCast(cursor_x)..@intCast(cursor_x + insert_count)], Glyph.initEmpty());
+        grid.fill(Glyph, screen[row][cursor_x .. cursor_x + insert_count], Glyph.initEmpty());
+        self.meta[row].inserted(cursor_x, insert_count, cols);
+        self.shiftclusters(row, cursor_x, insert_count);
 
-        self.set_dirt(@intCast(row), @intCast(row));
+        self.set_dirt_span(row, cursor_x, cols);
     }
 
     // NOTE: Deletes n characters starting from the current cursor position, shifting the remaining characters to the left.
@@ -501,36 +787,30 @@ pub const Term = struct {
 
     // NOTE: Moves the cursor up n lines.
     pub inline fn csi_cuu(self: *Term, params: []u32) !void {
+        const old = self.cursor.pos;
         const n = DEFAULT(u32, params[0], 1);
-        const old_y = self.cursor.pos.getY().?;
-        const new_y = if (old_y > n)
-            try std.math.sub(i16, old_y, @intCast(n))
-        else
-            0;
-        self.cursor.pos.addY(new_y);
-        self.set_dirt(@intCast(old_y), @intCast(new_y));
+        self.cursor.pos.y -|= std.math.lossyCast(u16, n);
+        self.wrapnext = null;
+        self.cursordirt(old);
     }
     // NOTE: Moves the cursor to the left by n positions.
     pub inline fn csi_cub(self: *Term, params: []u32) !void {
+        const old = self.cursor.pos;
         const n = DEFAULT(u32, params[0], 1);
-        const old_x = self.cursor.pos.getX().?;
-        const new_x = if (old_x > n)
-            try std.math.sub(i16, old_x, @intCast(n))
-        else
-            0;
-        self.cursor.pos.addX(new_x);
-        self.set_dirt(@intCast(self.cursor.pos.getY().?), @intCast(self.cursor.pos.getY().?));
+        self.cursor.pos.x -|= std.math.lossyCast(u16, n);
+        self.wrapnext = null;
+        self.cursordirt(old);
     }
 
     pub inline fn moveCursor(self: *Term, dx: i16, dy: i16) void {
-        var pos_vec: @Vector(2, i16) = .{ self.cursor.pos.getX().?, self.cursor.pos.getY().? };
-        const delta_vec: @Vector(2, i16) = .{ dx, dy };
+        var pos_vec: @Vector(2, i32) = .{ self.cursor.pos.x, self.cursor.pos.y };
+        const delta_vec: @Vector(2, i32) = .{ dx, dy };
         pos_vec += delta_vec;
-        self.cursor.pos.addPosition(pos_vec[0], pos_vec[1]);
+        self.cursor.pos = .{ .x = @intCast(pos_vec[0]), .y = @intCast(pos_vec[1]) };
     }
 
     inline fn computeScreenPosition(self: *Term, char_width: u16, char_height: u16) !struct { px: u16, py: u16 } {
-        const pos_vec: @Vector(2, u16) = .{ @intCast(self.cursor.pos.getX().?), @intCast(self.cursor.pos.getY().?) };
+        const pos_vec: @Vector(2, u16) = .{ self.cursor.pos.x, self.cursor.pos.y };
         const size_vec: @Vector(2, u16) = .{ char_width, char_height };
         const screen_vec = pos_vec * size_vec;
         return .{ .px = screen_vec[0], .py = screen_vec[1] };
@@ -538,20 +818,17 @@ pub const Term = struct {
 
     // NOTE: Moves the cursor down n lines.
     pub inline fn csi_cud(self: *Term, params: []u32) void {
+        const old = self.cursor.pos;
         const n = DEFAULT(u32, params[0], 1);
-        const old_y = self.cursor.pos.getY().?;
-        const new_y = @min(
-            old_y + @as(i16, @intCast(n)),
-            @as(i16, @intCast(self.window.tty_grid.getRows().? - 1)),
-        );
-        self.cursor.pos.addY(new_y);
-        self.set_dirt(@intCast(old_y), @intCast(new_y));
+        self.cursor.pos.y = @min(self.cursor.pos.y +| std.math.lossyCast(u16, n), self.window.tty_grid.rows - 1);
+        self.wrapnext = null;
+        self.cursordirt(old);
     }
     // NOTE: Processes Media Control commands. (Media Control)
     pub inline fn csi_mc(self: *Term, params: []u32, xterm: *XlibTerminal) void {
         switch (params[0]) {
             0 => xterm.tdump(),
-            1 => xterm.tdumpline(self.cursor.pos.getY().?),
+            1 => xterm.tdumpline(self.cursor.pos.y),
             2 => xterm.tdumpsel(),
             4 => self.mode.unset(.MODE_PRINT),
             5 => self.mode.set(.MODE_PRINT),
@@ -566,55 +843,59 @@ pub const Term = struct {
     }
     // NOTE:moves the cursor right n lines
     pub inline fn csi_cuf(self: *Term, params: []u32) void { // Cursor Forward
+        const old = self.cursor.pos;
         const n = DEFAULT(u32, params[0], 1);
-        const new_x = @min(self.cursor.pos.getX().? + @as(i16, @intCast(n)), @as(i16, @intCast(self.window.tty_grid.getCols().? - 1)));
-        self.cursor.pos.addX(new_x);
-        self.set_dirt(@intCast(self.cursor.pos.getY().?), @intCast(self.cursor.pos.getY().?));
+        self.cursor.pos.x = @min(self.cursor.pos.x +| std.math.lossyCast(u16, n), self.window.tty_grid.cols - 1);
+        self.wrapnext = null;
+        self.cursordirt(old);
     }
 
     // NOTE: Moves the cursor to the beginning of the next line (or n lines below).
     pub inline fn csi_cnl(self: *Term, params: []u32) void {
+        const old = self.cursor.pos;
         const n = DEFAULT(u32, params[0], 1);
-        const old_y = self.cursor.pos.getY().?;
-        self.cursor.pos.addX(0);
-        const new_y = @min(old_y + @as(i16, @intCast(n)), @as(i16, @intCast(self.window.tty_grid.getRows().? - 1)));
-        self.cursor.pos.addY(new_y);
-        self.set_dirt(@intCast(old_y), @intCast(new_y));
+        self.cursor.pos.x = 0;
+        self.cursor.pos.y = @min(self.cursor.pos.y +| std.math.lossyCast(u16, n), self.window.tty_grid.rows - 1);
+        self.wrapnext = null;
+        self.cursordirt(old);
     }
     // NOTE: Moves the cursor to the beginning of the previous line (or n lines above).
     pub inline fn csi_cpl(self: *Term, params: []u32) void {
+        const old = self.cursor.pos;
         const n = DEFAULT(u32, params[0], 1);
-        const old_y = self.cursor.pos.getY().?;
-        self.cursor.pos.addX(0);
-        const new_y = if (old_y > n) old_y - @as(i16, @intCast(n)) else 0;
-        self.cursor.pos.addY(new_y);
-        self.set_dirt(@intCast(new_y), @intCast(old_y));
+        self.cursor.pos.x = 0;
+        self.cursor.pos.y -|= std.math.lossyCast(u16, n);
+        self.wrapnext = null;
+        self.cursordirt(old);
     }
     // NOTE: Controls the tabulation setting (Tabulation Clear).
     pub inline fn csi_tbc(self: *Term, params: []u32) void {
         switch (params[0]) {
-            0 => self.tabs[@intCast(self.cursor.pos.getX().?)] = 0,
+            0 => self.tabs[self.cursor.pos.x] = 0,
             3 => @memset(&self.tabs, 0),
             else => std.log.warn("Unknown TBC parameter: {}", .{params[0]}),
         }
     }
     // NOTE: Moves the cursor to the absolute position on the current line.
     pub inline fn csi_cha(self: *Term, params: []u32) void {
+        const old = self.cursor.pos;
         const n = DEFAULT(u32, params[0], 1);
-        const new_x = @min(@as(i16, @intCast(n - 1)), @as(i16, @intCast(self.window.tty_grid.getCols().? - 1)));
-        self.cursor.pos.addX(new_x);
-        self.set_dirt(@intCast(self.cursor.pos.getY().?), @intCast(self.cursor.pos.getY().?));
+        self.cursor.pos.x = @min(std.math.lossyCast(u16, n - 1), self.window.tty_grid.cols - 1);
+        self.wrapnext = null;
+        self.cursordirt(old);
     }
 
     // NOTE: Moves the cursor to the specified position (row, column).
     pub inline fn csi_cup(self: *Term, params: []u32) void { // Cursor Position
+        const old = self.cursor.pos;
         const row = DEFAULT(u32, params[0], 1);
-        const col = DEFAULT(u32, params[1], 1);
-        const new_y = @min(@as(i16, @intCast(row - 1)), @as(i16, @intCast(self.window.tty_grid.getRows().? - 1)));
-        const new_x = @min(@as(i16, @intCast(col - 1)), @as(i16, @intCast(self.window.tty_grid.getCols().? - 1)));
-        const old_y = self.cursor.pos.getY().?;
-        self.cursor.pos.addPosition(new_x, new_y);
-        self.set_dirt(@intCast(old_y), @intCast(new_y));
+        const col = DEFAULT(u32, if (params.len > 1) params[1] else 0, 1);
+        self.cursor.pos = .{
+            .x = @min(std.math.lossyCast(u16, col - 1), self.window.tty_grid.cols - 1),
+            .y = @min(std.math.lossyCast(u16, row - 1), self.window.tty_grid.rows - 1),
+        };
+        self.wrapnext = null;
+        self.cursordirt(old);
     }
     // NOTE: Moves the cursor n tabs to the right.
     pub inline fn csi_cht(self: *Term, params: []u32) void { // Character Tabulation
@@ -625,23 +906,23 @@ pub const Term = struct {
     // NOTE: Clears the screen or part of it depending on the parameter n.
     pub inline fn csi_ed(self: *Term, params: []u32) void { // Erase Display
         const n = params[0];
-        const cols = self.window.tty_grid.getCols().? - 1;
-        const rows = self.window.tty_grid.getRows().? - 1;
+        const cols = self.window.tty_grid.cols - 1;
+        const rows = self.window.tty_grid.rows - 1;
         switch (n) {
             0 => {
-                self.tclearregion(self.cursor.pos.getX().?, self.cursor.pos.getY().?, @intCast(cols), self.cursor.pos.getY().?);
-                if (self.cursor.pos.getY().? < rows) {
-                    self.tclearregion(0, self.cursor.pos.getY().? + 1, @intCast(cols), @intCast(rows)); //TODO: MAKE COMPTIME TYPE WITHOUT INTCAST EVERYTIME
+                self.tclearregion(self.cursor.pos.x, self.cursor.pos.y, cols, self.cursor.pos.y);
+                if (self.cursor.pos.y < rows) {
+                    self.tclearregion(0, self.cursor.pos.y + 1, cols, rows);
                 }
             },
             1 => {
-                if (self.cursor.pos.getY().? > 0) {
-                    self.tclearregion(0, 0, @intCast(cols), self.cursor.pos.getY().? - 1);
+                if (self.cursor.pos.y > 0) {
+                    self.tclearregion(0, 0, cols, self.cursor.pos.y - 1);
                 }
-                self.tclearregion(0, self.cursor.pos.getY().?, self.cursor.pos.getX().?, self.cursor.pos.getY().?);
+                self.tclearregion(0, self.cursor.pos.y, self.cursor.pos.x, self.cursor.pos.y);
             },
             2 => {
-                self.tclearregion(0, 0, @intCast(cols), @intCast(rows));
+                self.tclearregion(0, 0, cols, rows);
             },
             else => std.log.warn("Unknown ED parameter: {}", .{n}),
         }
@@ -650,12 +931,12 @@ pub const Term = struct {
     // NOTE: Clears the string or part of it depending on the parameter n.
     pub inline fn csi_el(self: *Term, params: []u32) void {
         const n = DEFAULT(u32, params[0], 0);
-        const y = self.cursor.pos.getY().?;
-        const cols = self.window.tty_grid.getCols().? - 1;
+        const y = self.cursor.pos.y;
+        const cols = self.window.tty_grid.cols - 1;
         switch (n) {
-            0 => self.tclearregion(self.cursor.pos.getX().?, y, @intCast(cols), y),
-            1 => self.tclearregion(0, y, self.cursor.pos.getX().?, y),
-            2 => self.tclearregion(0, y, @intCast(cols), y),
+            0 => self.tclearregion(self.cursor.pos.x, y, cols, y),
+            1 => self.tclearregion(0, y, self.cursor.pos.x, y),
+            2 => self.tclearregion(0, y, cols, y),
             else => std.log.warn("Unknown EL parameter: {}", .{n}),
         }
     }
@@ -689,15 +970,12 @@ pub const Term = struct {
     // NOTE: Clears n characters starting from the current cursor position.
     pub inline fn csi_ech(self: *Term, params: []u32) void { // Erase Characteres
         const n = DEFAULT(u32, params[0], 1);
-        const end_x = @min(
-            self.cursor.pos.getX().? + @as(i16, @intCast(n)) - 1,
-            @as(i16, @intCast(self.window.tty_grid.getCols().? - 1)),
-        );
+        const end_x = @min(self.cursor.pos.x +| std.math.lossyCast(u16, n - 1), self.window.tty_grid.cols - 1);
         self.tclearregion(
-            self.cursor.pos.getX().?,
-            self.cursor.pos.getY().?,
+            self.cursor.pos.x,
+            self.cursor.pos.y,
             end_x,
-            self.cursor.pos.getY().?,
+            self.cursor.pos.y,
         );
     }
     // NOTE: Moves the cursor n tabs to the left.
@@ -707,11 +985,11 @@ pub const Term = struct {
     }
     // NOTE: Moves the cursor to the specified line (absolute position).
     pub inline fn csi_vpa(self: *Term, params: []u32) void {
-        const n = DEFAULT(i16, @intCast(params[0]), 1);
-        const new_y = @min(@as(i16, @intCast(n - 1)), @as(i16, @intCast(self.window.tty_grid.getRows().? - 1)));
-        const old_y = self.cursor.pos.getY().?;
-        self.cursor.pos.addY(new_y);
-        self.set_dirt(@intCast(old_y), @intCast(new_y));
+        const old = self.cursor.pos;
+        const n = DEFAULT(u32, params[0], 1);
+        self.cursor.pos.y = @min(std.math.lossyCast(u16, n - 1), self.window.tty_grid.rows - 1);
+        self.wrapnext = null;
+        self.cursordirt(old);
     }
 
     // NOTE: Set terminal nodes
@@ -722,7 +1000,6 @@ pub const Term = struct {
     // NOTE: Sets character attributes (color, style, etc.).
     pub fn csi_sgr(self: *Term, params: []u32, narg: usize) void { // Select Graphic Rendition
         self.handle_sgr(params[0..narg]);
-        self.set_dirt(@intCast(self.cursor.pos.getY().?), @intCast(self.cursor.pos.getX().?));
     }
     // NOTE: Responds to cursor or device status requests (Device Status Report).
     pub inline fn csi_dsr(self: *Term, params: []u32, xterm: *XlibTerminal) void {
@@ -730,7 +1007,7 @@ pub const Term = struct {
         switch (params[0]) {
             5 => xterm.ttywrite("\x1B[0n", 4, 0),
             6 => {
-                const res = std.fmt.bufPrint(&buf, "\x1B[{d};{d}R", .{ self.cursor.pos.getY().? + 1, self.cursor.pos.getX().? + 1 }) catch return;
+                const res = std.fmt.bufPrint(&buf, "\x1B[{d};{d}R", .{ self.cursor.pos.y + 1, self.cursor.pos.x + 1 }) catch return;
                 xterm.ttywrite(res, res.len, 0);
             },
             else => std.log.warn("Unknown DSR parameter: {}", .{params[0]}),
@@ -740,7 +1017,7 @@ pub const Term = struct {
     // NOTE: Sets the upper and lower scroll limits.
     pub fn csi_decstbm(self: *Term, params: []u32) void {
         const top = DEFAULT(u32, params[0], 1);
-        const bot = DEFAULT(u32, params[1], self.window.tty_grid.getRows().?);
+        const bot = DEFAULT(u32, params[1], self.window.tty_grid.rows);
         self.tsetscroll(@as(u16, @intCast(top - 1)), @as(u16, @intCast(bot - 1)));
         self.tmoveto(0, 0);
     }
@@ -759,124 +1036,158 @@ pub const Term = struct {
 
     // NOTE: Inserts n empty characters on the current line, shifting the existing ones to the right.
     inline fn tinsertblank(self: *Term, n: u32) void {
-        const screen = if (self.mode.isSet(.MODE_ALTSCREEN)) &self.alt else &self.line;
-        const cols = self.window.tty_grid.getCols().?;
-        const dest = self.cursor.pos.getX().? + @as(i16, @intCast(n));
+        const screen = self.line;
+        const cols = self.window.tty_grid.cols;
+        const x = self.cursor.pos.x;
+        const y = self.cursor.pos.y;
+        const dest = @as(u32, x) + n;
         if (dest >= cols) return;
-        util.move(
-            Glyph,
-            screen[self.cursor.pos.getY().?][dest..cols],
-            screen[self.cursor.pos.getY().?][self.cursor.pos.getX().? .. cols - @as(u16, @intCast(n))],
-        );
-        @memset(
-            screen[self.cursor.pos.getY().?][self.cursor.pos.getX().?..dest],
-            Glyph.initEmpty(),
-        );
-        self.set_dirt(self.cursor.pos.getY().?, self.cursor.pos.getY().?);
+        const row = screen[y][0..cols];
+        grid.shift(Glyph, row, dest, x, cols - dest);
+        grid.fill(Glyph, row[x..dest], Glyph.initEmpty());
+        self.meta[y].inserted(x, n, cols);
+        self.shiftclusters(y, x, @intCast(n));
+        self.set_dirt_span(y, x, cols);
     }
 
     // NOTE: Moves the cursor to the specified coordinates (x, y).
-    inline fn tmoveto(self: *Term, x: i16, y: i16) void {
-        const cols: i16 = @intCast(self.window.tty_grid.getCols().?);
-        const rows: i16 = @intCast(self.window.tty_grid.getRows().?);
-        const new_x = std.math.clamp(x, 0, cols - 1);
-        const new_y = std.math.clamp(y, 0, rows - 1);
-        const old_y = self.cursor.pos.getY().?;
-        self.cursor.pos.addPosition(new_x, new_y);
-        self.set_dirt(@intCast(old_y), @intCast(new_y));
+    pub inline fn tmoveto(self: *Term, x: i16, y: i16) void {
+        const old = self.cursor.pos;
+        const cols: i16 = @intCast(self.window.tty_grid.cols);
+        const rows: i16 = @intCast(self.window.tty_grid.rows);
+        self.cursor.pos = .{
+            .x = @intCast(std.math.clamp(x, 0, cols - 1)),
+            .y = @intCast(std.math.clamp(y, 0, rows - 1)),
+        };
+        self.wrapnext = null;
+        self.cursordirt(old);
     }
     // NOTE: Clears the screen area from (x1, y1) to (x2, y2).
-    inline fn tclearregion(self: *Term, x1: i16, y1: i16, x2: i16, y2: i16) void {
-        const screen = if (self.mode.isSet(.MODE_ALTSCREEN)) &self.alt else &self.line;
-        const cols: i16 = @intCast(self.window.tty_grid.getCols().?);
-        const rows: i16 = @intCast(self.window.tty_grid.getRows().?);
-        const max_x = std.math.clamp(x2, 0, cols - 1);
-        const max_y = std.math.clamp(y2, 0, rows - 1);
-        for (@max(y1, 0)..@intCast(max_y + 1)) |y| {
-            @memset(screen[y][@max(x1, 0)..@intCast(max_x + 1)], Glyph.initEmpty());
-            self.set_dirt(@intCast(y), @intCast(y));
+    inline fn tclearregion(self: *Term, x1: u16, y1: u16, x2: u16, y2: u16) void {
+        const screen = self.line;
+        const cols = self.window.tty_grid.cols;
+        const rows = self.window.tty_grid.rows;
+        const max_x = @min(x2, cols - 1);
+        const max_y = @min(y2, rows - 1);
+        if (x1 > max_x or y1 > max_y) return;
+        const whole = x1 == 0 and max_x == cols - 1;
+        for (y1..@as(usize, max_y) + 1) |y| {
+            grid.fill(Glyph, screen[y][x1 .. @as(usize, max_x) + 1], Glyph.initEmpty());
+            self.meta[y].cleared(x1, @as(usize, max_x) + 1);
+            if (whole) self.graphemes.clearRow(y);
+            self.set_dirt_span(@intCast(y), x1, @as(usize, max_x) + 1);
         }
     }
 
     // NOTE: Moves the cursor to the next or previous tab position.
     pub inline fn tputtab(self: *Term, n: i16) void {
-        const cols = self.window.tty_grid.getCols().?;
-        var x = self.cursor.pos.getX().?;
+        const old = self.cursor.pos;
+        const cols = self.window.tty_grid.cols;
+        var x = self.cursor.pos.x;
         if (n > 0) {
             var count: u16 = @intCast(n);
             while (x < cols and count > 0) : (count -= 1) {
                 x += 1;
-                while (x < cols and self.tabs[@intCast(x)] == 0) x += 1;
+                while (x < cols and self.tabs[x] == 0) x += 1;
             }
         } else if (n < 0) {
             var count: i16 = n;
             while (x > 0 and count < 0) : (count += 1) {
                 x -= 1;
-                while (x > 0 and self.tabs[@intCast(x)] == 0) x -= 1;
+                while (x > 0 and self.tabs[x] == 0) x -= 1;
             }
         }
-        self.cursor.pos.addX(@min(x, @as(i16, @intCast(cols - 1))));
-        self.set_dirt(@intCast(self.cursor.pos.getY().?), @intCast(self.cursor.pos.getY().?));
+        self.cursor.pos.x = @min(x, cols - 1);
+        // a tab from the last column stays there, the next character overwrites it
+        self.wrapnext = null;
+        self.cursordirt(old);
     }
 
     // NOTE: Scrolls up the screen by n lines in the area from top to bottom.
     pub inline fn tscrollup(self: *Term, top: u16, n: u32) void {
-        const screen = if (self.mode.isSet(.MODE_ALTSCREEN)) &self.alt else &self.line;
-        const rows = self.window.tty_grid.getRows().?;
+        const screen = self.line;
+        const rows = self.window.tty_grid.rows;
+        const cols = self.window.tty_grid.cols;
         const shift = @min(n, @as(u32, rows - top));
         if (shift == 0) return;
 
-        util.move(
-            [c.MAX_COLS]Glyph,
-            screen[top .. rows - shift],
-            screen[top + shift .. rows],
-        );
+        // lines leaving the top of the main screen go to the history
+        var pushed: usize = 0;
+        if (c.scroll_bool and top == 0 and !self.mode.isSet(.MODE_ALTSCREEN)) {
+            for (screen[0..shift], self.meta[0..shift]) |*row, meta| {
+                // what a rewrap needs to keep the page whole, see Term.reflow;
+                // the clusters of the row stay behind, see viewCluster
+                const info = History.RowInfo{ .width = @min(meta.len, cols), .wraps = row[cols - 1].mode.isSet(.ATTR_WRAP) };
+                self.history.pushRow(row[0..cols], info) catch |err| {
+                    std.log.warn("scrollback push failed: {}", .{err});
+                    break;
+                };
+                pushed += 1;
+            }
+        }
 
+        // cells past cols stay blank, only the used columns move
+        grid.copyRows([c.MAX_COLS]Glyph, screen[top .. rows - shift], screen[top + shift .. rows], cols);
         for (rows - shift..rows) |y| {
-            @memset(&screen[y], Glyph.initEmpty());
-            self.set_dirt(@intCast(y), @intCast(y));
+            grid.fill(Glyph, screen[y][0..cols], Glyph.initEmpty());
+        }
+        self.rowsup(top, rows, shift);
+        if (self.gcell) |*cell| {
+            // the cluster being written moves with its row
+            if (cell[1] >= top + shift) cell[1] -= @intCast(shift) else self.gcell = null;
+        }
+
+        // scrolled back: the view follows its lines, nothing visible changed
+        if (self.scroll > 0 and pushed == shift) {
+            self.scroll += pushed;
+            if (self.scroll > self.history.count) {
+                // oldest page got recycled under the view
+                self.scroll = self.history.count;
+                self.fulldirt();
+            }
+            return;
         }
-        self.set_dirt(top, rows - 1);
+        self.scrolldirt(top, rows, @intCast(shift));
     }
 
     // NOTE: Scrolls the screen down n lines in the area from top to bottom.
     pub inline fn tscrolldown(self: *Term, top: u16, n: u32) void {
-        const screen = if (self.mode.isSet(.MODE_ALTSCREEN)) &self.alt else &self.line;
-        const rows = self.window.tty_grid.getRows().?;
+        const screen = self.line;
+        const rows = self.window.tty_grid.rows;
         const shift = @min(n, @as(u32, rows - top));
         if (shift == 0) return;
 
-        util.move(
-            [c.MAX_COLS]Glyph,
-            screen[top .. rows - shift],
-            screen[top + shift .. rows],
-        );
-
+        const cols = self.window.tty_grid.cols;
+        grid.copyRows([c.MAX_COLS]Glyph, screen[top + shift .. rows], screen[top .. rows - shift], cols);
         for (top..top + shift) |y| {
-            @memset(&screen[y], Glyph.initEmpty());
-            self.set_dirt(@intCast(y), @intCast(y));
+            grid.fill(Glyph, screen[y][0..cols], Glyph.initEmpty());
         }
-        self.set_dirt(top, rows - 1);
+        self.rowsdown(top, rows, shift);
+        self.gcell = null;
+        self.scrolldirt(top, rows, -@as(i32, @intCast(shift)));
     }
 
     // NOTE: Inserts n empty lines at the current cursor position, pushing the existing ones down.
     inline fn tinsertblankline(self: *Term, n: u32) void {
-        const screen = if (self.mode.isSet(.MODE_ALTSCREEN)) &self.alt else &self.line;
-        const rows = self.window.tty_grid.getRows().?;
-        const cursor_y = self.cursor.pos.getY().?;
-        const shift = @min(n, @as(u32, @intCast(@as(i16, @intCast(rows)) - cursor_y))); // TODO:MAKE EVERYTHERE std..math.sub or std.math.add or comptime checks type
+        const screen = self.line;
+        const rows = self.window.tty_grid.rows;
+        const cursor_y = self.cursor.pos.y;
+        const shift = @min(n, rows -| cursor_y);
         if (shift == 0) return;
 
-        util.move(
+        const cols = self.window.tty_grid.cols;
+        grid.copyRows(
             [c.MAX_COLS]Glyph,
-            screen[@as(usize, @intCast(cursor_y)) + shift .. rows],
-            screen[@intCast(cursor_y) .. rows - shift],
+            screen[cursor_y + shift .. rows],
+            screen[cursor_y .. rows - shift],
+            cols,
         );
-
-        for (@intCast(cursor_y)..@as(usize, @intCast(cursor_y)) + shift) |y| {
-            @memset(&screen[y], Glyph.initEmpty());
-            self.set_dirt(@intCast(y), @intCast(y));
+        for (cursor_y..cursor_y + shift) |y| {
+            grid.fill(Glyph, screen[y][0..cols], Glyph.initEmpty());
         }
+        self.rowsdown(@intCast(cursor_y), rows, shift);
+        self.gcell = null;
+        self.scrolldirt(cursor_y, rows, -@as(i32, @intCast(shift)));
     }
     // NOTE: Sets the terminal or window modes depending on the parameters.
     inline fn tsetmode(
@@ -891,17 +1202,28 @@ pub const Term = struct {
             if (priv != 0) {
                 switch (arg) {
                     1 => winmode.setOrUnset(.MODE_APPCURSOR, set != 0),
+                    7 => self.mode.setOrUnset(.MODE_WRAP, set != 0), // DECAWM
                     12 => winmode.setOrUnset(.MODE_BLINK, set != 0),
-                    25 => self.cursor_visible = (set != 0),
+                    25 => {
+                        self.cursor_visible = (set != 0);
+                        self.cursordirt(self.cursor.pos);
+                    },
                     1049 => {
-                        self.mode.setOrUnset(.MODE_ALTSCREEN, set != 0);
-                        self.fulldirt();
+                        if (self.mode.isSet(.MODE_ALTSCREEN) == (set != 0)) continue;
+                        if (set != 0) {
+                            self.tcursor(.CURSOR_SAVE);
+                            self.swapscreen();
+                            self.tclearregion(0, 0, self.window.tty_grid.cols - 1, self.window.tty_grid.rows - 1);
+                        } else {
+                            self.swapscreen();
+                            self.tcursor(.CURSOR_LOAD);
+                        }
                     },
                     else => std.log.debug("Unknown private mode: {}", .{arg}),
                 }
             } else {
                 switch (arg) {
-                    4 => self.mode.setOrUnset(.MODE_WRAP, set != 0),
+                    4 => self.mode.setOrUnset(.MODE_INSERT, set != 0), // IRM
                     else => std.log.debug("Unknown mode: {}", .{arg}),
                 }
             }
@@ -909,49 +1231,46 @@ pub const Term = struct {
     }
     // NOTE: Deletes n lines starting from the current cursor position, shifting the remaining ones upwards.
     inline fn tdeleteline(self: *Term, n: u32) void {
-        const screen = if (self.mode.isSet(.MODE_ALTSCREEN)) &self.alt else &self.line;
-        const rows = @as(u32, self.window.tty_grid.getRows().?);
-        const cursor_y = @as(u32, @intCast(self.cursor.pos.getY().?));
-        const shift = @min(n, rows - cursor_y);
+        const screen = self.line;
+        const rows = self.window.tty_grid.rows;
+        const cursor_y = self.cursor.pos.y;
+        const shift = @min(n, rows -| cursor_y);
         if (shift == 0) return;
 
-        util.move(
+        const cols = self.window.tty_grid.cols;
+        grid.copyRows(
             [c.MAX_COLS]Glyph,
-            screen[@intCast(cursor_y) .. rows - shift],
-            screen[@as(usize, @intCast(cursor_y)) + shift .. rows],
+            screen[cursor_y .. rows - shift],
+            screen[cursor_y + shift .. rows],
+            cols,
         );
-
         for (rows - shift..rows) |y| {
-            util.set(Glyph, &screen[y], Glyph.initEmpty());
-
-            self.set_dirt(@intCast(y), @intCast(y));
+            grid.fill(Glyph, screen[y][0..cols], Glyph.initEmpty());
         }
+        self.rowsup(cursor_y, rows, shift);
+        self.gcell = null;
+        self.scrolldirt(cursor_y, rows, @intCast(shift));
     }
     // NOTE: Deletes n characters on the current line, shifting the remaining characters to the left.
     inline fn tdeletechar(self: *Term, n: u32) void {
-        const screen = if (self.mode.isSet(.MODE_ALTSCREEN)) &self.alt else &self.line;
-        const cols = @as(u32, self.window.tty_grid.getCols().?);
-        const x = @as(u32, @intCast(self.cursor.pos.getX().?));
-        const y = @as(u32, @intCast(self.cursor.pos.getY().?));
-        const shift = @min(n, cols - x);
+        const screen = self.line;
+        const cols = self.window.tty_grid.cols;
+        const x = self.cursor.pos.x;
+        const y = self.cursor.pos.y;
+        const shift = @min(n, cols -| x);
         if (shift == 0) return;
 
-        util.move(
-            Glyph,
-            screen[y][x .. cols - n],
-            screen[y][x + n .. cols],
-        );
-
-        for (cols - n..cols) |xx| {
-            screen[y][xx] = Glyph.initEmpty();
-        }
+        grid.shift(Glyph, screen[y][0..cols], x, x + shift, cols - x - shift);
+        grid.fill(Glyph, screen[y][cols - shift .. cols], Glyph.initEmpty());
+        self.meta[y].deleted(x, n);
+        self.shiftclusters(y, x, -@as(i32, @intCast(shift)));
 
-        self.set_dirt(@intCast(y), @intCast(y));
+        self.set_dirt_span(y, x, cols);
     }
 
     // NOTE: Sets the scroll area from top to bot.
     inline fn tsetscroll(self: *Term, top: u16, bot: u16) void {
-        const rows = self.window.tty_grid.getRows().?;
+        const rows = self.window.tty_grid.rows;
         self.top = @min(top, rows - 1);
         self.bot = @min(bot, rows - 1);
         if (self.top > self.bot) {
@@ -962,64 +1281,357 @@ pub const Term = struct {
     // NOTE: Saves or loads the cursor position.
     pub fn tcursor(self: *Term, mode: enum { CURSOR_SAVE, CURSOR_LOAD }) void {
         if (mode == .CURSOR_SAVE) {
-            self.ocx = @intCast(self.cursor.pos.getX().?);
-            self.ocy = @intCast(self.cursor.pos.getY().?);
+            self.ocx = self.cursor.pos.x;
+            self.ocy = self.cursor.pos.y;
         } else {
-            const old_y = self.cursor.pos.getY().?;
-            self.cursor.pos.addPosition(@intCast(self.ocx), @intCast(self.ocy));
-            self.set_dirt(@intCast(old_y), @intCast(self.ocy));
+            const old = self.cursor.pos;
+            self.cursor.pos = .{ .x = self.ocx, .y = self.ocy };
+            self.wrapnext = null;
+            self.cursordirt(old);
         }
     }
     // NOTE: Outputs the character at the current cursor position and updates its position.
     pub inline fn tputc(self: *Term, u: u32) void {
-        const screen = if (self.mode.isSet(.MODE_ALTSCREEN)) &self.alt else &self.line;
-
-        const x = self.cursor.pos.getX().?;
-        const y = self.cursor.pos.getY().?;
-        const cols = self.window.tty_grid.getCols().?;
-        const rows = self.window.tty_grid.getRows().?;
-        if (x < cols and y < rows) {
-            screen[@intCast(y)][@intCast(x)] = Glyph{
-                .u = u,
+        switch (self.printmodes()) {
+            inline else => |m| {
+                const modes = comptime PrintModes.of(m);
+                if (self.joins(u)) self.tcombine(u) else self.tputw(modes, u, charwidth.width(u));
+            },
+        }
+    }
+
+    // NOTE: Outputs a run of decoded characters, their widths are looked up per batch.
+    pub fn tputs(self: *Term, text: []const u32) void {
+        switch (self.printmodes()) {
+            inline else => |m| self.tputsWith(comptime PrintModes.of(m), text),
+        }
+    }
+
+    fn tputsWith(self: *Term, comptime modes: PrintModes, text: []const u32) void {
+        var widths: [256]u2 = undefined;
+        var rest = text;
+        while (rest.len > 0) {
+            const n = @min(rest.len, widths.len);
+            charwidth.widths(rest[0..n], widths[0..n]);
+            for (rest[0..n], widths[0..n]) |u, w| {
+                if (self.joins(u)) self.tcombine(u) else self.tputw(modes, u, w);
+            }
+            rest = rest[n..];
+        }
+    }
+
+    // NOTE: Outputs a run of printable ASCII. Every byte is one cell and starts
+    // a cluster of its own, so neither widths nor joins are looked up.
+    pub fn tputascii(self: *Term, text: []const u8) void {
+        switch (self.printmodes()) {
+            inline else => |m| self.tputasciiWith(comptime PrintModes.of(m), text),
+        }
+    }
+
+    fn tputasciiWith(self: *Term, comptime modes: PrintModes, text: []const u8) void {
+        self.gstate = 0;
+        for (text) |cc| self.tputw(modes, cc, 1);
+    }
+
+    // Mode bits the print path depends on. Each combination gets its own
+    // writer, picked once per run, so the writers carry no mode tests.
+    const PrintModes = struct {
+        insert: bool,
+        wrap: bool,
+
+        inline fn of(comptime bits: u2) PrintModes {
+            return .{ .insert = bits & 2 != 0, .wrap = bits & 1 != 0 };
+        }
+    };
+
+    inline fn printmodes(self: *const Term) u2 {
+        return @as(u2, @intFromBool(self.mode.isSet(.MODE_INSERT))) << 1 |
+            @intFromBool(self.mode.isSet(.MODE_WRAP));
+    }
+
+    // NOTE: Whether the last print filled the last column and the cursor has
+    // not moved since, the next character then goes to the next row.
+    inline fn wrappending(self: *const Term) bool {
+        const at = self.wrapnext orelse return false;
+        return at.x == self.cursor.pos.x and at.y == self.cursor.pos.y;
+    }
+
+    // NOTE: Whether u continues the grapheme cluster of the cell written last,
+    // by the utf8proc segmentation rules. ASCII always starts a new cluster and
+    // skips utf8proc, so does anything written after the cursor moved.
+    inline fn joins(self: *Term, u: u32) bool {
+        if (u < 0x80 or self.gcell == null or
+            self.cursor.pos.x != self.gnext.x or self.cursor.pos.y != self.gnext.y)
+        {
+            self.gstate = 0;
+            return false;
+        }
+        return !c.utf8proc_grapheme_break_stateful(@intCast(self.gprev), @intCast(u), &self.gstate);
+    }
+
+    // NOTE: Adds u to the cluster of the cell written last. The cell keeps the base
+    // codepoint and gets ATTR_GRAPHEME, the rest goes to the grapheme table.
+    fn tcombine(self: *Term, u: u32) void {
+        self.gprev = u;
+        const pos = self.gcell.?;
+        const g = &self.line[pos[1]][pos[0]];
+        if (!g.mode.isSet(.ATTR_GRAPHEME)) {
+            self.graphemes.begin(pos[1], pos[0], g.u) catch |err| {
+                std.log.warn("grapheme table insert failed: {}", .{err});
+                return;
+            };
+            g.mode.set(.ATTR_GRAPHEME);
+        }
+        self.graphemes.append(pos[1], pos[0], u);
+        self.meta[pos[1]].attrs.set(.ATTR_GRAPHEME);
+        self.set_dirt_span(pos[1], pos[0], pos[0] + 2);
+    }
+
+    // NOTE: Row metadata and clusters follow rows [top, end) moving n up, the rows scrolled in are blank.
+    inline fn rowsup(self: *Term, top: usize, end: usize, n: usize) void {
+        std.mem.rotate(RowMeta, self.meta[top..end], n);
+        @memset(self.meta[end - n .. end], .{});
+        self.graphemes.scrollUp(top, end, n);
+    }
+
+    // NOTE: Row metadata and clusters follow rows [top, end) moving n down, the rows scrolled in are blank.
+    inline fn rowsdown(self: *Term, top: usize, end: usize, n: usize) void {
+        std.mem.rotate(RowMeta, self.meta[top..end], end - top - n);
+        @memset(self.meta[top .. top + n], .{});
+        self.graphemes.scrollDown(top, end, n);
+    }
+
+    // NOTE: Moves the clusters of row y from column x on by delta cells, along with the cells.
+    inline fn shiftclusters(self: *Term, y: usize, x: u16, delta: i32) void {
+        self.gcell = null;
+        self.graphemes.shift(y, x, delta, self.window.tty_grid.cols) catch |err| {
+            std.log.warn("grapheme table shift failed: {}", .{err});
+            self.graphemes.clearRow(y);
+        };
+    }
+
+    // NOTE: Writes a character w cells wide. A wide character takes the cell to its
+    // right as an ATTR_WDUMMY. Filling the last column leaves the cursor on it,
+    // with wrap mode the next character goes to the next row first, as does a
+    // wide character with one cell left. Without it the last cells are
+    // overwritten. Insert mode pushes the rest of the row right first.
+    // Zero width characters that join no cluster are dropped.
+    inline fn tputw(self: *Term, comptime modes: PrintModes, u: u32, w: u2) void {
+        self.lastc = u;
+        self.gprev = u;
+        if (w == 0) return;
+        const screen = self.line;
+
+        var x = self.cursor.pos.x;
+        var y = self.cursor.pos.y;
+        const cols = self.window.tty_grid.cols;
+        const rows = self.window.tty_grid.rows;
+        if (x >= cols or y >= rows) return;
+        if (modes.wrap) {
+            if (self.wrappending() or (w == 2 and x + 1 >= cols)) {
+                self.twrap(y);
+                x = 0;
+                y = self.cursor.pos.y;
+            }
+        } else if (w == 2 and x + 1 >= cols) {
+            x = cols - 2;
+        }
+
+        const row = &screen[y];
+        if (modes.insert and x + w < cols) {
+            // a wide character split by the insert loses its first half, one
+            // starting at x moves right whole
+            if (row[x].mode.isSet(.ATTR_WDUMMY)) {
+                clearwide(row, x, cols);
+                row[x].u = ' ';
+                row[x].mode.unset(.ATTR_WDUMMY);
+            }
+            grid.shift(Glyph, row[0..cols], x + w, x, cols - x - w);
+            self.meta[y].inserted(x, w, cols);
+            self.shiftclusters(y, x, w);
+        } else {
+            // overwriting half of a wide character blanks the other half
+            clearwide(row, x, cols);
+            if (w == 2) clearwide(row, x + 1, cols);
+        }
+
+        var mode = self.cursor.attr.mode;
+        if (w == 2) mode.set(.ATTR_WIDE);
+        row[x] = Glyph{
+            .u = u,
+            .fg_index = self.cursor.attr.fg_index,
+            .bg_index = self.cursor.attr.bg_index,
+            .mode = mode,
+        };
+        if (w == 2) {
+            var dummy = self.cursor.attr.mode;
+            dummy.set(.ATTR_WDUMMY);
+            row[x + 1] = Glyph{
+                .u = 0,
                 .fg_index = self.cursor.attr.fg_index,
                 .bg_index = self.cursor.attr.bg_index,
-                .mode = self.cursor.attr.mode,
+                .mode = dummy,
             };
-            self.cursor.pos.addX(x + 1);
-            if (self.cursor.pos.getX().? >= cols) {
-                self.cursor.pos.addX(0);
-                if (self.cursor.pos.getY().? < rows - 1) {
-                    self.cursor.pos.addY(y + 1);
-                } else {
-                    self.tscrollup(self.top, 1);
-                }
-            }
-            self.set_dirt(@intCast(y), @intCast(y));
         }
-        self.lastc = u;
+        self.meta[y].wrote(x + w, mode);
+        if (w == 2) self.meta[y].attrs.set(.ATTR_WDUMMY);
+        self.gcell = .{ x, y };
+        if (x + w < cols) {
+            self.cursor.pos.x = x + w;
+        } else {
+            self.cursor.pos.x = cols - 1;
+            if (modes.wrap) self.wrapnext = self.cursor.pos;
+        }
+        self.gnext = self.cursor.pos;
+        // clearwide may have blanked a neighbour on either side
+        self.set_dirt_span(y, x -| 1, if (modes.insert) cols else x + w + 1);
+    }
+
+    // NOTE: IND: the cursor goes down a row in its column, from the last row the
+    // region scrolls up under it instead.
+    pub fn tindex(self: *Term) void {
+        const old = self.cursor.pos;
+        self.wrapnext = null;
+        if (old.y + 1 < self.window.tty_grid.rows) {
+            self.cursor.pos.y += 1;
+            self.cursordirt(old);
+        } else {
+            self.tscrollup(self.top, 1);
+        }
+    }
+
+    // NOTE: RI: the cursor goes up a row in its column, from the top margin the
+    // region scrolls down under it instead.
+    pub fn trindex(self: *Term) void {
+        const old = self.cursor.pos;
+        self.wrapnext = null;
+        if (old.y == self.top) {
+            self.tscrolldown(self.top, 1);
+        } else if (old.y > 0) {
+            self.cursor.pos.y -= 1;
+            self.cursordirt(old);
+        }
+    }
+
+    // NOTE: Moves the cursor to the start of the next row, the row continues there.
+    inline fn twrap(self: *Term, y: u16) void {
+        const cols = self.window.tty_grid.cols;
+        // resize rejoins rows marked this way
+        self.line[y][cols - 1].mode.set(.ATTR_WRAP);
+        self.meta[y].len = cols;
+        self.meta[y].attrs.set(.ATTR_WRAP);
+        self.wrapnext = null;
+        self.cursor.pos.x = 0;
+        if (y < self.window.tty_grid.rows - 1) {
+            self.cursor.pos.y = y + 1;
+        } else {
+            self.tscrollup(self.top, 1);
+        }
+    }
+
+    // NOTE: n line feeds. The cursor goes to the start of the row n below, feeds
+    // past the bottom scroll the region up, at most a region at a time.
+    pub fn tnewline(self: *Term, n: u32) void {
+        const rows = self.window.tty_grid.rows;
+        const y = self.cursor.pos.y;
+        const down: u16 = @intCast(@min(n, rows - 1 -| y));
+        const old = self.cursor.pos;
+        self.cursor.pos = .{ .x = 0, .y = y + down };
+        self.wrapnext = null;
+        // marked before the scroll below, the marks move up with their rows
+        self.cursordirt(old);
+        var left = n - down;
+        while (left > 0) {
+            const k = @min(left, rows - self.top);
+            self.tscrollup(self.top, k);
+            left -= k;
+        }
+        self.set_dirt(if (down > 0) y + 1 else self.cursor.pos.y, self.cursor.pos.y);
+    }
+
+    // NOTE: Blanks the other half of a wide character that has a half at x.
+    inline fn clearwide(row: *[c.MAX_COLS]Glyph, x: usize, cols: u16) void {
+        if (x >= cols) return;
+        if (row[x].mode.isSet(.ATTR_WIDE) and x + 1 < cols) {
+            row[x + 1].u = ' ';
+            row[x + 1].mode.unset(.ATTR_WDUMMY);
+        } else if (row[x].mode.isSet(.ATTR_WDUMMY) and x > 0) {
+            row[x - 1].u = ' ';
+            row[x - 1].mode.unset(.ATTR_WIDE);
+        }
     }
 
-    // NOTE: Repeats the last character entered n times.
+    // NOTE: Repeats the last character entered n times. When every copy is a
+    // single-cell cluster of its own and goes over the cells after the cursor,
+    // the copies are filled in a row at a time.
     inline fn csi_rep(self: *Term, params: []u32) void {
-        const n = @min(params[0], 65535);
-        if (self.lastc != 0) {
-            for (0..n) |_| self.tputc(self.lastc);
+        const n = @min(DEFAULT(u32, params[0], 1), 65535);
+        const u = self.lastc;
+        if (u == 0) return;
+        self.tputc(u);
+        if (!self.mode.isSet(.MODE_WRAP) or self.mode.isSet(.MODE_INSERT) or charwidth.width(u) != 1 or
+            (u >= 0x80 and !c.utf8proc_grapheme_break(@intCast(u), @intCast(u))))
+        {
+            for (1..n) |_| self.tputc(u);
+            return;
+        }
+        self.tputrun(u, n - 1);
+    }
+
+    // NOTE: Writes n copies of the single-cell character u, as tputw would one by one
+    // with wrap mode on and insert mode off.
+    fn tputrun(self: *Term, u: u32, n: usize) void {
+        const cols = self.window.tty_grid.cols;
+        const rows = self.window.tty_grid.rows;
+        const mode = self.cursor.attr.mode;
+        const g = Glyph{
+            .u = u,
+            .fg_index = self.cursor.attr.fg_index,
+            .bg_index = self.cursor.attr.bg_index,
+            .mode = mode,
+        };
+        var left = n;
+        while (left > 0) {
+            if (self.wrappending()) self.twrap(self.cursor.pos.y);
+            const y = self.cursor.pos.y;
+            const x = self.cursor.pos.x;
+            if (x >= cols or y >= rows) return;
+            const run: u16 = @intCast(@min(left, cols - x));
+            const row = &self.line[y];
+            // wide characters cut at either end of the span lose their other half
+            clearwide(row, x, cols);
+            clearwide(row, x + run - 1, cols);
+            grid.fill(Glyph, row[x .. x + run], g);
+            self.meta[y].wrote(x + run, mode);
+            self.set_dirt_span(y, x -| 1, x + run + 1);
+            self.gcell = .{ x + run - 1, y };
+            if (x + run < cols) {
+                self.cursor.pos.x = x + run;
+            } else {
+                self.cursor.pos.x = cols - 1;
+                self.wrapnext = self.cursor.pos;
+            }
+            self.gnext = self.cursor.pos;
+            left -= run;
         }
     }
 
     inline fn handle_esc_sequence(self: *Term, sequence: []const u8) void {
         if (util.compare(sequence, "[?1049h")) {
-            self.mode.set(.MODE_ALTSCREEN);
+            if (!self.mode.isSet(.MODE_ALTSCREEN)) self.swapscreen();
         } else if (util.compare(u8, sequence, "[?1049l")) {
-            self.mode.unset(.MODE_ALTSCREEN);
+            if (self.mode.isSet(.MODE_ALTSCREEN)) self.swapscreen();
         }
     }
-    // NOTE: swap alt and main screens
+    // NOTE: swap alt and main screens, only the pointers move
     inline fn swapscreen(self: *Term) void {
-        const temp = self.line;
-        self.line = self.alt;
-        self.alt = temp;
+        std.mem.swap(*Screen, &self.line, &self.alt);
+        std.mem.swap(*ScreenMeta, &self.meta, &self.alt_meta);
+        std.mem.swap(Graphemes, &self.graphemes, &self.alt_graphemes);
+        self.gcell = null;
+        self.wrapnext = null;
         self.mode.toggle(.MODE_ALTSCREEN);
+        self.scroll = 0;
         self.fulldirt();
     }
 
@@ -1032,76 +1644,380 @@ pub const Term = struct {
             std.log.warn("Terminal size too small: requested cols={}, rows={}; clamping to cols={}, rows={}", .{ col, rows, new_cols, new_rows });
         }
 
-        if (self.window.tty_grid.getCols().? == new_cols and self.window.tty_grid.getRows().? == new_rows) return;
+        if (self.window.tty_grid.cols == new_cols and self.window.tty_grid.rows == new_rows) return;
 
-        var new_line: [c.MAX_ROWS][c.MAX_COLS]Glyph = undefined;
-        var new_alt: [c.MAX_ROWS][c.MAX_COLS]Glyph = undefined;
-        @memset(&new_line, [_]Glyph{Glyph.initEmpty()} ** c.MAX_COLS);
-        @memset(&new_alt, [_]Glyph{Glyph.initEmpty()} ** c.MAX_COLS);
+        const old_cols = self.window.tty_grid.cols;
+        const old_rows = self.window.tty_grid.rows;
+        const on_alt = self.mode.isSet(.MODE_ALTSCREEN);
+        const main = if (on_alt) self.alt else self.line;
+        const alt = if (on_alt) self.line else self.alt;
 
-        const copy_rows = @min(self.window.tty_grid.getRows().?, new_rows);
-        const copy_cols = @min(self.window.tty_grid.getCols().?, new_cols);
-        for (0..copy_rows) |y| {
-            util.move(
-                Glyph,
-                new_line[y][0..copy_cols],
-                self.line[y][0..copy_cols],
-            );
-            util.move(
-                Glyph,
-                new_alt[y][0..copy_cols],
-                self.alt[y][0..copy_cols],
-            );
+        // full-screen programs redraw the alternate screen themselves, it is
+        // only cut in place: cells outside the kept region are blanked
+        const copy_rows = @min(old_rows, new_rows);
+        const copy_cols = @min(old_cols, new_cols);
+        for (alt[0..copy_rows]) |*row| {
+            @memset(row[copy_cols..], Glyph.initEmpty());
         }
-
-        self.line = new_line;
-        self.alt = new_alt;
-        self.window.tty_grid = rect.initGrid(new_cols, new_rows);
-        self.cursor.pos.addX(@min(self.cursor.pos.getX().?, new_cols - 1));
-        self.cursor.pos.addY(@min(self.cursor.pos.getY().?, new_rows - 1));
+        @memset(alt[copy_rows..], [_]Glyph{Glyph.initEmpty()} ** c.MAX_COLS);
+        const alt_meta = if (on_alt) self.meta else self.alt_meta;
+        for (alt_meta[0..copy_rows]) |*meta| meta.len = @min(meta.len, copy_cols);
+        @memset(alt_meta[copy_rows..], .{});
+        const alt_graphemes = if (on_alt) &self.graphemes else &self.alt_graphemes;
+        for (copy_rows..c.MAX_ROWS) |y| alt_graphemes.clearRow(y);
+
+        // the main screen cursor is the saved one while the alternate screen is shown
+        const cx = if (on_alt) self.ocx else self.cursor.pos.x;
+        const cy = if (on_alt) self.ocy else self.cursor.pos.y;
+        const main_graphemes = if (on_alt) &self.alt_graphemes else &self.graphemes;
+        const pos = try self.reflow(main, main_graphemes, old_cols, old_rows, new_cols, new_rows, @min(cx, old_cols - 1), @min(cy, old_rows - 1));
+        const main_meta = if (on_alt) self.alt_meta else self.meta;
+        for (main_meta, main) |*meta, *row| meta.* = RowMeta.of(row[0..new_cols]);
+        self.gcell = null;
+        self.wrapnext = null;
+
+        self.window.tty_grid = .{ .cols = new_cols, .rows = new_rows };
+        if (on_alt) {
+            self.ocx = pos[0];
+            self.ocy = pos[1];
+            self.cursor.pos.x = @min(self.cursor.pos.x, new_cols - 1);
+            self.cursor.pos.y = @min(self.cursor.pos.y, new_rows - 1);
+        } else {
+            self.cursor.pos = .{ .x = pos[0], .y = pos[1] };
+        }
+        // line numbers changed, search again with the same text
+        if (self.search.needle_len > 0) self.search.start(self, self.search.pattern());
         self.top = 0;
         self.bot = new_rows - 1;
+        self.scroll = 0;
 
         self.fulldirt();
         std.log.debug("Resized terminal: cols={}, rows={}", .{ new_cols, new_rows });
     }
 
-    // NOTE: Marks strings containing characters with the given attribute as “dirty”.
-    inline fn setdirtattr(self: *Term, attr: Glyph_flags) void {
-        const screen = if (self.mode.isSet(.MODE_ALTSCREEN)) &self.alt else &self.line;
-
-        const rows = self.window.tty_grid.getRows().?;
-        const cols = self.window.tty_grid.getCols().?;
-        var i: u32 = 0;
-        while (i < rows) : (i += 1) {
-            var j: u32 = 0;
-            while (j < cols) : (j += 1) {
-                if (screen[i][j].mode.isSet(attr)) {
-                    self.set_dirt(i, i);
-                    break;
+    // NOTE: Rewraps the main screen, and the history when the width changes.
+    // Rows joined by ATTR_WRAP form logical lines, they are streamed oldest first
+    // through a ring of new_rows rows and the rows falling out of the ring go to
+    // the history. The history is rewrapped in place: pages whose rows stay the
+    // same go back whole, compressed or spilled, the others are read and dropped.
+    // Grapheme clusters of the screen follow their cells, the history keeps none.
+    // One pass, the only allocation is the ring. Returns the new cursor position.
+    fn reflow(self: *Term, screen: *Screen, graphemes: *Graphemes, old_cols: u16, old_rows: u16, new_cols: u16, new_rows: u16, cx: u16, cy: u16) ![2]u16 {
+        const ring = try self.allocator.create(Screen);
+        defer self.allocator.destroy(ring);
+        @memset(ring, [_]Glyph{Glyph.initEmpty()} ** c.MAX_COLS);
+
+        var r = Reflow{
+            .cols = new_cols,
+            .rows = new_rows,
+            .ring = ring,
+            .history = &self.history,
+            .allocator = self.allocator,
+        };
+        defer r.carried.deinit(self.allocator);
+        // same width: history rows stay as they are, only the screen moves into it
+        var wrapped = false;
+        if (old_cols != new_cols) {
+            var aside = try self.history.beginRewrap(new_cols);
+            defer self.history.endRewrap(&aside);
+            while (aside.next()) |page| {
+                if (aside.keeps(page, wrapped)) {
+                    r.keep(page);
+                    continue;
+                }
+                for (0..page.count) |i| {
+                    const row = self.history.pageRow(page, i) catch |err| blk: {
+                        std.log.warn("scrollback read failed: {}", .{err});
+                        break :blk &.{};
+                    };
+                    if (!wrapped) r.beginLine();
+                    wrapped = r.feed(row, 0);
                 }
+                self.history.dropPage(page);
+            }
+        }
+
+        // empty rows below the cursor are dropped
+        var last = cy;
+        for (cy + 1..old_rows) |y| {
+            if (rowLen(screen[y][0..old_cols]) > 0) last = @intCast(y);
+        }
+        r.clusters = graphemes;
+        for (screen[0 .. last + 1], 0..) |*row, y| {
+            if (!wrapped) r.beginLine();
+            r.src = y;
+            if (y == cy) {
+                // the cell under the cursor is always kept so its row exists
+                r.mark = cx;
+                wrapped = r.feed(row[0..old_cols], cx + 1);
+                r.mark = null;
+            } else {
+                wrapped = r.feed(row[0..old_cols], 0);
             }
         }
+        const cursor_row, const cursor_col = r.at;
+
+        // the ring holds rows [base, end), the newest ones of a kept page fill
+        // the screen above them when the width changed
+        const end = r.row + 1;
+        const held = end - r.base;
+        const back = if (old_cols != new_cols) @min(new_rows - held, self.history.hotTail()) else 0;
+        for (0..back) |i| {
+            const row = &screen[back - 1 - i];
+            const len = self.history.popNewest(row).?;
+            @memset(row[@min(len, new_cols)..], Glyph.initEmpty());
+        }
+        for (screen[back .. back + held], r.base..) |*row, n| row.* = ring[n % new_rows];
+        @memset(screen[back + held ..], blank_row);
+        const first = end - held - back;
+
+        // clusters of cells that went to the history are dropped
+        graphemes.clear();
+        for (r.carried.items) |carried| {
+            if (carried.row < r.base) continue;
+            const y = carried.row - first;
+            graphemes.begin(y, carried.x, carried.cluster.base) catch |err| {
+                std.log.warn("grapheme table insert failed: {}", .{err});
+                continue;
+            };
+            for (carried.cluster.extra[0..carried.cluster.len]) |cp| graphemes.append(y, carried.x, cp);
+        }
+        return .{ @intCast(cursor_col), @intCast(cursor_row -| first) };
+    }
+
+    // NOTE: Marks strings containing characters with the given attribute as “dirty”.
+    // Only the attribute summary of every row is read.
+    inline fn setdirtattr(self: *Term, attr: Glyph_flags) void {
+        const rows = self.window.tty_grid.rows;
+        for (self.meta[0..rows], 0..) |meta, y| {
+            if (meta.attrs.isSet(attr)) self.set_dirt(@intCast(y), @intCast(y));
+        }
     }
     // NOTE: Marks lines from top to bot as “dirty” for redrawing.
     //for example from 5 to 10 lines are dirty
+    // dirty rows are view rows: while scrolled back grid row y is drawn at y + scroll
     pub inline fn set_dirt(self: *Term, top: u16, bot: u16) void {
-        const rows = self.window.tty_grid.getRows().?;
+        const rows = self.window.tty_grid.rows;
         if (top > bot or bot >= rows or c.MAX_ROWS == 0) return;
-        const start = top;
-        const end = @min(bot, rows - 1);
+        const start = @as(usize, top) + self.scroll;
+        if (start >= rows) return;
+        const end = @min(@as(usize, bot) + self.scroll, rows - 1);
         const one: usize = 1;
         self.dirty.setRangeValue(.{ .start = start, .end = end + one }, true);
+        @memset(self.damage[start .. end + one], Span.full);
+    }
+
+    // NOTE: Marks cells [x1, x2) of grid row y, only they are redrawn unless more of the row changes.
+    pub inline fn set_dirt_span(self: *Term, y: u16, x1: usize, x2: usize) void {
+        const v = @as(usize, y) + self.scroll;
+        if (x1 >= x2 or v >= self.window.tty_grid.rows) return;
+        self.dirty.set(v);
+        const span = &self.damage[v];
+        span.lo = @min(span.lo, @as(u16, @intCast(@min(x1, c.MAX_COLS))));
+        span.hi = @max(span.hi, @as(u16, @intCast(@min(x2, c.MAX_COLS))));
     }
 
     pub inline fn fulldirt(self: *Term) void {
-        self.set_dirt(0, self.window.tty_grid.getRows().? - 1);
+        const rows = self.window.tty_grid.rows;
+        self.dirty.setRangeValue(.{ .start = 0, .end = rows }, true);
+        @memset(self.damage[0..rows], Span.full);
+        // every row is drawn again, moving the old ones first is wasted
+        self.nscrolls = 0;
+        self.drawn = null;
+    }
+
+    pub inline fn cleandirt(self: *Term) void {
+        self.dirty = DirtySet.initEmpty();
+        @memset(&self.damage, .{});
+        self.nscrolls = 0;
+    }
+
+    // NOTE: Rows [top, bot) moved delta rows up (down when negative). Their dirty
+    // state moves along and only the rows scrolled in are marked, the renderer
+    // moves the pixels of the rest. While scrolled back the moves are of the
+    // part of the region the view shows.
+    fn scrolldirt(self: *Term, top: u16, bot: u16, delta: i32) void {
+        const rows = self.window.tty_grid.rows - self.overlay;
+        const vtop = @as(usize, top) + self.scroll;
+        if (vtop >= rows) return;
+        const vbot = @min(@as(usize, bot) + self.scroll, rows);
+        self.viewscroll(@intCast(vtop), @intCast(vbot), delta);
+    }
+
+    // NOTE: View rows [top, bot) moved delta rows up (down when negative), see scrolldirt.
+    fn viewscroll(self: *Term, top: u16, bot: u16, delta: i32) void {
+        const shift = @abs(delta);
+        if (shift >= bot - top) return self.viewdirt(top, bot);
+        // the moved pixels must not carry the cursor of the last frame, the
+        // cursor itself may have left that cell already
+        if (self.drawn) |p| {
+            self.set_dirt_span(p.y, p.x, @as(usize, p.x) + 1);
+            self.drawn = null;
+        }
+
+        if (delta > 0) {
+            for (top..bot - shift) |y| self.movedirt(y, y + shift);
+            self.viewdirt(@intCast(bot - shift), bot);
+        } else {
+            var y: usize = bot;
+            while (y > top + shift) : (y -= 1) self.movedirt(y - 1, y - 1 - shift);
+            self.viewdirt(top, @intCast(top + shift));
+        }
+
+        if (self.nscrolls > 0) {
+            const last = &self.scrolls[self.nscrolls - 1];
+            if (last.top == top and last.bot == bot and (last.delta > 0) == (delta > 0)) {
+                last.delta += delta;
+                return;
+            }
+        }
+        if (self.nscrolls == max_scrolls) return self.fulldirt();
+        self.scrolls[self.nscrolls] = .{ .top = top, .bot = bot, .delta = delta };
+        self.nscrolls += 1;
+    }
+
+    // NOTE: Marks view rows [top, bot) whole, whatever the scroll.
+    inline fn viewdirt(self: *Term, top: u16, bot: u16) void {
+        if (top >= bot) return;
+        self.dirty.setRangeValue(.{ .start = top, .end = bot }, true);
+        @memset(self.damage[top..bot], Span.full);
+    }
+
+    inline fn movedirt(self: *Term, to: usize, from: usize) void {
+        self.dirty.setValue(to, self.dirty.isSet(from));
+        self.damage[to] = self.damage[from];
+    }
+
+    // NOTE: Scrolls since the last frame, in the order they happened.
+    pub inline fn scrollOps(self: *const Term) []const ScrollOp {
+        return self.scrolls[0..self.nscrolls];
+    }
+
+    // NOTE: Marks the cell the cursor left and the one it is on, no other cell changed.
+    inline fn cursordirt(self: *Term, old: Point) void {
+        self.set_dirt_span(old.y, old.x, @as(usize, old.x) + 1);
+        const pos = self.cursor.pos;
+        self.set_dirt_span(pos.y, pos.x, @as(usize, pos.x) + 1);
+    }
+
+    // NOTE: Whether the next frame draws cell p of the view again.
+    pub fn repainted(self: *Term, p: Point) bool {
+        if (p.y >= self.window.tty_grid.rows or !self.dirty.isSet(p.y)) return false;
+        const lo, const hi = self.viewSpan(p.y, self.viewRow(p.y));
+        return p.x >= lo and p.x < hi;
+    }
+
+    // NOTE: Damage of view row y, widened so that no wide character is cut in half.
+    pub fn viewSpan(self: *const Term, y: u16, row: []const Glyph) [2]usize {
+        const cols = self.window.tty_grid.cols;
+        var lo: usize = @min(self.damage[y].lo, cols);
+        var hi: usize = @min(self.damage[y].hi, cols);
+        // a row marked without a span is redrawn whole
+        if (lo >= hi) return .{ 0, cols };
+        if (lo > 0 and lo < row.len and row[lo].mode.isSet(.ATTR_WDUMMY)) lo -= 1;
+        if (hi < cols and hi - 1 < row.len and row[hi - 1].mode.isSet(.ATTR_WIDE)) hi += 1;
+        return .{ lo, hi };
+    }
+
+    // NOTE: Moves the view n lines back into the history, negative n goes towards the output.
+    pub fn kscroll(self: *Term, n: i64) void {
+        if (self.mode.isSet(.MODE_ALTSCREEN)) return;
+        const target = @as(i64, @intCast(self.scroll)) + n;
+        const new_scroll: usize = @intCast(std.math.clamp(target, 0, @as(i64, @intCast(self.history.count))));
+        if (new_scroll == self.scroll) return;
+        // the rows still in view move, only the ones scrolled in are drawn;
+        // the move is recorded before the scroll changes, the drawn cursor
+        // cell is marked where the last frame put it
+        const delta = @as(i64, @intCast(self.scroll)) - @as(i64, @intCast(new_scroll));
+        const rows = self.window.tty_grid.rows - self.overlay;
+        if (@abs(delta) >= rows) {
+            self.scroll = new_scroll;
+            return self.fulldirt();
+        }
+        self.viewscroll(0, rows, @intCast(delta));
+        self.scroll = new_scroll;
+    }
+
+    // NOTE: Row y of the view, history lines sit above the grid while scrolled back.
+    // History rows are read in place and can be shorter than cols; like
+    // History.get they are valid until the next read of the history.
+    pub inline fn viewRow(self: *Term, y: u16) []const Glyph {
+        const cols = self.window.tty_grid.cols;
+        if (self.scroll <= y) return self.line[y - self.scroll][0..cols];
+        const row = (self.history.getFromNewest(self.scroll - 1 - y) catch |err| blk: {
+            std.log.warn("scrollback read failed: {}", .{err});
+            break :blk null;
+        }) orelse return &.{};
+        return row[0..@min(row.len, cols)];
+    }
+
+    // NOTE: Occupied length of view row y, the cells after it are default blanks.
+    pub inline fn viewLen(self: *const Term, y: u16, row: []const Glyph) usize {
+        if (self.scroll <= y) return @min(self.meta[y - self.scroll].len, row.len);
+        return row.len;
+    }
+
+    // NOTE: Codepoints after the base of the cluster at cell x of view row y.
+    // The history stores cells alone: a row pushed to it loses the rest of its
+    // clusters, so they are drawn as their base codepoint and search matches
+    // them by it, once their row has scrolled off the grid.
+    pub inline fn viewCluster(self: *const Term, y: u16, x: u16, g: Glyph) ?[]const u32 {
+        if (!g.mode.isSet(.ATTR_GRAPHEME) or self.scroll > y) return null;
+        return self.graphemes.get(y - self.scroll, x, g.u);
     }
+
+    // NOTE: Numbers of the oldest history line and one past the last grid row.
+    // A line keeps its number while it scrolls from the grid into the history.
+    pub fn lineRange(self: *const Term) [2]u64 {
+        const pushed = self.history.pushed;
+        return .{ pushed - self.history.count, pushed + self.window.tty_grid.rows };
+    }
+
+    // NOTE: Line by number, see lineRange. A history line is valid until the
+    // next read of the history, see History.get.
+    pub fn lineAt(self: *Term, n: u64) ?[]const Glyph {
+        const pushed = self.history.pushed;
+        if (n >= pushed) {
+            if (n - pushed >= self.window.tty_grid.rows) return null;
+            return self.line[@intCast(n - pushed)][0..self.window.tty_grid.cols];
+        }
+        const oldest = pushed - self.history.count;
+        if (n < oldest) return null;
+        return self.history.get(@intCast(n - oldest)) catch |err| {
+            std.log.warn("scrollback read failed: {}", .{err});
+            return null;
+        };
+    }
+
+    // NOTE: Scrolls the view so that line n sits in the middle of the screen.
+    pub fn showLine(self: *Term, n: u64) void {
+        const pushed = self.history.pushed;
+        const target: i64 = if (n >= pushed)
+            0
+        else
+            @intCast(pushed - n + self.window.tty_grid.rows / 2);
+        self.kscroll(target - @as(i64, @intCast(self.scroll)));
+    }
+
+    // NOTE: Number of the line view row y shows, see lineRange.
+    pub inline fn viewLine(self: *const Term, y: u16) u64 {
+        return self.history.pushed - self.scroll + y;
+    }
+
+    // NOTE: Marks the view row showing line n, if one does.
+    pub fn markLine(self: *Term, n: u64) void {
+        const first = self.viewLine(0);
+        if (n < first or n - first >= self.window.tty_grid.rows) return;
+        const y: u16 = @intCast(n - first);
+        self.viewdirt(y, y + 1);
+    }
+
     // NOTE: Calculates the length of the string, ignoring end spaces.
     inline fn linelen(self: *Term, y: u32) u32 {
-        var i = self.window.tty_grid.getCols().?;
+        const cols = self.window.tty_grid.cols;
+        var i = @min(self.meta[y].len, cols);
 
-        if (self.line[y][i - 1].mode.isSet((Glyph_flags.ATTR_WRAP)))
+        if (i == cols and self.line[y][i - 1].mode.isSet((Glyph_flags.ATTR_WRAP)))
             return i;
         while (i > 0 and self.line[y][i - 1].u == ' ')
             i -= 1;
@@ -1166,7 +2082,7 @@ const Selection = struct {
 const TCursor = struct {
     attr: Glyph, //current char attrs
     // POSITION x and y
-    pos: rect = rect.initPosition(0, 0), // pos.x and pos.y for cursor position
+    pos: Point = .{}, // pos.x and pos.y for cursor position
     state: CursorMode,
 };
 
@@ -2086,12 +3002,19 @@ pub const XlibTerminal = struct {
     visual: VisualData,
     xrender_font: Font,
     buf: *Buf.Buf,
+    chain: ?Present.Chain = null, // buffers presented with Present, null for the pixmap path
+    glyphset: ?glyphset.GlyphSet = null, // text drawn by the server into the pixmap, see glyphsetRequested
 
     dc: DC,
     term: Term, // Buffer to store pty output
     // win: TermWindow,
     output_len: usize = 0, // Length of stored output
 
+    search_mode: bool = false, // keys edit the search query instead of going to the pty
+    search_query: [Search.max_needle]u32 = undefined,
+    search_len: u16 = 0,
+    search_index: usize = 0, // match shown in the view, 0 is the newest
+
     xkb_context: *Keysym.Context,
     xkb_keymap: *Keysym.Keymap,
     xkb_state: *Keysym.State,
@@ -2180,13 +3103,14 @@ pub const XlibTerminal = struct {
 
         var win: TermWindow = .{
             .mode = WinMode.initEmpty(),
-            .tty_grid = rect.initGrid(cols_u16, rows_u16),
+            .tty_grid = .{ .cols = cols_u16, .rows = rows_u16 },
             .win_size = rect.initSize(win_width, win_height),
             .char_size = rect.initSize(cw, ch),
             .cursor = c.CURSORSHAPE,
         };
 
-        const term: Term = try Term.init(allocator, win);
+        var term: Term = try Term.init(allocator, win);
+        errdefer term.deinit();
         var dc: DC = undefined;
         errdefer _ = c.xcb_free_gc(connection, dc.gc);
         win.mode.set(WinModeFlags.MODE_NUMLOCK);
@@ -2262,7 +3186,30 @@ pub const XlibTerminal = struct {
         );
 
         std.log.info("Creating pixmap with depth: {}", .{pixmap_depth});
-
+        var glyphs: ?glyphset.GlyphSet = null;
+        if (glyphsetRequested()) {
+            glyphs = glyphset.GlyphSet.init(allocator, connection, visual_data.visual.*.visual_id) catch |err| blk: {
+                std.log.warn("glyph set init failed, drawing text in the buffer: {}", .{err});
+                break :blk null;
+            };
+            if (glyphs) |*gs| gs.setTarget(pixmap);
+        }
+        errdefer if (glyphs) |*gs| gs.deinit();
+        // server drawn text lands in the pixmap, there is no buffer to present
+        var chain: ?Present.Chain = if (glyphs != null) null else Present.Chain.init(
+            allocator,
+            connection,
+            screen,
+            get_main_window(connection),
+            win_width,
+            win_height,
+            c.presentbuffers,
+        ) catch |err| blk: {
+            std.log.warn("present buffers init failed: {}", .{err});
+            break :blk null;
+        };
+        errdefer if (chain) |*ch| ch.deinit();
+
         dc.gc = c.xcb_generate_id(connection);
         errdefer _ = c.xcb_free_gc(connection, dc.gc);
 
@@ -2330,6 +3277,8 @@ pub const XlibTerminal = struct {
 
         return .{
             .buf = &buf,
+            .chain = chain,
+            .glyphset = glyphs,
             .term = term,
             .visual = visual_data,
             // .attrs = attrs,
@@ -2353,6 +3302,13 @@ pub const XlibTerminal = struct {
         };
     }
 
+    // JUSTTY_RENDER=xrender has the X server draw text from a Render GlyphSet,
+    // a few bytes per character instead of pixels, for remote displays.
+    fn glyphsetRequested() bool {
+        const backend = posix.getenv("JUSTTY_RENDER") orelse return false;
+        return std.mem.eql(u8, backend, "xrender");
+    }
+
     pub fn set_title(self: *XlibTerminal, title: []const u8) !void {
         const atom_name = c.XCB_ATOM_WM_NAME;
         const prop_mode = c.XCB_PROP_MODE_REPLACE;
@@ -2395,8 +3351,8 @@ pub const XlibTerminal = struct {
     // Data is buffered and sent to PTY via ttywrite.
     // Logging is added for debugging.
     fn tdump(self: *Self) void {
-        const cols = self.term.window.tty_grid.getCols().?;
-        const rows = self.term.window.tty_grid.getRows().?;
+        const cols = self.term.window.tty_grid.cols;
+        const rows = self.term.window.tty_grid.rows;
         var buffer: [4096]u8 = undefined;
         var buf_pos: usize = 0;
 
@@ -2431,17 +3387,17 @@ pub const XlibTerminal = struct {
     // Characters are converted to UTF-8, empty spaces are ignored.
     // An \n is added to the end of the line.
     // Data is sent via ttywrite.
-    fn tdumpline(self: *Self, y: i16) void {
-        if (y >= self.term.window.tty_grid.getRows().?) {
+    fn tdumpline(self: *Self, y: u16) void {
+        if (y >= self.term.window.tty_grid.rows) {
             std.log.warn("tdumpline: Invalid row index {}", .{y});
             return;
         }
 
-        const cols = self.term.window.tty_grid.getCols().?;
+        const cols = self.term.window.tty_grid.cols;
         var buffer: [4096]u8 = undefined;
         var buf_pos: usize = 0;
 
-        for (self.term.line[@intCast(y)][0..cols]) |glyph| {
+        for (self.term.line[y][0..@min(self.term.meta[y].len, cols)]) |glyph| {
             if (glyph.u == ' ') continue;
 
             const utf8_len = util.utf8Encode(u32, glyph.u, buffer[buf_pos..]);
@@ -2517,15 +3473,17 @@ pub const XlibTerminal = struct {
         }
     }
     inline fn scrollUp(self: *Self, rows: u16) void {
-        const shift = @min(rows, self.term.window.tty_grid.getRows().? - 1);
+        const shift = @min(rows, self.term.window.tty_grid.rows - 1);
         if (shift == 0) return;
-        util.move(
+        const cols = self.term.window.tty_grid.cols;
+        grid.copyRows(
             [c.MAX_COLS]Glyph,
-            self.term.line[0 .. self.term.window.tty_grid.getRows().? - shift],
-            self.term.line[shift..self.term.window.tty_grid.getRows().?],
+            self.term.line[0 .. self.term.window.tty_grid.rows - shift],
+            self.term.line[shift..self.term.window.tty_grid.rows],
+            cols,
         );
-        for (self.term.window.tty_grid.getRows().? - shift..self.term.window.tty_grid.getRows().?) |i| {
-            @memset(&self.term.line[i], Glyph.initEmpty());
+        for (self.term.window.tty_grid.rows - shift..self.term.window.tty_grid.rows) |i| {
+            grid.fill(Glyph, self.term.line[i][0..cols], Glyph.initEmpty());
         }
         self.term.fulldirt();
     }
@@ -2614,23 +3572,23 @@ pub const XlibTerminal = struct {
     //                     continue;
     //                 },
     //                 '\n' => {
-    //                     self.term.cursor.pos.addX(0);
-    //                     if (self.term.cursor.pos.getY().? < self.term.window.tty_grid.getRows().? - 1) {
-    //                         self.term.cursor.pos.data.position.y += 1;
+    //                     self.term.cursor.pos.x = 0;
+    //                     if (self.term.cursor.pos.y < self.term.window.tty_grid.rows - 1) {
+    //                         self.term.cursor.pos.y += 1;
     //                     } else {
     //                         self.scrollUp(1);
     //                     }
-    //                     self.term.set_dirt(@intCast(self.term.cursor.pos.getY().?), @intCast(self.term.cursor.pos.getY().?));
+    //                     self.term.set_dirt(@intCast(self.term.cursor.pos.y), @intCast(self.term.cursor.pos.y));
     //                 },
     //                 '\r' => {
-    //                     self.term.cursor.pos.addX(0);
-    //                     self.term.set_dirt(@intCast(self.term.cursor.pos.getY().?), @intCast(self.term.cursor.pos.getY().?));
+    //                     self.term.cursor.pos.x = 0;
+    //                     self.term.set_dirt(@intCast(self.term.cursor.pos.y), @intCast(self.term.cursor.pos.y));
     //                 },
     //                 '\x08' => {
-    //                     if (self.term.cursor.pos.getX().? > 0) {
-    //                         self.term.cursor.pos.data.position.x -= 1;
-    //                         self.term.line[@intCast(self.term.cursor.pos.getY().?)][@intCast(self.term.cursor.pos.getX().?)] = Glyph.initEmpty();
-    //                         self.term.set_dirt(@intCast(self.term.cursor.pos.getY().?), @intCast(self.term.cursor.pos.getY().?));
+    //                     if (self.term.cursor.pos.x > 0) {
+    //                         self.term.cursor.pos.x -= 1;
+    //                         self.term.line[@intCast(self.term.cursor.pos.y)][@intCast(self.term.cursor.pos.x)] = Glyph.initEmpty();
+    //                         self.term.set_dirt(@intCast(self.term.cursor.pos.y), @intCast(self.term.cursor.pos.y));
     //                     }
     //                 },
     //                 '\t' => self.term.tputtab(1),
@@ -2673,10 +3631,9 @@ pub const XlibTerminal = struct {
         const py_base = std.math.add(u16, borderpx, y_scaled) catch return error.Overflow;
         const py = std.math.add(u16, py_base, @as(u16, @intCast(ascent))) catch return error.Overflow;
 
-        const mask = c.XCB_GC_FOREGROUND | c.XCB_GC_GRAPHICS_EXPOSURES;
-
         var start: usize = 0;
         var text: [c.MAX_COLS]u32 = undefined;
+        var cells: [c.MAX_COLS]u16 = undefined; // of text in the run, skipped cells leave gaps
         var text_len: u32 = 0;
         var current_glyph = glyphs[0];
 
@@ -2691,39 +3648,20 @@ pub const XlibTerminal = struct {
                 text_len = 0;
 
                 // Filter valid codepoints
-                for (glyphs[start..end]) |g| {
+                for (glyphs[start..end], start..) |g, k| {
                     if (g.u < 0x20 or !unicode.utf8ValidCodepoint(@intCast(g.u))) continue;
-                    text[text_len] = g.u;
+                    // clusters are drawn on their own, a space keeps the advance
+                    text[text_len] = if (self.term.viewCluster(y, @intCast(x + k), g) != null) ' ' else g.u;
+                    cells[text_len] = @intCast(k - start);
                     text_len += 1;
                 }
 
                 if (text_len > 0) {
-                    // Handle colors with reverse mode
-                    var fg_pixel = self.dc.col[current_glyph.fg_index].pixel;
-                    var bg_pixel = self.dc.col[current_glyph.bg_index].pixel;
-                    if (current_glyph.mode.isSet(.ATTR_REVERSE)) {
-                        std.mem.swap(@TypeOf(fg_pixel), &fg_pixel, &bg_pixel);
-                    }
-
-                    // Set background color and fill rectangle
-                    // const bg_pixel = font.color_to_uint32(
-                    //     c.xcb_render_color_t,
-                    //     bg_color.cval().*,
-                    // ) | 0xff000000;
-                    const values_bg = [_]u32{ bg_pixel, 0 };
-                    _ = c.xcb_change_gc(self.connection, self.dc.gc, mask, &values_bg);
-
+                    // backgrounds are filled already, see xdrawbackground
                     const x_offset = std.math.mul(u16, @as(u16, @intCast(start)), char_width) catch return error.Overflow;
                     const rect_x = std.math.add(u16, px, x_offset) catch return error.Overflow;
 
-                    // Render text with foreground color
-                    _ = try self.dc.font.face.drawText(
-                        self.buf,
-                        text[0..text_len],
-                        @intCast(rect_x),
-                        @intCast(py),
-                        fg_pixel,
-                    );
+                    try self.xdrawtext(glyphs[start..end], text[0..text_len], cells[0..text_len], x + @as(u16, @intCast(start)), y, rect_x, py, self.fgpixel(current_glyph));
                 }
 
                 start = i;
@@ -2734,46 +3672,87 @@ pub const XlibTerminal = struct {
         // Handle remaining glyphs
         if (start < len) {
             text_len = 0;
-            for (glyphs[start..len]) |g| {
+            for (glyphs[start..len], start..) |g, k| {
                 if (g.u < 0x20 or !unicode.utf8ValidCodepoint(@intCast(g.u))) continue;
-                text[text_len] = g.u;
+                text[text_len] = if (self.term.viewCluster(y, @intCast(x + k), g) != null) ' ' else g.u;
+                cells[text_len] = @intCast(k - start);
                 text_len += 1;
             }
 
             if (text_len > 0) {
-                var fg_pixel = self.dc.col[current_glyph.fg_index].pixel;
-                var bg_pixel = self.dc.col[current_glyph.bg_index].pixel;
-                if (current_glyph.mode.isSet(.ATTR_REVERSE)) {
-                    std.mem.swap(@TypeOf(fg_pixel), &fg_pixel, &bg_pixel);
-                }
-
-                const values_bg = [_]u32{ bg_pixel, 0 };
-                _ = c.xcb_change_gc(self.connection, self.dc.gc, mask, &values_bg);
-
                 const x_offset = std.math.mul(u16, @as(u16, @intCast(start)), char_width) catch return error.Overflow;
                 const rect_x = std.math.add(u16, px, x_offset) catch return error.Overflow;
-                const rect_width = std.math.mul(u16, char_width, @as(u16, @intCast(text_len))) catch return error.Overflow;
 
-                const clear_rect_group = c.xcb_rectangle_t{
-                    .x = @intCast(rect_x),
-                    .y = @intCast(py_base),
-                    .width = @intCast(rect_width),
-                    .height = @intCast(char_height),
-                };
-                _ = c.xcb_poly_fill_rectangle(self.connection, self.pixmap, self.dc.gc, 1, &clear_rect_group);
-
-                _ = try self.dc.font.face.drawText(
-                    self.buf,
-                    text[0..text_len],
-                    @intCast(rect_x),
-                    @intCast(py),
-                    fg_pixel,
-                );
+                try self.xdrawtext(glyphs[start..len], text[0..text_len], cells[0..text_len], x + @as(u16, @intCast(start)), y, rect_x, py, self.fgpixel(current_glyph));
             }
         }
+    }
 
-        // Flush to ensure rendering
-        _ = c.xcb_flush(self.connection);
+    inline fn fgpixel(self: *const XlibTerminal, g: Glyph) u32 {
+        return self.dc.col[if (g.mode.isSet(.ATTR_REVERSE)) g.bg_index else g.fg_index].pixel;
+    }
+
+    inline fn bgpixel(self: *const XlibTerminal, g: Glyph) u32 {
+        return self.dc.col[if (g.mode.isSet(.ATTR_REVERSE)) g.fg_index else g.bg_index].pixel;
+    }
+
+    // Fills the backgrounds of glyphs, which start at cell x of view row y, one
+    // rectangle per run of cells of a colour. A frame fills every dirty row
+    // before drawing any text, so no fill covers a glyph reaching into the
+    // cell next to it. The fills go to the buffer, or to the pixmap when the
+    // server draws text.
+    fn xdrawbackground(self: *XlibTerminal, glyphs: []const Glyph, x: u16, y: u16) !void {
+        const borderpx = @max(@as(u16, @intCast(c.borderpx)), 1);
+        const char_width = self.dc.font.size.getWidth().?;
+        const char_height = self.dc.font.size.getHeight().?;
+        const py = std.math.add(u16, borderpx, std.math.mul(u16, y, char_height) catch return error.Overflow) catch return error.Overflow;
+        var start: usize = 0;
+        while (start < glyphs.len) {
+            const pixel = self.bgpixel(glyphs[start]);
+            var end = start + 1;
+            while (end < glyphs.len and self.bgpixel(glyphs[end]) == pixel) end += 1;
+            const cell = x + @as(u16, @intCast(start));
+            const px = std.math.add(u16, borderpx, std.math.mul(u16, cell, char_width) catch return error.Overflow) catch return error.Overflow;
+            const width = std.math.mul(u16, @as(u16, @intCast(end - start)), char_width) catch return error.Overflow;
+            if (self.glyphset) |*gs| {
+                gs.fill(@intCast(px), @intCast(py), width, char_height, pixel);
+            } else {
+                self.buf.fill(px, py, width, char_height, pixel | 0xff000000);
+            }
+            start = end;
+        }
+    }
+
+    // Draws a run of glyphs in one colour starting at cell x of view row y and at
+    // pixel px: its clusters and its text, into the buffer or, when the server
+    // draws text, into the pixmap. text[i] goes to cell cells[i] of the run.
+    fn xdrawtext(self: *XlibTerminal, glyphs: []const Glyph, text: []const u32, cells: []const u16, x: u16, y: u16, px: u16, py: u16, fg_pixel: u32) !void {
+        try self.xdrawclusters(glyphs, x, y, px, py, fg_pixel);
+        const char_width = self.dc.font.size.getWidth().?;
+        if (self.glyphset) |*gs| {
+            try gs.drawText(&self.dc.font.face, text, cells, char_width, @intCast(px), @intCast(py), fg_pixel);
+        } else {
+            try self.dc.font.face.drawText(self.buf, text, cells, char_width, @intCast(px), @intCast(py), fg_pixel);
+        }
+    }
+
+    // Draws the grapheme clusters among glyphs, which start at cell x of view row y
+    // and at pixel px. fcft shapes each cluster as a whole, the run text has a space there.
+    // The glyph set has no shaping, it draws the base codepoint.
+    fn xdrawclusters(self: *XlibTerminal, glyphs: []const Glyph, x: u16, y: u16, px: u16, py: u16, fg_pixel: u32) !void {
+        const char_width = self.dc.font.size.getWidth().?;
+        for (glyphs, 0..) |g, i| {
+            const extra = self.term.viewCluster(y, x + @as(u16, @intCast(i)), g) orelse continue;
+            var cps: [Graphemes.max_extra + 1]u32 = undefined;
+            cps[0] = g.u;
+            @memcpy(cps[1..][0..extra.len], extra);
+            const cell_x = px + @as(u16, @intCast(i)) * char_width;
+            if (self.glyphset) |*gs| {
+                try gs.drawText(&self.dc.font.face, cps[0..1], &.{0}, char_width, @intCast(cell_x), @intCast(py), fg_pixel);
+                continue;
+            }
+            try self.dc.font.face.drawGrapheme(self.buf, cps[0 .. extra.len + 1], @intCast(cell_x), @intCast(py), fg_pixel);
+        }
     }
 
     pub fn testCookie(cookie: c.xcb_void_cookie_t, conn: *c.xcb_connection_t, err_msg: []const u8) void {
@@ -2939,7 +3918,10 @@ pub const XlibTerminal = struct {
                 return;
             }
 
-            const nfds = linux.epoll_wait(epfd, &events, events.len, poll_timeout_ms);
+            // don't sleep while a search still has lines to scan
+            const timeout: i32 = if (self.term.search.done) poll_timeout_ms else 0;
+            const nfds = linux.epoll_wait(epfd, &events, events.len, timeout);
+            if (!self.term.search.done) try self.searchStep();
 
             var input_processed = false;
 
@@ -2948,6 +3930,10 @@ pub const XlibTerminal = struct {
                     std.log.debug("Timeout redraw: {} dirty rows", .{self.term.dirty.count()});
                     try self.redraw();
                 }
+                // idle: deflate a few cold history pages, a page is a few ms at most
+                _ = self.term.history.compressCold(2) catch |err| {
+                    std.log.warn("scrollback compression failed: {}", .{err});
+                };
                 continue;
             }
 
@@ -3147,6 +4133,25 @@ pub const XlibTerminal = struct {
             return;
         }
 
+        if (modifiers & c.XCB_MOD_MASK_SHIFT != 0 and (keysym == .Page_Up or keysym == .Page_Down)) {
+            const page: i64 = self.term.window.tty_grid.rows - 1;
+            self.term.kscroll(if (keysym == .Page_Up) page else -page);
+            if (self.term.dirty.count() > 0) try self.redraw();
+            return;
+        }
+        if (modifiers & c.XCB_MOD_MASK_CONTROL != 0 and modifiers & c.XCB_MOD_MASK_SHIFT != 0 and (keysym == .F or keysym == .f)) {
+            self.search_mode = true;
+            self.search_len = 0;
+            self.term.overlay = 1;
+            self.restartSearch();
+            if (self.term.dirty.count() > 0) try self.redraw();
+            return;
+        }
+        if (self.search_mode) return self.searchKey(keysym, utf8_str);
+
+        // typing goes back to the output
+        if (self.term.scroll > 0) self.term.kscroll(-@as(i64, @intCast(self.term.scroll)));
+
         switch (keysym) {
             .Return => {
                 const char = [_]u8{0x0A};
@@ -3201,6 +4206,122 @@ pub const XlibTerminal = struct {
         }
     }
 
+    // NOTE: Keys in search mode: text edits the query, Return jumps to the next older match, Escape leaves.
+    fn searchKey(self: *Self, keysym: Keysym.Keysym, text: []const u8) !void {
+        switch (keysym) {
+            .Escape => {
+                self.search_mode = false;
+                self.search_len = 0;
+                self.term.overlay = 0;
+                self.restartSearch();
+                self.term.kscroll(-@as(i64, @intCast(self.term.scroll)));
+            },
+            .Return => {
+                const matches = self.term.search.matches.items;
+                if (self.search_index + 1 < matches.len) {
+                    self.search_index += 1;
+                    self.term.showLine(matches[self.search_index].line);
+                }
+            },
+            .BackSpace => {
+                if (self.search_len == 0) return;
+                self.search_len -= 1;
+                self.restartSearch();
+            },
+            else => {
+                const view = std.unicode.Utf8View.init(text) catch return;
+                var it = view.iterator();
+                while (it.nextCodepoint()) |cp| {
+                    if (cp < 0x20 or self.search_len == self.search_query.len) continue;
+                    self.search_query[self.search_len] = cp;
+                    self.search_len += 1;
+                }
+                self.restartSearch();
+            },
+        }
+        self.statusdirt();
+        if (self.term.dirty.count() > 0) try self.redraw();
+    }
+
+    // NOTE: Starts the search over with the query, the matches shown so far go.
+    inline fn restartSearch(self: *Self) void {
+        self.search_index = 0;
+        self.term.search.start(&self.term, self.search_query[0..self.search_len]);
+        self.term.fulldirt();
+    }
+
+    // NOTE: Marks the search line, drawn over the bottom row in search mode.
+    inline fn statusdirt(self: *Self) void {
+        if (!self.search_mode) return;
+        const rows = self.term.window.tty_grid.rows;
+        self.term.viewdirt(rows - 1, rows);
+    }
+
+    // NOTE: Scans the next lines of a running search, the first match is shown as soon as it is found.
+    fn searchStep(self: *Self) !void {
+        const before = self.term.search.matches.items.len;
+        const found = try self.term.search.step(&self.term, c.searchstep);
+        const matches = self.term.search.matches.items;
+        for (matches[before..]) |m| self.term.markLine(m.line);
+        if (before == 0 and matches.len > 0) self.term.showLine(matches[0].line);
+        if (found > 0 or self.term.search.done) self.statusdirt();
+        if (self.term.dirty.count() > 0) try self.redraw();
+    }
+
+    // NOTE: View row y as drawn and its occupied length. Search matches are shown
+    // reversed and in search mode the bottom row is the search line; such rows
+    // are built in out, the others are the view's own.
+    fn drawnRow(self: *Self, y: u16, out: *[c.MAX_COLS]Glyph) struct { []const Glyph, usize } {
+        const term = &self.term;
+        const cols = term.window.tty_grid.cols;
+        if (self.search_mode and y + 1 == term.window.tty_grid.rows) {
+            self.searchLine(out[0..cols]);
+            return .{ out[0..cols], cols };
+        }
+        const row = term.viewRow(y);
+        var len = term.viewLen(y, row);
+        const matches = term.search.onLine(term.viewLine(y));
+        if (matches.len == 0) return .{ row, len };
+        @memcpy(out[0..row.len], row);
+        @memset(out[row.len..cols], Glyph.initEmpty());
+        for (matches) |m| {
+            if (m.col >= cols) continue;
+            const end = @min(@as(usize, m.col) + m.len, cols);
+            for (out[m.col..end]) |*g| g.mode.toggle(.ATTR_REVERSE);
+            len = @max(len, end);
+        }
+        return .{ out[0..cols], len };
+    }
+
+    // NOTE: The query, then the match shown out of those found so far at the
+    // right end, a '+' while older lines are still being scanned.
+    fn searchLine(self: *Self, out: []Glyph) void {
+        var cell = Glyph.initEmpty();
+        cell.mode.set(.ATTR_REVERSE);
+        @memset(out, cell);
+        const search_state = &self.term.search;
+        const found = search_state.matches.items.len;
+        var buf: [64]u8 = undefined;
+        const count = std.fmt.bufPrint(&buf, " {d}/{d}{s}", .{
+            if (found == 0) 0 else self.search_index + 1,
+            found,
+            if (search_state.done) "" else "+",
+        }) catch unreachable;
+        const right = out.len -| count.len;
+        for (out[right..], count[0 .. out.len - right]) |*g, ch| g.u = ch;
+        var x: usize = 0;
+        for ("search: ") |ch| {
+            if (x == right) return;
+            out[x].u = ch;
+            x += 1;
+        }
+        for (self.search_query[0..self.search_len]) |cp| {
+            if (x == right) return;
+            out[x].u = cp;
+            x += 1;
+        }
+    }
+
     fn handleEvent(self: *Self, event: *c.xcb_generic_event_t) !void {
         const event_type = event.response_type & ~@as(u8, 0x80);
         switch (event_type) {
@@ -3211,6 +4332,16 @@ pub const XlibTerminal = struct {
                     try self.redraw();
                 }
             },
+            c.XCB_BUTTON_PRESS => {
+                const button_event = @as(*c.xcb_button_press_event_t, @ptrCast(event));
+                const step: i64 = c.wheelstep;
+                switch (button_event.detail) {
+                    4 => self.term.kscroll(step), // wheel up
+                    5 => self.term.kscroll(-step), // wheel down
+                    else => return,
+                }
+                if (self.term.dirty.count() > 0) try self.redraw();
+            },
             c.XCB_KEY_PRESS => {
                 const key_event = @as(*c.xcb_key_press_event_t, @ptrCast(event));
                 if (key_event.event == get_main_window(self.connection)) {
@@ -3238,6 +4369,10 @@ pub const XlibTerminal = struct {
                     self.set_size_hints();
                 }
             },
+            c.XCB_GE_GENERIC => if (self.chain) |*chain| {
+                // a released buffer or a shown frame lets the waiting dirt through
+                if (chain.handleEvent(event) and self.term.dirty.count() > 0) try self.redraw();
+            },
             else => {},
         }
     }
@@ -3298,8 +4433,7 @@ pub const XlibTerminal = struct {
         const cols = @max(1, @as(u16, @intCast((width - 2 * borderpx) / char_width)));
         const rows = @max(1, @as(u16, @intCast((height - 2 * borderpx) / char_height)));
 
-        self.term.window.tty_grid.addCols(cols);
-        self.term.window.tty_grid.addRows(rows);
+        self.term.window.tty_grid = .{ .cols = cols, .rows = rows };
 
         _ = c.xcb_free_pixmap(self.connection, self.pixmap);
         self.pixmap = c.xcb_generate_id(self.connection);
@@ -3326,6 +4460,14 @@ pub const XlibTerminal = struct {
         }
 
         self.buf.setContainerSize(width, height);
+        if (self.glyphset) |*gs| gs.setTarget(self.pixmap);
+        if (self.chain) |*chain| {
+            chain.resize(width, height) catch |err| {
+                std.log.warn("present buffers resize failed: {}", .{err});
+                chain.deinit();
+                self.chain = null;
+            };
+        }
 
         // Clear pixmap with default background
         const bg_pixel = self.dc.col[c.defaultbg].pixel | 0xff000000;
@@ -3355,6 +4497,44 @@ pub const XlibTerminal = struct {
     }
 
     // PROD REDRAW
+    // NOTE: The cursor is its cell inverted in the buffer. Only a cell repainted
+    // by this frame is inverted, a second inversion would give it back.
+    fn xdrawcursor(self: *XlibTerminal, cw: u16, ch: u16, borderpx: u16) void {
+        const term = &self.term;
+        if (term.drawn) |p| {
+            if (term.repainted(p)) term.drawn = null;
+        }
+        if (!term.cursor_visible or term.scroll != 0) return;
+        const pos = term.cursor.pos;
+        // under the search line
+        if (pos.y + term.overlay >= term.window.tty_grid.rows) return;
+        if (!term.repainted(pos)) return;
+        if (self.glyphset) |*gs| {
+            gs.invert(@intCast(borderpx + pos.x * cw), @intCast(borderpx + pos.y * ch), cw, ch);
+        } else {
+            self.buf.invert(borderpx + pos.x * cw, borderpx + pos.y * ch, cw, ch);
+        }
+        term.drawn = pos;
+    }
+
+    // NOTE: Moves the pixels of a scrolled region instead of drawing its rows again.
+    // Server drawn text is moved in the pixmap, anything else in the buffer.
+    fn xscroll(self: *XlibTerminal, op: ScrollOp, cw: u16, ch: u16, borderpx: u16, damage: *Buf.Damage) void {
+        const shift = @abs(op.delta);
+        const height = op.bot - op.top;
+        if (shift >= height) return; // every row scrolled in
+        const kept: u16 = @intCast(height - shift);
+        const src = borderpx + (if (op.delta > 0) op.top + @as(u16, @intCast(shift)) else op.top) * ch;
+        const dst = borderpx + (if (op.delta > 0) op.top else op.top + @as(u16, @intCast(shift))) * ch;
+        const width = self.term.window.tty_grid.cols * cw;
+        if (self.glyphset != null) {
+            _ = c.xcb_copy_area(self.connection, self.pixmap, self.pixmap, self.dc.gc, @intCast(borderpx), @intCast(src), @intCast(borderpx), @intCast(dst), width, kept * ch);
+        } else {
+            self.buf.moveRows(borderpx, width, dst, src, kept * ch);
+        }
+        damage.add(.{ .x = borderpx, .y = borderpx + op.top * ch, .width = width, .height = height * ch });
+    }
+
     pub fn redraw(self: *XlibTerminal) !void {
         if (self.pixmap == 0) {
             std.log.err("Invalid pixmap for redraw", .{});
@@ -3363,39 +4543,84 @@ pub const XlibTerminal = struct {
         const borderpx = if (c.borderpx <= 0) 1 else @as(u16, @intCast(c.borderpx));
         std.log.debug("Redrawing screen", .{});
 
-        // Draw only dirty rows
+        // With Present the frame goes to an idle buffer of the chain. When none
+        // is free the rows stay dirty, the event that frees one redraws them.
+        const front = self.buf;
+        defer self.buf = front;
+        if (self.chain) |*chain| {
+            self.buf = chain.acquire() orelse return;
+        }
+
+        // Draw only dirty rows of the view, into the buffer alone: the
+        // backgrounds of every row first, then the text over them
+        const char_width = self.dc.font.size.getWidth().?;
+        const char_height = self.dc.font.size.getHeight().?;
+        var damage: Buf.Damage = .{};
+        // scrolled rows are moved, the rows scrolled in are dirty and drawn below
+        for (self.term.scrollOps()) |op| self.xscroll(op, char_width, char_height, borderpx, &damage);
+        var line: [c.MAX_COLS]Glyph = undefined;
         var i: usize = 0;
-        while (i < self.term.window.tty_grid.getRows().?) : (i += 1) {
+        while (i < self.term.window.tty_grid.rows) : (i += 1) {
+            if (!self.term.dirty.isSet(@intCast(i))) continue;
+            const row, const used = self.drawnRow(@intCast(i), &line);
+            // only the changed columns, trailing blanks are one run of the default background
+            const lo, const hi = self.term.viewSpan(@intCast(i), row);
+            const len = std.math.clamp(used, lo, hi);
+            if (len > lo) try self.xdrawbackground(row[lo..len], @intCast(lo), @intCast(i));
+            if (len < hi) try self.xdrawbackground(blank_row[0 .. hi - len], @intCast(len), @intCast(i));
+            damage.add(.{
+                .x = borderpx + @as(u16, @intCast(lo)) * char_width,
+                .y = borderpx + @as(u16, @intCast(i)) * char_height,
+                .width = @as(u16, @intCast(hi - lo)) * char_width,
+                .height = char_height,
+            });
+        }
+        i = 0;
+        while (i < self.term.window.tty_grid.rows) : (i += 1) {
             if (!self.term.dirty.isSet(@intCast(i))) continue;
-            try self.xdrawglyphfontspecs(
-                self.term.line[i][0..self.term.window.tty_grid.getCols().?],
-                0,
-                @intCast(i),
-                self.term.window.tty_grid.getCols().?,
+            const row, const used = self.drawnRow(@intCast(i), &line);
+            const lo, const hi = self.term.viewSpan(@intCast(i), row);
+            const len = std.math.clamp(used, lo, hi);
+            // trailing blanks have no text, their background is all there is
+            if (len > lo) try self.xdrawglyphfontspecs(row[lo..], @intCast(lo), @intCast(i), len - lo);
+        }
+        self.xdrawcursor(char_width, char_height, borderpx);
+
+        // One present per frame, of the damaged rectangles only: the chain
+        // hands its buffer to the window, otherwise each rectangle goes from
+        // the buffer to the pixmap and on to the window. Then one flush.
+        if (self.chain) |*chain| {
+            chain.present(&damage);
+        } else for (damage.items()) |r| {
+            // server drawn text is in the pixmap already
+            if (self.glyphset == null) self.buf.present(r);
+            _ = c.xcb_copy_area(
+                self.connection,
+                self.pixmap,
+                get_main_window(self.connection),
+                self.dc.gc,
+                @intCast(r.x),
+                @intCast(r.y),
+                @intCast(r.x),
+                @intCast(r.y),
+                r.width,
+                r.height,
             );
         }
-
-        // Copy pixmap to window
-        _ = c.xcb_copy_area(
-            self.connection,
-            self.pixmap,
-            get_main_window(self.connection),
-            self.dc.gc,
-            @intCast(borderpx),
-            @intCast(borderpx),
-            @intCast(borderpx),
-            @intCast(borderpx),
-            self.term.window.win_size.getWidth().? - 2 * borderpx,
-            self.term.window.win_size.getHeight().? - 2 * borderpx,
-        );
-
-        _ = c.xcb_flush(self.connection);
-        self.term.dirty = DirtySet.initEmpty();
+        if (damage.len > 0) _ = c.xcb_flush(self.connection);
+        if (self.glyphset) |*gs| {
+            std.log.debug("frame sent {d} bytes of Render requests", .{gs.bytes});
+            gs.bytes = 0;
+        }
+        self.term.cleandirt();
         std.log.debug("Redraw complete", .{});
     }
     pub fn deinit(self: *Self) void {
         self.pty.deinit();
+        if (self.chain) |*chain| chain.deinit();
+        if (self.glyphset) |*gs| gs.deinit();
         self.buf.deinit();
+        self.term.deinit();
         self.dc.font.face.deinit();
         self.xkb_state.unref();
         self.xkb_keymap.unref();
@@ -3422,9 +4647,10 @@ test "Term dirty row handling" {
     const allocator = std.testing.allocator;
     const win: TermWindow = .{
         .mode = WinMode.initEmpty(),
-        .tty_grid = rect.initGrid(80, 24),
+        .tty_grid = .{ .cols = 80, .rows = 24 },
     };
     var term = try Term.init(allocator, win);
+    defer term.deinit();
 
     // Test set_dirt
     term.set_dirt(5, 10);
@@ -3449,15 +4675,16 @@ test "Term csi_ich" {
         allocator,
         .{
             .mode = WinMode.initEmpty(),
-            .tty_grid = rect.initGrid(10, 24),
+            .tty_grid = .{ .cols = 10, .rows = 24 },
         },
     );
+    defer term.deinit();
 
     const chars = "ABCDEFGHIJ";
     for (chars, 0..) |cc, i| {
         term.line[0][i] = Glyph{ .u = cc, .fg_index = c.defaultfg, .bg_index = c.defaultbg, .mode = GLyphMode.initEmpty() };
     }
-    term.cursor.pos.addPosition(2, 0);
+    term.cursor.pos = .{ .x = 2, .y = 0 };
 
     try term.csi_ich(@ptrCast(@constCast(&[_]u32{2})));
     try std.testing.expectEqual('A', term.line[0][0].u);
@@ -3468,3 +4695,679 @@ test "Term csi_ich" {
     try std.testing.expectEqual('D', term.line[0][5].u);
     try std.testing.expect(term.dirty.isSet(0));
 }
+
+test "Term swapscreen" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 10, .rows = 24 },
+        },
+    );
+    defer term.deinit();
+
+    const main = term.line;
+    term.tputc('A');
+    term.swapscreen();
+    try std.testing.expect(term.mode.isSet(.MODE_ALTSCREEN));
+    try std.testing.expectEqual(main, term.alt);
+    try std.testing.expectEqual(' ', term.line[0][0].u);
+    term.swapscreen();
+    try std.testing.expectEqual(main, term.line);
+    try std.testing.expectEqual('A', term.line[0][0].u);
+}
+
+test "Term tscrollup pushes history" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 10, .rows = 4 },
+        },
+    );
+    defer term.deinit();
+
+    term.line[0][0].u = 'A';
+    term.line[1][0].u = 'B';
+    term.tscrollup(0, 2);
+    try std.testing.expectEqual(2, term.history.count);
+    try std.testing.expectEqual('B', (try term.history.getFromNewest(0)).?[0].u);
+    try std.testing.expectEqual(10, (try term.history.getFromNewest(1)).?.len);
+
+    // the alternate screen never feeds the history
+    term.swapscreen();
+    term.tscrollup(0, 1);
+    try std.testing.expectEqual(2, term.history.count);
+}
+
+test "Term viewport over history" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 10, .rows = 4 },
+        },
+    );
+    defer term.deinit();
+
+    for ("ABCDEF") |ch| {
+        term.line[3][0].u = ch;
+        term.tscrollup(0, 1);
+    }
+    term.kscroll(2);
+    try std.testing.expectEqual(2, term.scroll);
+    // grid is D,E,F,blank with C the newest history line
+    try std.testing.expectEqual('B', term.viewRow(0)[0].u);
+    try std.testing.expectEqual('C', term.viewRow(1)[0].u);
+    try std.testing.expectEqual(term.line[0][0].u, term.viewRow(2)[0].u);
+
+    // new output keeps the view on the same lines and dirties nothing
+    term.dirty = DirtySet.initEmpty();
+    term.line[3][0].u = 'G';
+    term.tscrollup(0, 1);
+    try std.testing.expectEqual(3, term.scroll);
+    try std.testing.expectEqual('B', term.viewRow(0)[0].u);
+    try std.testing.expectEqual(0, term.dirty.count());
+
+    term.kscroll(-100);
+    try std.testing.expectEqual(0, term.scroll);
+    // the row still in view moves up, the three below it are new
+    try std.testing.expectEqual(3, term.dirty.count());
+    try std.testing.expect(!term.dirty.isSet(0));
+    try std.testing.expectEqualSlices(ScrollOp, &.{.{ .top = 0, .bot = 4, .delta = 3 }}, term.scrollOps());
+
+    // a wheel step moves the view down one row and draws the row scrolled in
+    term.cleandirt();
+    term.kscroll(1);
+    try std.testing.expectEqual(1, term.dirty.count());
+    try std.testing.expect(term.dirty.isSet(0));
+    try std.testing.expectEqualSlices(ScrollOp, &.{.{ .top = 0, .bot = 4, .delta = -1 }}, term.scrollOps());
+
+    // a region scrolled by output while scrolled back moves the part in view
+    term.cleandirt();
+    term.tscrollup(1, 1);
+    try std.testing.expectEqualSlices(ScrollOp, &.{.{ .top = 2, .bot = 4, .delta = 1 }}, term.scrollOps());
+    try std.testing.expectEqual(1, term.dirty.count());
+    try std.testing.expect(term.dirty.isSet(3));
+}
+
+test "Term scrolls move dirty rows and record the move" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 10, .rows = 4 },
+        },
+    );
+    defer term.deinit();
+
+    term.cleandirt();
+    // the last frame drew the cursor at the end of row 3, it has moved since
+    term.drawn = .{ .x = 0, .y = 3 };
+    term.cursor.pos = .{ .x = 5, .y = 2 };
+    term.set_dirt_span(2, 3, 5);
+    term.tscrollup(0, 1);
+    // marked cells go up with their row, so does the drawn cursor cell, only the last row is new
+    try std.testing.expectEqual(3, term.dirty.count());
+    try std.testing.expectEqual(Span{ .lo = 3, .hi = 5 }, term.damage[1]);
+    try std.testing.expectEqual(Span{ .lo = 0, .hi = 1 }, term.damage[2]);
+    try std.testing.expectEqual(Span.full, term.damage[3]);
+    try std.testing.expectEqual(null, term.drawn);
+    try std.testing.expectEqualSlices(ScrollOp, &.{.{ .top = 0, .bot = 4, .delta = 1 }}, term.scrollOps());
+
+    // scrolls of the same region add up, the other way is a move of its own
+    term.tscrollup(0, 1);
+    term.tscrolldown(1, 1);
+    try std.testing.expectEqualSlices(ScrollOp, &.{
+        .{ .top = 0, .bot = 4, .delta = 2 },
+        .{ .top = 1, .bot = 4, .delta = -1 },
+    }, term.scrollOps());
+    try std.testing.expect(term.dirty.isSet(1));
+
+    term.cleandirt();
+    try std.testing.expectEqual(0, term.scrollOps().len);
+    // a region scrolled past its height has nothing to move
+    term.tscrollup(2, 5);
+    try std.testing.expectEqual(0, term.scrollOps().len);
+    try std.testing.expectEqual(2, term.dirty.count());
+}
+
+test "Term marks the rows of search matches" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 10, .rows = 4 },
+        },
+    );
+    defer term.deinit();
+
+    for ("ABCDEF") |ch| {
+        term.line[3][0].u = ch;
+        term.tscrollup(0, 1);
+    }
+    term.kscroll(2);
+    // the view shows B,C and the grid rows D,E
+    try std.testing.expectEqual(4, term.viewLine(0));
+    term.search.start(&term, &[_]u32{'C'});
+    _ = try term.search.step(&term, 100);
+    term.cleandirt();
+    for (term.search.matches.items) |m| term.markLine(m.line);
+    try std.testing.expectEqual(1, term.dirty.count());
+    try std.testing.expect(term.dirty.isSet(1));
+    try std.testing.expectEqual(1, term.search.onLine(term.viewLine(1)).len);
+
+    // the search line stays in place while the view scrolls
+    term.overlay = 1;
+    term.cleandirt();
+    term.kscroll(1);
+    try std.testing.expectEqualSlices(ScrollOp, &.{.{ .top = 0, .bot = 3, .delta = -1 }}, term.scrollOps());
+    try std.testing.expect(!term.dirty.isSet(3));
+}
+
+test "Term search over history" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 10, .rows = 4 },
+        },
+    );
+    defer term.deinit();
+
+    for ("ABCDEF") |ch| {
+        term.line[3][0].u = ch;
+        term.tscrollup(0, 1);
+    }
+    // history is blank,blank,blank,A,B,C and the grid D,E,F,blank: lines 0..9
+    term.search.start(&term, &[_]u32{'E'});
+    try std.testing.expectEqual(1, try term.search.step(&term, 100));
+    try std.testing.expectEqual(7, term.search.matches.items[0].line);
+
+    term.search.start(&term, &[_]u32{'B'});
+    try std.testing.expectEqual(1, try term.search.step(&term, 100));
+    const match = term.search.matches.items[0];
+    try std.testing.expectEqual(4, match.line);
+    try std.testing.expectEqual(0, match.col);
+
+    // the line keeps its number while output goes on
+    term.line[3][0].u = 'G';
+    term.tscrollup(0, 1);
+    try std.testing.expectEqual('B', term.lineAt(match.line).?[0].u);
+    term.showLine(match.line);
+    try std.testing.expectEqual('B', term.viewRow(2)[0].u);
+}
+
+test "Term resize reflows wrapped lines" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 10, .rows = 4 },
+        },
+    );
+    defer term.deinit();
+
+    for ("0123456789ABCDE") |ch| term.tputc(ch);
+    try std.testing.expect(term.line[0][9].mode.isSet(.ATTR_WRAP));
+
+    // wider: the two rows become one
+    try term.resize(20, 4);
+    try std.testing.expectEqual('E', term.line[0][14].u);
+    try std.testing.expectEqual(' ', term.line[1][0].u);
+    try std.testing.expectEqual(15, term.cursor.pos.x);
+    try std.testing.expectEqual(0, term.cursor.pos.y);
+
+    // narrower: the cursor moves with its cell
+    try term.resize(5, 4);
+    try std.testing.expectEqual('5', term.line[1][0].u);
+    try std.testing.expectEqual('A', term.line[2][0].u);
+    try std.testing.expect(term.line[2][4].mode.isSet(.ATTR_WRAP));
+    try std.testing.expectEqual(0, term.cursor.pos.x);
+    try std.testing.expectEqual(3, term.cursor.pos.y);
+
+    // fewer rows: the top of the line goes to the history
+    try term.resize(5, 2);
+    try std.testing.expectEqual(2, term.history.count);
+    try std.testing.expectEqual('A', term.line[0][0].u);
+    try std.testing.expectEqual(1, term.cursor.pos.y);
+
+    // and comes back from the history as one line
+    try term.resize(20, 4);
+    try std.testing.expectEqual(0, term.history.count);
+    try std.testing.expectEqual('0', term.line[0][0].u);
+    try std.testing.expectEqual('E', term.line[0][14].u);
+    try std.testing.expect(!term.line[0][14].mode.isSet(.ATTR_WRAP));
+    try std.testing.expectEqual(15, term.cursor.pos.x);
+    try std.testing.expectEqual(0, term.cursor.pos.y);
+}
+
+test "Term resize keeps unchanged history pages compressed" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 10, .rows = 4 },
+        },
+    );
+    defer term.deinit();
+
+    // two pages of short lines, the first one compressed
+    var row = [_]Glyph{Glyph.initEmpty()} ** 10;
+    for (0..512) |i| {
+        row[0].u = @intCast('a' + i % 26);
+        try term.history.pushRow(&row, .{ .width = 1 });
+    }
+    term.history.budget.hot_lines = 0;
+    try std.testing.expectEqual(1, try term.history.compressCold(1));
+
+    // narrower: no line changes, the newest ones come back above the cursor
+    try term.resize(8, 4);
+    try std.testing.expect(term.history.pages.get(0).?.rows == null);
+    try std.testing.expectEqual(509, term.history.count);
+    try std.testing.expectEqual('a', (try term.history.get(0)).?[0].u);
+    try std.testing.expectEqual('a' + 509 % 26, term.line[0][0].u);
+    try std.testing.expectEqual(' ', term.line[0][8].u);
+    try std.testing.expectEqual(Point{ .x = 0, .y = 3 }, term.cursor.pos);
+}
+
+test "Term resize places the cursor past wide characters" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 10, .rows = 4 },
+        },
+    );
+    defer term.deinit();
+
+    for ("abcdefgh") |ch| term.tputc(ch);
+    term.tputc(0x4E2D);
+    for ("xy") |ch| term.tputc(ch);
+    try std.testing.expectEqual(Point{ .x = 2, .y = 1 }, term.cursor.pos);
+
+    // the wide character does not fit in the last column and goes down,
+    // the cell it leaves empty moves the cursor one cell further
+    try term.resize(9, 4);
+    try std.testing.expectEqual(0x4E2D, term.line[1][0].u);
+    try std.testing.expectEqual('y', term.line[1][3].u);
+    try std.testing.expectEqual(Point{ .x = 4, .y = 1 }, term.cursor.pos);
+}
+
+test "Term resize carries grapheme clusters" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 10, .rows = 4 },
+        },
+    );
+    defer term.deinit();
+
+    term.tputs(&[_]u32{ 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'e', 0x0301, 'x' });
+    try std.testing.expectEqualSlices(u32, &.{0x0301}, term.graphemes.get(0, 7, 'e').?);
+
+    // the cluster moves with its cell to the next row
+    try term.resize(5, 4);
+    try std.testing.expect(term.line[1][2].mode.isSet(.ATTR_GRAPHEME));
+    try std.testing.expectEqualSlices(u32, &.{0x0301}, term.graphemes.get(1, 2, 'e').?);
+
+    // and stays when only the height changes
+    try term.resize(5, 3);
+    try std.testing.expectEqualSlices(u32, &.{0x0301}, term.graphemes.get(1, 2, 'e').?);
+}
+
+test "Term cursor moves cancel a pending wrap" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 10, .rows = 4 },
+        },
+    );
+    defer term.deinit();
+
+    // moving onto the cell the wrap is pending at still cancels it
+    for ("0123456789") |ch| term.tputc(ch);
+    term.tmoveto(9, 0);
+    term.tputc('X');
+    try std.testing.expectEqual('X', term.line[0][9].u);
+    try std.testing.expectEqual(Point{ .x = 9, .y = 0 }, term.cursor.pos);
+
+    // so does restoring a cursor saved there
+    term.tcursor(.CURSOR_SAVE);
+    term.tcursor(.CURSOR_LOAD);
+    term.tputc('Y');
+    try std.testing.expectEqual('Y', term.line[0][9].u);
+    try std.testing.expectEqual(' ', term.line[1][0].u);
+}
+
+test "Term wide characters" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 10, .rows = 4 },
+        },
+    );
+    defer term.deinit();
+
+    term.tputs(&[_]u32{ 'a', 0x4E2D, 0x0301 });
+    try std.testing.expect(term.line[0][1].mode.isSet(.ATTR_WIDE));
+    try std.testing.expect(term.line[0][2].mode.isSet(.ATTR_WDUMMY));
+    try std.testing.expectEqual(3, term.cursor.pos.x);
+
+    // overwriting the dummy half blanks the wide character
+    term.cursor.pos.x = 2;
+    term.tputc('b');
+    try std.testing.expectEqual(' ', term.line[0][1].u);
+    try std.testing.expect(!term.line[0][1].mode.isSet(.ATTR_WIDE));
+
+    // a wide character does not fit in the last cell
+    term.cursor.pos.x = 9;
+    term.tputc(0x4E2D);
+    try std.testing.expect(term.line[0][9].mode.isSet(.ATTR_WRAP));
+    try std.testing.expectEqual(0x4E2D, term.line[1][0].u);
+    try std.testing.expectEqual(2, term.cursor.pos.x);
+    try std.testing.expectEqual(1, term.cursor.pos.y);
+}
+
+test "Term grapheme clusters" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 10, .rows = 4 },
+        },
+    );
+    defer term.deinit();
+
+    // e + combining acute, then plain ASCII
+    term.tputs(&[_]u32{ 'e', 0x0301, 'x' });
+    try std.testing.expectEqual('e', term.line[0][0].u);
+    try std.testing.expect(term.line[0][0].mode.isSet(.ATTR_GRAPHEME));
+    try std.testing.expectEqualSlices(u32, &.{0x0301}, term.graphemes.get(0, 0, 'e').?);
+    try std.testing.expect(!term.line[0][1].mode.isSet(.ATTR_GRAPHEME));
+    try std.testing.expectEqual(2, term.cursor.pos.x);
+
+    // man ZWJ woman is one wide cell
+    term.tputs(&[_]u32{ 0x1F468, 0x200D, 0x1F469 });
+    try std.testing.expectEqual(0x1F468, term.line[0][2].u);
+    try std.testing.expectEqualSlices(u32, &.{ 0x200D, 0x1F469 }, term.graphemes.get(0, 2, 0x1F468).?);
+    try std.testing.expectEqual(4, term.cursor.pos.x);
+
+    // a mark after the cursor moved starts nothing
+    term.cursor.pos.x = 6;
+    term.tputc(0x0301);
+    try std.testing.expect(!term.line[0][6].mode.isSet(.ATTR_GRAPHEME));
+
+    // clusters move with their cells
+    term.cursor.pos.x = 0;
+    term.tinsertblank(1);
+    try std.testing.expectEqualSlices(u32, &.{0x0301}, term.graphemes.get(0, 1, 'e').?);
+    term.tscrolldown(0, 1);
+    try std.testing.expectEqualSlices(u32, &.{0x0301}, term.graphemes.get(1, 1, 'e').?);
+    try std.testing.expect(term.viewCluster(1, 1, term.line[1][1]) != null);
+
+    // overwritten cells lose their cluster
+    term.cursor.pos = .{ .x = 1, .y = 1 };
+    term.tputc('e');
+    try std.testing.expect(term.viewCluster(1, 1, term.line[1][1]) == null);
+}
+
+test "Term row metadata" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 10, .rows = 4 },
+        },
+    );
+    defer term.deinit();
+
+    term.tputs(&[_]u32{ 'a', 'b', 'c' });
+    try std.testing.expectEqual(3, term.meta[0].len);
+    try std.testing.expectEqual(3, term.linelen(0));
+
+    // only rows holding blinking text are redrawn for blink
+    term.cursor.pos = .{ .x = 0, .y = 2 };
+    var blink = [_]u32{5};
+    term.handle_sgr(&blink);
+    term.tputc('x');
+    term.dirty = DirtySet.initEmpty();
+    term.setdirtattr(.ATTR_BLINK);
+    try std.testing.expectEqual(1, term.dirty.count());
+    try std.testing.expect(term.dirty.isSet(2));
+
+    // insert and delete move the end of the row
+    term.cursor.pos = .{ .x = 0, .y = 0 };
+    term.tinsertblank(2);
+    try std.testing.expectEqual(5, term.meta[0].len);
+    term.tdeletechar(3);
+    try std.testing.expectEqual(2, term.meta[0].len);
+    term.tclearregion(1, 0, 9, 0);
+    try std.testing.expectEqual(1, term.meta[0].len);
+
+    // metadata moves with its row
+    term.tscrollup(0, 2);
+    try std.testing.expectEqual(1, term.meta[0].len);
+    try std.testing.expect(term.meta[0].attrs.isSet(.ATTR_BLINK));
+    try std.testing.expectEqual(0, term.meta[2].len);
+
+    // a wrapped row is full
+    term.cursor.pos = .{ .x = 0, .y = 3 };
+    for (0..12) |_| term.tputc('z');
+    try std.testing.expectEqual(10, term.meta[2].len);
+    try std.testing.expectEqual(10, term.linelen(2));
+}
+
+test "Term print modes" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 10, .rows = 4 },
+        },
+    );
+    defer term.deinit();
+
+    // filling the last column leaves the cursor there until the next print
+    term.tputascii("0123456789");
+    try std.testing.expectEqual(9, term.cursor.pos.x);
+    try std.testing.expectEqual(0, term.cursor.pos.y);
+    try std.testing.expect(!term.line[0][9].mode.isSet(.ATTR_WRAP));
+    term.tputc(0x0301);
+    try std.testing.expect(term.line[0][9].mode.isSet(.ATTR_GRAPHEME));
+    term.tputc('k');
+    try std.testing.expect(term.line[0][9].mode.isSet(.ATTR_WRAP));
+    try std.testing.expectEqual('k', term.line[1][0].u);
+    try std.testing.expectEqual(1, term.cursor.pos.x);
+
+    // moving the cursor drops the pending wrap
+    term.cursor.pos = .{ .x = 0, .y = 2 };
+    term.tputascii("aaaaaaaaaa");
+    term.cursor.pos.x = 0;
+    term.tputc('b');
+    try std.testing.expectEqual('b', term.line[2][0].u);
+    try std.testing.expectEqual(1, term.cursor.pos.x);
+    try std.testing.expectEqual(2, term.cursor.pos.y);
+
+    // without DECAWM the last column is overwritten
+    var decawm = [_]u32{7};
+    term.tsetmode(1, 0, &decawm, 1, &term.window.mode);
+    term.cursor.pos = .{ .x = 0, .y = 3 };
+    term.tputascii("0123456789XY");
+    try std.testing.expectEqual('Y', term.line[3][9].u);
+    try std.testing.expectEqual(9, term.cursor.pos.x);
+    try std.testing.expectEqual('0', term.line[0][0].u);
+    term.tsetmode(1, 1, &decawm, 1, &term.window.mode);
+
+    // IRM pushes the rest of the row right
+    var irm = [_]u32{4};
+    term.tsetmode(0, 1, &irm, 1, &term.window.mode);
+    term.cursor.pos = .{ .x = 0, .y = 1 };
+    term.tputs(&[_]u32{ 'a', 0x4E2D });
+    try std.testing.expectEqual('a', term.line[1][0].u);
+    try std.testing.expect(term.line[1][1].mode.isSet(.ATTR_WIDE));
+    try std.testing.expectEqual('k', term.line[1][3].u);
+    try std.testing.expectEqual(4, term.meta[1].len);
+    try std.testing.expectEqual(3, term.cursor.pos.x);
+    term.tsetmode(0, 0, &irm, 1, &term.window.mode);
+    try std.testing.expect(term.mode.isSet(.MODE_WRAP));
+}
+
+test "Term column damage" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 10, .rows = 4 },
+        },
+    );
+    defer term.deinit();
+    var blank: [10]Glyph = [_]Glyph{Glyph.initEmpty()} ** 10;
+
+    // a printed character damages its cell and the neighbours clearwide may touch
+    term.cursor.pos = .{ .x = 4, .y = 1 };
+    term.tputc('a');
+    try std.testing.expectEqual(1, term.dirty.count());
+    try std.testing.expectEqual([2]usize{ 3, 6 }, term.viewSpan(1, &blank));
+
+    // a cursor move damages the cell it left and the one it lands on
+    term.cleandirt();
+    term.tmoveto(8, 3);
+    try std.testing.expectEqual(2, term.dirty.count());
+    try std.testing.expectEqual([2]usize{ 5, 6 }, term.viewSpan(1, &blank));
+    try std.testing.expectEqual([2]usize{ 8, 9 }, term.viewSpan(3, &blank));
+
+    // the span never cuts a wide character in half
+    blank[5].mode.set(.ATTR_WIDE);
+    blank[6].mode.set(.ATTR_WDUMMY);
+    try std.testing.expectEqual([2]usize{ 5, 7 }, term.viewSpan(1, &blank));
+    term.set_dirt_span(2, 6, 7);
+    try std.testing.expectEqual([2]usize{ 5, 7 }, term.viewSpan(2, &blank));
+
+    // erasing to the end of the line and whole-row marks
+    term.cleandirt();
+    term.tclearregion(2, 0, 9, 0);
+    try std.testing.expectEqual([2]usize{ 2, 10 }, term.viewSpan(0, &blank));
+    term.set_dirt(3, 3);
+    try std.testing.expectEqual([2]usize{ 0, 10 }, term.viewSpan(3, &blank));
+}
+
+test "Term csi_rep fills runs" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 10, .rows = 4 },
+        },
+    );
+    defer term.deinit();
+
+    // a wide character cut by the run loses its other half
+    term.cursor.pos = .{ .x = 2, .y = 1 };
+    term.tputc(0x4E00);
+    term.cursor.pos = .{ .x = 7, .y = 0 };
+    term.tputc('a');
+    var rep = [_]u32{5};
+    term.csi_rep(&rep);
+    for (7..10) |x| try std.testing.expectEqual('a', term.line[0][x].u);
+    try std.testing.expect(term.line[0][9].mode.isSet(.ATTR_WRAP));
+    for (0..3) |x| try std.testing.expectEqual('a', term.line[1][x].u);
+    try std.testing.expect(!term.line[1][2].mode.isSet(.ATTR_WIDE));
+    try std.testing.expectEqual(' ', term.line[1][3].u);
+    try std.testing.expect(!term.line[1][3].mode.isSet(.ATTR_WDUMMY));
+    try std.testing.expectEqual(3, term.cursor.pos.x);
+    try std.testing.expectEqual(1, term.cursor.pos.y);
+    try std.testing.expectEqual(4, term.meta[1].len);
+
+    // wide characters are repeated one by one
+    term.tputc(0x4E00);
+    rep[0] = 3;
+    term.csi_rep(&rep);
+    try std.testing.expectEqual(0x4E00, term.line[1][7].u);
+    try std.testing.expect(term.line[1][8].mode.isSet(.ATTR_WDUMMY));
+    try std.testing.expectEqual(0x4E00, term.line[2][0].u);
+}
+
+test "Term cursor representation benchmark" {
+    const allocator = std.testing.allocator;
+    var term = try Term.init(
+        allocator,
+        .{
+            .mode = WinMode.initEmpty(),
+            .tty_grid = .{ .cols = 240, .rows = 67 },
+        },
+    );
+    defer term.deinit();
+    const iterations = 1_000_000;
+    var text: [4096]u32 = undefined;
+    for (&text, 0..) |*u, i| u.* = ' ' + @as(u32, @intCast(i % 95));
+    const rounds = iterations / text.len;
+    const chars = rounds * text.len;
+
+    // the cursor work of tputs replayed over the same text, with the rect
+    // union the cursor and the grid size used to be and with Point and Grid:
+    // read the position and the size, write the cell, advance or wrap
+    var tagged = rect.initPosition(0, 0);
+    const tagged_grid = rect.initGrid(240, 67);
+    var timer = try std.time.Timer.start();
+    for (0..rounds) |_| {
+        for (text) |u| {
+            const x = tagged.getX().?;
+            const y = tagged.getY().?;
+            term.line[@intCast(y)][@intCast(x)].u = u;
+            if (x + 1 < @as(i16, @intCast(tagged_grid.getCols().?))) {
+                tagged.addX(x + 1);
+            } else {
+                tagged.addX(0);
+                tagged.addY(if (y + 1 < @as(i16, @intCast(tagged_grid.getRows().?))) y + 1 else 0);
+            }
+        }
+        std.mem.doNotOptimizeAway(&tagged);
+    }
+    const union_ns = timer.read();
+    var plain: Point = .{};
+    const plain_grid = Grid{ .cols = 240, .rows = 67 };
+    timer.reset();
+    for (0..rounds) |_| {
+        for (text) |u| {
+            term.line[plain.y][plain.x].u = u;
+            if (plain.x + 1 < plain_grid.cols) {
+                plain.x += 1;
+            } else {
+                plain.x = 0;
+                plain.y = if (plain.y + 1 < plain_grid.rows) plain.y + 1 else 0;
+            }
+        }
+        std.mem.doNotOptimizeAway(&plain);
+    }
+    const plain_ns = timer.read();
+    std.debug.print("cursor bench: the tputs cursor trace takes {} ps per character with rect, {} ps with Point\n", .{
+        union_ns * 1000 / chars,
+        plain_ns * 1000 / chars,
+    });
+
+    // the whole per-character path on the same text
+    timer.reset();
+    for (0..rounds) |_| term.tputs(&text);
+    std.debug.print("cursor bench: {} ns per printed character\n", .{timer.read() / chars});
+}